@@ -0,0 +1,60 @@
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace profiling::allocation_counter {
+
+	std::atomic<bool> enabled{ false };
+	std::atomic<uint64_t> allocations{ 0 };
+	std::atomic<uint64_t> allocated_bytes{ 0 };
+
+} // namespace profiling::allocation_counter
+
+// Глобальные operator new и operator delete считают выделения памяти, пока замеры включены.
+// Формы с std::nothrow_t в стандартной библиотеке вызывают эти, выровненные формы не считаются.
+void* operator new(std::size_t size)
+{
+	if (profiling::allocation_counter::enabled.load(std::memory_order_relaxed)) {
+		profiling::allocation_counter::allocations.fetch_add(1, std::memory_order_relaxed);
+		profiling::allocation_counter::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	if (size == 0) {
+		size = 1;
+	}
+	while (true) {
+		if (void* pointer = std::malloc(size)) {
+			return pointer;
+		}
+		std::new_handler handler = std::get_new_handler();
+		if (handler == nullptr) {
+			throw std::bad_alloc();
+		}
+		handler();
+	}
+}
+
+void* operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
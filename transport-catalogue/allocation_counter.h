@@ -0,0 +1,17 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Счётчики выделений памяти для замеров этапов. Их ведут заменённые глобальные operator new и operator delete
+// из allocation_counter.cpp. Операторы вынесены в отдельную единицу трансляции без контейнеров:
+// встроенные в код контейнеров, они вызывают ложные предупреждения GCC -Wmismatched-new-delete о free
+// для памяти из operator new.
+namespace profiling::allocation_counter {
+
+	// Счётчики обновляются из operator new во всех потоках, поэтому атомарны
+	extern std::atomic<bool> enabled;
+	extern std::atomic<uint64_t> allocations;
+	extern std::atomic<uint64_t> allocated_bytes;
+
+} // namespace profiling::allocation_counter
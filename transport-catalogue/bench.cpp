@@ -0,0 +1,345 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "city_generator.h"
+#include "json.h"
+#include "json_builder.h"
+#include "map_renderer.h"
+#include "serialization.h"
+#include "transport_catalogue.h"
+#include "transport_router.h"
+
+// Бенчмарки основных этапов на синтетическом городе. Результат — JSON со временем каждого замера,
+// который можно сравнить с результатом прошлого прогона ключом --baseline.
+
+using namespace std;
+
+namespace {
+
+	struct Options {
+		city_generator::CityParams city;
+		city_generator::RequestMix mix;
+		size_t repeat = 3;
+		size_t routes = 1000;
+		string out;
+		string baseline;
+		string emit_base;
+		string emit_stat;
+	};
+
+	// Результат одного бенчмарка: ops операций в каждом из повторов
+	struct Result {
+		string name;
+		size_t ops = 1;
+		vector<double> samples_ms;
+
+		double Median() const
+		{
+			vector<double> sorted = samples_ms;
+			sort(sorted.begin(), sorted.end());
+			return sorted.empty() ? 0 : sorted[(sorted.size() - 1) / 2];
+		}
+	};
+
+	template <typename Func>
+	double TimeMs(Func&& func)
+	{
+		const auto start = chrono::steady_clock::now();
+		func();
+		return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+
+	// sample выполняет подготовку сам и возвращает время только измеряемой части
+	Result Measure(string name, size_t ops, size_t repeat, const function<double()>& sample)
+	{
+		Result result{ move(name), ops, {} };
+		result.samples_ms.reserve(repeat);
+		for (size_t i = 0; i < repeat; ++i) {
+			result.samples_ms.push_back(sample());
+		}
+		cerr << result.name << ": "sv << result.Median() << " ms\n"sv;
+		return result;
+	}
+
+	void FillStops(transport_catalogue::TransportCatalogue& db, const city_generator::City& city)
+	{
+		for (domain::StopToAdd stop : city.stops) {
+			db.AddStop(stop);
+		}
+	}
+
+	void FillBuses(transport_catalogue::TransportCatalogue& db, const city_generator::City& city)
+	{
+		for (const city_generator::BusSpec& bus : city.buses) {
+			db.AddBus(bus.name, bus.stops, bus.is_ring);
+		}
+	}
+
+	void WriteJson(const json::Node& node, const string& file)
+	{
+		ofstream out(file);
+		json::Print(json::Document(node), out);
+	}
+
+	// Медианы прошлого прогона по именам бенчмарков
+	map<string, double> LoadBaseline(const string& file)
+	{
+		map<string, double> medians;
+		ifstream in(file);
+		if (!in) {
+			return medians;
+		}
+		const json::Document doc = json::Load(in);
+		for (const json::Node& item : doc.GetRoot().AsMap().at("benchmarks"s).AsArray()) {
+			const json::Dict& bench = item.AsMap();
+			medians[bench.at("name"s).AsString()] = bench.at("median_ms"s).AsDouble();
+		}
+		return medians;
+	}
+
+	vector<Result> RunBenchmarks(const Options& options, const city_generator::City& city)
+	{
+		vector<Result> results;
+		const size_t repeat = max<size_t>(options.repeat, 1);
+
+		// Разбор JSON документа make_base
+		ostringstream base_text;
+		json::Print(json::Document(city_generator::MakeBaseDocument(city, "bench.db"s)), base_text);
+		const string base_json = base_text.str();
+		results.push_back(Measure("json_load"s, 1, repeat, [&base_json]() {
+			istringstream in(base_json);
+			return TimeMs([&in]() { json::Load(in); });
+		}));
+
+		// Добавление маршрутов в справочник, где уже есть все остановки
+		results.push_back(Measure("catalogue_add_bus"s, city.buses.size(), repeat, [&city]() {
+			transport_catalogue::TransportCatalogue db;
+			FillStops(db, city);
+			return TimeMs([&db, &city]() { FillBuses(db, city); });
+		}));
+
+		transport_catalogue::TransportCatalogue db;
+		FillStops(db, city);
+		FillBuses(db, city);
+		domain::RoutingSettings routing = city_generator::DefaultRoutingSettings();
+
+		results.push_back(Measure("graph_build"s, 1, repeat, [&db, &routing]() {
+			unique_ptr<transport_router::GraphBuilder> builder;
+			return TimeMs([&]() { builder = make_unique<transport_router::GraphBuilder>(db, routing); });
+		}));
+
+		// Построение полной таблицы маршрутов по готовому графу; последний маршрутизатор нужен дальше
+		unique_ptr<transport_router::RouteHandler> handler;
+		results.push_back(Measure("router_build"s, 1, repeat, [&db, &routing, &handler]() {
+			transport_router::GraphBuilder builder(db, routing);
+			handler.reset();
+			return TimeMs([&]() {
+				handler = make_unique<transport_router::RouteHandler>(db, routing, move(builder));
+			});
+		}));
+
+		const city_generator::RequestMix routes_mix{ options.routes, 0, 0, 1, 0, options.mix.seed };
+		const json::Node route_requests = city_generator::MakeStatRequests(city, routes_mix);
+		vector<pair<string, string>> pairs;
+		for (const json::Node& request : route_requests.AsArray()) {
+			pairs.emplace_back(request.AsMap().at("from"s).AsString(), request.AsMap().at("to"s).AsString());
+		}
+		results.push_back(Measure("build_route"s, pairs.size(), repeat, [&handler, &pairs]() {
+			transport_router::RouteBuffers buffers;
+			return TimeMs([&]() {
+				for (const auto& [from, to] : pairs) {
+					handler->BuildRoute(from, to, buffers);
+				}
+			});
+		}));
+
+		const filesystem::path db_file = filesystem::temp_directory_path() / "transport_catalogue_bench.db";
+		const renderer::SVG_Settings render = city_generator::DefaultRenderSettings();
+		results.push_back(Measure("serialize_save"s, 1, repeat, [&]() {
+			transport_catalogue::serialize::Serialize serialize(db, filesystem::path(db_file));
+			serialize.SetSVGSettings(render);
+			serialize.SetRoutingSettings(routing);
+			serialize.SetGraph(handler->GetGrahpPtr());
+			serialize.SetRouter(handler->GetRouterPtr());
+			return TimeMs([&serialize]() { serialize.Save(); });
+		}));
+		results.push_back(Measure("deserialize_load"s, 1, repeat, [&db_file]() {
+			transport_catalogue::TransportCatalogue loaded;
+			transport_catalogue::serialize::Deserialize deserialize(loaded, filesystem::path(db_file));
+			return TimeMs([&deserialize]() { deserialize.Load(); });
+		}));
+		filesystem::remove(db_file);
+
+		const map<string_view, domain::Bus*> buses = db.GetAllBuses();
+		results.push_back(Measure("map_draw"s, 1, repeat, [&]() {
+			renderer::MapRenderer renderer(render, db.GetStopsList());
+			return TimeMs([&]() { renderer.DrawMap(buses); });
+		}));
+		results.push_back(Measure("map_render"s, 1, repeat, [&]() {
+			renderer::MapRenderer renderer(render, db.GetStopsList());
+			string svg;
+			return TimeMs([&]() { renderer.RenderMap(buses, svg, 1); });
+		}));
+		results.push_back(Measure("map_render_parallel"s, 1, repeat, [&]() {
+			renderer::MapRenderer renderer(render, db.GetStopsList());
+			string svg;
+			return TimeMs([&]() { renderer.RenderMap(buses, svg); });
+		}));
+
+		return results;
+	}
+
+	json::Node MakeReport(const Options& options, const vector<Result>& results)
+	{
+		const map<string, double> baseline = options.baseline.empty() ? map<string, double>{} : LoadBaseline(options.baseline);
+
+		json::Builder builder;
+		auto report = builder.StartDict();
+		report.Key("city"s).StartDict()
+			.Key("stops"s).Value(static_cast<int>(options.city.stop_count))
+			.Key("buses"s).Value(static_cast<int>(options.city.bus_count))
+			.Key("min_route_stops"s).Value(static_cast<int>(options.city.min_route_stops))
+			.Key("max_route_stops"s).Value(static_cast<int>(options.city.max_route_stops))
+			.Key("ring_ratio"s).Value(options.city.ring_ratio)
+			.Key("distance_density"s).Value(options.city.distance_density)
+			.Key("seed"s).Value(static_cast<int>(options.city.seed))
+			.EndDict();
+		report.Key("threads"s).Value(static_cast<int>(thread::hardware_concurrency()));
+
+		auto benchmarks = report.Key("benchmarks"s).StartArray();
+		for (const Result& result : results) {
+			const double median = result.Median();
+			auto item = benchmarks.StartDict();
+			item.Key("name"s).Value(result.name)
+				.Key("ops"s).Value(static_cast<int>(result.ops))
+				.Key("median_ms"s).Value(median)
+				.Key("min_ms"s).Value(*min_element(result.samples_ms.begin(), result.samples_ms.end()))
+				.Key("max_ms"s).Value(*max_element(result.samples_ms.begin(), result.samples_ms.end()))
+				.Key("median_us_per_op"s).Value(median * 1000 / max<size_t>(result.ops, 1));
+			// Отношение больше 1 — замедление относительно прошлого прогона
+			if (auto it = baseline.find(result.name); it != baseline.end() && it->second > 0) {
+				item.Key("baseline_median_ms"s).Value(it->second)
+					.Key("ratio"s).Value(median / it->second);
+			}
+			item.EndDict();
+		}
+		benchmarks.EndArray();
+		return report.EndDict().Build();
+	}
+
+	void PrintUsage(ostream& stream = cerr)
+	{
+		stream << "Usage: transport_catalogue_bench [--stops N] [--buses N] [--min-route N] [--max-route N]\n"sv
+			<< "    [--ring-ratio X] [--distance-density X] [--seed N] [--repeat N] [--routes N]\n"sv
+			<< "    [--out FILE] [--baseline FILE] [--emit-base FILE] [--emit-stat FILE] [--stat-count N]\n"sv;
+	}
+
+	bool ParseOptions(int argc, char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const string_view name(argv[i]);
+			if (i + 1 >= argc) {
+				return false;
+			}
+			const string value(argv[++i]);
+			if (name == "--stops"sv) {
+				options.city.stop_count = stoul(value);
+			}
+			else if (name == "--buses"sv) {
+				options.city.bus_count = stoul(value);
+			}
+			else if (name == "--min-route"sv) {
+				options.city.min_route_stops = stoul(value);
+			}
+			else if (name == "--max-route"sv) {
+				options.city.max_route_stops = stoul(value);
+			}
+			else if (name == "--ring-ratio"sv) {
+				options.city.ring_ratio = stod(value);
+			}
+			else if (name == "--distance-density"sv) {
+				options.city.distance_density = stod(value);
+			}
+			else if (name == "--seed"sv) {
+				options.city.seed = stoull(value);
+				options.mix.seed = options.city.seed;
+			}
+			else if (name == "--repeat"sv) {
+				options.repeat = stoul(value);
+			}
+			else if (name == "--routes"sv) {
+				options.routes = stoul(value);
+			}
+			else if (name == "--stat-count"sv) {
+				options.mix.count = stoul(value);
+			}
+			else if (name == "--out"sv) {
+				options.out = value;
+			}
+			else if (name == "--baseline"sv) {
+				options.baseline = value;
+			}
+			else if (name == "--emit-base"sv) {
+				options.emit_base = value;
+			}
+			else if (name == "--emit-stat"sv) {
+				options.emit_stat = value;
+			}
+			else {
+				return false;
+			}
+		}
+		return true;
+	}
+
+} // namespace
+
+// С --emit-base/--emit-stat только записывает документы make_base и process_requests для сгенерированного города,
+// иначе прогоняет бенчмарки.
+int main(int argc, char* argv[]) {
+	Options options;
+	try {
+		if (!ParseOptions(argc, argv, options)) {
+			PrintUsage();
+			return 1;
+		}
+	}
+	catch (const logic_error&) {
+		PrintUsage();
+		return 1;
+	}
+
+	const city_generator::City city = city_generator::MakeCity(options.city);
+
+	if (!options.emit_base.empty() || !options.emit_stat.empty()) {
+		const string db_file = "transport_catalogue.db"s;
+		if (!options.emit_base.empty()) {
+			WriteJson(city_generator::MakeBaseDocument(city, db_file), options.emit_base);
+		}
+		if (!options.emit_stat.empty()) {
+			WriteJson(city_generator::MakeStatDocument(city, options.mix, db_file), options.emit_stat);
+		}
+		return 0;
+	}
+
+	const json::Node report = MakeReport(options, RunBenchmarks(options, city));
+	if (options.out.empty()) {
+		json::Print(json::Document(report), cout);
+		cout << '\n';
+	}
+	else {
+		WriteJson(report, options.out);
+	}
+
+	google::protobuf::ShutdownProtobufLibrary();
+}
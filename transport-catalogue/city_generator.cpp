@@ -0,0 +1,341 @@
+#include "city_generator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string_view>
+
+#include "geo.h"
+#include "json_builder.h"
+
+namespace city_generator {
+	using namespace std::literals;
+
+	namespace {
+		// Границы города в градусах
+		const double MIN_LATITUDE = 55.5;
+		const double MAX_LATITUDE = 55.8;
+		const double MIN_LONGITUDE = 37.4;
+		const double MAX_LONGITUDE = 37.8;
+		// Дорога длиннее расстояния по прямой в [1.1, 1.5) раза
+		const double MIN_ROAD_FACTOR = 1.1;
+		const double ROAD_FACTOR_SPREAD = 0.4;
+
+		// splitmix64: последовательность зависит только от seed, в отличие от std::uniform_*_distribution
+		class Random {
+		public:
+			explicit Random(uint64_t seed)
+				: state_(seed) {
+			}
+
+			uint64_t Next()
+			{
+				uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				return z ^ (z >> 31);
+			}
+
+			// Равномерно в [0, 1)
+			double Uniform()
+			{
+				return static_cast<double>(Next() >> 11) * (1. / 9007199254740992.);
+			}
+
+			// Равномерно в [0, bound)
+			size_t Index(size_t bound)
+			{
+				return bound > 0 ? static_cast<size_t>(Next() % bound) : 0;
+			}
+
+		private:
+			uint64_t state_;
+		};
+
+		// Сетка узлов, в которых стоят остановки: узел (row, column) — остановка row * columns + column
+		struct Grid {
+			size_t columns = 1;
+			size_t stop_count = 0;
+
+			bool IsValid(long long row, long long column) const
+			{
+				return row >= 0 && column >= 0 && column < static_cast<long long>(columns)
+					&& static_cast<size_t>(row) * columns + static_cast<size_t>(column) < stop_count;
+			}
+
+			// Число строк, заполненных целиком
+			size_t FullRows() const
+			{
+				return stop_count / columns;
+			}
+		};
+
+		std::string StopName(size_t index)
+		{
+			return "Stop "s + std::to_string(index);
+		}
+
+		// Линейный маршрут — случайное блуждание по соседним узлам без немедленного возврата назад
+		std::vector<size_t> MakeLinearRoute(const Grid& grid, size_t length, Random& random)
+		{
+			static const int STEPS[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+			std::vector<size_t> route;
+			size_t current = random.Index(grid.stop_count);
+			route.push_back(current);
+			int previous_step = -1;
+			while (route.size() < length) {
+				const long long row = static_cast<long long>(current / grid.columns);
+				const long long column = static_cast<long long>(current % grid.columns);
+				int candidates[4];
+				int candidate_count = 0;
+				for (int step = 0; step < 4; ++step) {
+					// Шаг, обратный предыдущему, даёт тот же перегон в другую сторону
+					if (previous_step >= 0 && (step ^ 1) == previous_step) {
+						continue;
+					}
+					if (grid.IsValid(row + STEPS[step][0], column + STEPS[step][1])) {
+						candidates[candidate_count++] = step;
+					}
+				}
+				if (candidate_count == 0) {
+					break;
+				}
+				previous_step = candidates[random.Index(candidate_count)];
+				current = static_cast<size_t>(row + STEPS[previous_step][0]) * grid.columns
+					+ static_cast<size_t>(column + STEPS[previous_step][1]);
+				route.push_back(current);
+			}
+			return route;
+		}
+
+		// Кольцевой маршрут обходит периметр прямоугольника из целиком заполненных строк сетки
+		// и заканчивается в начальной остановке
+		std::vector<size_t> MakeRingRoute(const Grid& grid, size_t length, Random& random)
+		{
+			const size_t rows = grid.FullRows();
+			if (rows < 2 || grid.columns < 2) {
+				return MakeLinearRoute(grid, length, random);
+			}
+			// Периметр прямоугольника width x height узлов — 2 * (width + height - 2) перегонов
+			const size_t half = std::max<size_t>(length / 2 + 1, 2);
+			const size_t width = std::clamp<size_t>(2 + random.Index(half - 1), 2, grid.columns);
+			const size_t height = std::clamp<size_t>(half + 2 - width, 2, rows);
+			const size_t top = random.Index(rows - height + 1);
+			const size_t left = random.Index(grid.columns - width + 1);
+
+			std::vector<size_t> route;
+			const auto add = [&](size_t row, size_t column) {
+				route.push_back(row * grid.columns + column);
+			};
+			for (size_t column = left; column < left + width - 1; ++column) {
+				add(top, column);
+			}
+			for (size_t row = top; row < top + height - 1; ++row) {
+				add(row, left + width - 1);
+			}
+			for (size_t column = left + width - 1; column > left; --column) {
+				add(top + height - 1, column);
+			}
+			for (size_t row = top + height - 1; row > top; --row) {
+				add(row, left);
+			}
+			route.push_back(route.front());
+			return route;
+		}
+
+		json::Node RenderSettingsToJson(const renderer::SVG_Settings& settings)
+		{
+			json::Array palette;
+			for (const std::string& color : settings.color_palette) {
+				palette.emplace_back(color);
+			}
+			return json::Builder{}.StartDict()
+				.Key("width"s).Value(settings.width)
+				.Key("height"s).Value(settings.height)
+				.Key("padding"s).Value(settings.padding)
+				.Key("line_width"s).Value(settings.line_width)
+				.Key("stop_radius"s).Value(settings.stop_radius)
+				.Key("bus_label_font_size"s).Value(settings.bus_label_font_size)
+				.Key("bus_label_offset"s).Value(json::Array{ settings.bus_label_offset.dx, settings.bus_label_offset.dy })
+				.Key("stop_label_font_size"s).Value(settings.stop_label_font_size)
+				.Key("stop_label_offset"s).Value(json::Array{ settings.stop_label_offset.dx, settings.stop_label_offset.dy })
+				.Key("underlayer_color"s).Value(settings.underlayer_color)
+				.Key("underlayer_width"s).Value(settings.underlayer_width)
+				.Key("color_palette"s).Value(std::move(palette))
+				.EndDict().Build();
+		}
+	} // namespace
+
+	City MakeCity(const CityParams& params)
+	{
+		Random random(params.seed);
+		City city;
+
+		Grid grid;
+		grid.stop_count = params.stop_count;
+		grid.columns = std::max<size_t>(static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(params.stop_count)))), 1);
+		const size_t rows = (params.stop_count + grid.columns - 1) / std::max<size_t>(grid.columns, 1);
+
+		// Узлы сетки сдвигаются не больше чем на треть шага, чтобы соседние остановки не менялись местами
+		const double lat_step = (MAX_LATITUDE - MIN_LATITUDE) / std::max<size_t>(rows, 1);
+		const double lng_step = (MAX_LONGITUDE - MIN_LONGITUDE) / grid.columns;
+		city.stops.reserve(params.stop_count);
+		for (size_t index = 0; index < params.stop_count; ++index) {
+			const size_t row = index / grid.columns;
+			const size_t column = index % grid.columns;
+			const double latitude = MAX_LATITUDE - (row + 0.5 + (random.Uniform() - 0.5) / 1.5) * lat_step;
+			const double longitude = MIN_LONGITUDE + (column + 0.5 + (random.Uniform() - 0.5) / 1.5) * lng_step;
+			city.stops.push_back({ StopName(index), latitude, longitude, {} });
+		}
+
+		const auto addDistance = [&city, &random](size_t from, size_t to) {
+			std::vector<domain::DistanceToStop>& distances = city.stops[from].distance_to_stop;
+			const std::string& name = city.stops[to].stop_name;
+			if (std::any_of(distances.begin(), distances.end(), [&name](const domain::DistanceToStop& item) { return item.stop_name == name; })) {
+				return;
+			}
+			const double geo_distance = geo::ComputeDistance(
+				{ city.stops[from].latitude, city.stops[from].longitude },
+				{ city.stops[to].latitude, city.stops[to].longitude });
+			const double road_distance = geo_distance * (MIN_ROAD_FACTOR + ROAD_FACTOR_SPREAD * random.Uniform());
+			distances.push_back({ name, std::max(static_cast<int>(std::lround(road_distance)), 1) });
+		};
+
+		const size_t min_length = std::max<size_t>(params.min_route_stops, 2);
+		const size_t max_length = std::max(params.max_route_stops, min_length);
+		city.buses.reserve(params.bus_count);
+		for (size_t index = 0; params.stop_count > 1 && index < params.bus_count; ++index) {
+			const size_t length = min_length + random.Index(max_length - min_length + 1);
+			const bool is_ring = random.Uniform() < params.ring_ratio;
+			const std::vector<size_t> route = is_ring
+				? MakeRingRoute(grid, length, random)
+				: MakeLinearRoute(grid, length, random);
+
+			BusSpec bus{ "Bus "s + std::to_string(index), {}, is_ring };
+			bus.stops.reserve(route.size());
+			for (size_t i = 0; i < route.size(); ++i) {
+				bus.stops.push_back(city.stops[route[i]].stop_name);
+				if (i > 0) {
+					addDistance(route[i - 1], route[i]);
+					if (random.Uniform() < params.distance_density) {
+						addDistance(route[i], route[i - 1]);
+					}
+				}
+			}
+			city.buses.push_back(std::move(bus));
+		}
+		return city;
+	}
+
+	json::Node MakeBaseRequests(const City& city)
+	{
+		json::Array requests;
+		requests.reserve(city.stops.size() + city.buses.size());
+		for (const domain::StopToAdd& stop : city.stops) {
+			json::Dict distances;
+			for (const domain::DistanceToStop& distance : stop.distance_to_stop) {
+				distances.emplace(distance.stop_name, distance.distance);
+			}
+			requests.emplace_back(json::Dict{
+				{ "type"s, "Stop"s },
+				{ "name"s, stop.stop_name },
+				{ "latitude"s, stop.latitude },
+				{ "longitude"s, stop.longitude },
+				{ "road_distances"s, std::move(distances) } });
+		}
+		for (const BusSpec& bus : city.buses) {
+			json::Array stops(bus.stops.begin(), bus.stops.end());
+			requests.emplace_back(json::Dict{
+				{ "type"s, "Bus"s },
+				{ "name"s, bus.name },
+				{ "stops"s, std::move(stops) },
+				{ "is_roundtrip"s, bus.is_ring } });
+		}
+		return requests;
+	}
+
+	json::Node MakeStatRequests(const City& city, const RequestMix& mix)
+	{
+		Random random(mix.seed);
+		const double total = mix.bus + mix.stop + mix.route + mix.map;
+		// Концы маршрутов берутся среди остановок, через которые ходят автобусы, иначе половина запросов Route
+		// заканчивается "not found" без поиска
+		std::vector<std::string_view> served;
+		for (const BusSpec& bus : city.buses) {
+			served.insert(served.end(), bus.stops.begin(), bus.stops.end());
+		}
+		std::sort(served.begin(), served.end());
+		served.erase(std::unique(served.begin(), served.end()), served.end());
+
+		json::Array requests;
+		requests.reserve(mix.count);
+		for (size_t index = 0; index < mix.count; ++index) {
+			const int id = static_cast<int>(index + 1);
+			const double pick = random.Uniform() * total;
+			if (pick < mix.bus && !city.buses.empty()) {
+				requests.emplace_back(json::Dict{
+					{ "id"s, id }, { "type"s, "Bus"s }, { "name"s, city.buses[random.Index(city.buses.size())].name } });
+			}
+			else if (pick < mix.bus + mix.stop && !city.stops.empty()) {
+				requests.emplace_back(json::Dict{
+					{ "id"s, id }, { "type"s, "Stop"s }, { "name"s, city.stops[random.Index(city.stops.size())].stop_name } });
+			}
+			else if (pick < mix.bus + mix.stop + mix.route && !served.empty()) {
+				const std::string_view from = served[random.Index(served.size())];
+				const std::string_view to = served[random.Index(served.size())];
+				requests.emplace_back(json::Dict{
+					{ "id"s, id }, { "type"s, "Route"s }, { "from"s, std::string(from) }, { "to"s, std::string(to) } });
+			}
+			else {
+				requests.emplace_back(json::Dict{ { "id"s, id }, { "type"s, "Map"s } });
+			}
+		}
+		return requests;
+	}
+
+	json::Node MakeBaseDocument(const City& city, const std::string& db_file)
+	{
+		const domain::RoutingSettings routing = DefaultRoutingSettings();
+		return json::Dict{
+			{ "serialization_settings"s, json::Dict{ { "file"s, db_file } } },
+			{ "routing_settings"s, json::Dict{
+				{ "bus_wait_time"s, routing.bus_wait_time },
+				{ "bus_velocity"s, routing.bus_velocity } } },
+			{ "render_settings"s, RenderSettingsToJson(DefaultRenderSettings()) },
+			{ "base_requests"s, MakeBaseRequests(city) } };
+	}
+
+	json::Node MakeStatDocument(const City& city, const RequestMix& mix, const std::string& db_file)
+	{
+		return json::Dict{
+			{ "serialization_settings"s, json::Dict{ { "file"s, db_file } } },
+			{ "stat_requests"s, MakeStatRequests(city, mix) } };
+	}
+
+	domain::RoutingSettings DefaultRoutingSettings()
+	{
+		domain::RoutingSettings settings;
+		settings.bus_wait_time = 6;
+		settings.bus_velocity = 40;
+		return settings;
+	}
+
+	renderer::SVG_Settings DefaultRenderSettings()
+	{
+		renderer::SVG_Settings settings;
+		settings.width = 1200;
+		settings.height = 500;
+		settings.padding = 50;
+		settings.line_width = 14;
+		settings.stop_radius = 5;
+		settings.bus_label_font_size = 20;
+		settings.bus_label_offset = { 7, 15 };
+		settings.stop_label_font_size = 18;
+		settings.stop_label_offset = { 7, -3 };
+		settings.underlayer_color = "rgba(255,255,255,0.85)"s;
+		settings.underlayer_width = 3;
+		settings.color_palette = { "green"s, "rgb(255,160,0)"s, "red"s };
+		return settings;
+	}
+
+} // namespace city_generator
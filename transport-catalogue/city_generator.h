@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "domain.h"
+#include "json.h"
+#include "map_renderer.h"
+
+// Генератор синтетических городов для бенчмарков и нагрузочных прогонов.
+// Остановки стоят в узлах сетки со случайным сдвигом, маршруты идут по соседним узлам,
+// поэтому линии на карте и расстояния между остановками похожи на настоящие.
+namespace city_generator {
+
+	// При одинаковых параметрах город получается одинаковым на любой платформе:
+	// используется собственный генератор случайных чисел, а не распределения стандартной библиотеки.
+	struct CityParams {
+		size_t stop_count = 1000;
+		size_t bus_count = 120;
+		// Число остановок маршрута распределено равномерно в [min_route_stops, max_route_stops]
+		size_t min_route_stops = 5;
+		size_t max_route_stops = 20;
+		// Доля кольцевых маршрутов
+		double ring_ratio = 0.4;
+		// Для каждого перегона маршрута расстояние задаётся в прямую сторону; с этой вероятностью
+		// отдельно задаётся и обратное, иначе оно берётся из прямого
+		double distance_density = 0.5;
+		uint64_t seed = 1;
+	};
+
+	struct BusSpec {
+		std::string name;
+		std::vector<std::string> stops;
+		bool is_ring = false;
+	};
+
+	struct City {
+		std::vector<domain::StopToAdd> stops;
+		std::vector<BusSpec> buses;
+	};
+
+	// Доли типов запросов в наборе stat_requests
+	struct RequestMix {
+		size_t count = 100;
+		double bus = 0.2;
+		double stop = 0.2;
+		double route = 0.55;
+		double map = 0.05;
+		uint64_t seed = 1;
+	};
+
+	City MakeCity(const CityParams& params);
+
+	// Массив base_requests в формате make_base
+	json::Node MakeBaseRequests(const City& city);
+	// Массив stat_requests со случайными запросами Bus, Stop, Route и Map в долях mix
+	json::Node MakeStatRequests(const City& city, const RequestMix& mix);
+
+	// Полные документы make_base и process_requests с настройками по умолчанию
+	json::Node MakeBaseDocument(const City& city, const std::string& db_file);
+	json::Node MakeStatDocument(const City& city, const RequestMix& mix, const std::string& db_file);
+
+	// Настройки, общие для документов генератора и бенчмарков
+	domain::RoutingSettings DefaultRoutingSettings();
+	renderer::SVG_Settings DefaultRenderSettings();
+
+} // namespace city_generator
@@ -23,7 +23,8 @@ namespace domain {
 		std::vector<Stop*> stop_for_bus_forward;
 		std::string_view name;
 		Stop* secondFinalStop;
-		const bool is_ring;
+		// Не константа: при обновлении базы маршрут может смениться с кольцевого на линейный и наоборот
+		bool is_ring;
 		double distance_by_geo;
 		double distance_by_road;
 		size_t id;
@@ -66,6 +67,8 @@ namespace domain {
 	struct RoutingSettings {
 		double bus_wait_time;
 		int bus_velocity;
+		// Скорость пешехода (км/ч) для пеших участков маршрута между точкой и остановкой.
+		double pedestrian_velocity = 5.0;
 	};
 
 	struct RouteItem_Wait {
@@ -76,8 +79,18 @@ namespace domain {
 		std::string_view bus_name;
 		double time = 0;
 		int span_count = 0;
+		// Ребро графа, по которому построен участок: по нему участок можно нарисовать на карте
+		const Bus* bus = nullptr;
+		size_t from_stop = 0;
+		size_t to_stop = 0;
 	};
 	struct RouteItem_NoWay {
 	};
+	// Пеший участок маршрута. Пустое имя остановки означает произвольную точку (начало или конец маршрута).
+	struct RouteItem_Walk {
+		double time = 0;
+		std::string_view from_stop;
+		std::string_view to_stop;
+	};
 
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "ranges.h"
 #include "domain.h"
+#include "memory_usage.h"
 
 #include <cstdlib>
 #include <vector>
@@ -44,6 +45,8 @@ namespace graph {
 		const std::vector<Edge<Weight>>& GetEdges() const;
 		const std::vector<IncidenceList>& GetIncidenceList() const;
 
+		std::vector<memory::Usage> GetMemoryUsage() const;
+
 	private:
 		std::vector<Edge<Weight>> edges_;
 		std::vector<IncidenceList> incidence_lists_;
@@ -104,5 +107,17 @@ namespace graph {
 	{
 		return incidence_lists_;
 	}
+	template<typename Weight>
+	inline std::vector<memory::Usage> DirectedWeightedGraph<Weight>::GetMemoryUsage() const
+	{
+		size_t incidence_bytes = memory::VectorBytes(incidence_lists_);
+		for (const IncidenceList& list : incidence_lists_) {
+			incidence_bytes += memory::VectorBytes(list);
+		}
+		return {
+			{ "graph_edges", edges_.size(), memory::VectorBytes(edges_) },
+			{ "graph_incidence_lists", incidence_lists_.size(), incidence_bytes },
+		};
+	}
 
 }  // namespace graph
\ No newline at end of file
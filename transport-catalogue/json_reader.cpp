@@ -1,4 +1,7 @@
 #include "json_reader.h"
+#include "latency.h"
+#include "profiling.h"
+#include "route_table.h"
 
 namespace jsonReader {
 	using namespace std;
@@ -19,9 +22,17 @@ namespace jsonReader {
 		if (jDoc_.GetRoot().IsDict() && jDoc_.GetRoot().AsMap().size() != 0) {
 			// Загрузка данных
 			const json::Node& base_requests_node = jDoc_.GetRoot().AsMap().find("base_requests")->second;
-			BaseRequests(base_requests_node);
-
-			ProcessRequestPool(request_pool_);
+			{
+				profiling::Phase phase("parse_requests"sv);
+				BaseRequests(base_requests_node);
+			}
+			{
+				profiling::Phase phase("fill_catalogue"sv);
+				ProcessRequestPool(request_pool_);
+			}
+			renderedMap_.reset();
+			mapLayouts_.clear();
+			stopProjection_.reset();
 		}
 	}
 
@@ -36,12 +47,21 @@ namespace jsonReader {
 		auto it = jDoc_.GetRoot().AsMap().find("stat_requests");
 		if (it != jDoc_.GetRoot().AsMap().end()) {
 			const json::Node& stat_requests_node = it->second;
+			optional<profiling::Phase> phase;
+			phase.emplace("answer"sv);
 			json::Document jDocStatResult = StatRequests(stat_requests_node);
 
+			phase.reset();
+			phase.emplace("print"sv);
 			json::Print(jDocStatResult, os);
 		}
 	}
 
+	json::Document JsonReader::ProcessStatRequests(const json::Node& requests) const
+	{
+		return StatRequests(requests);
+	}
+
 	// Сериализует базу данных в бинарный файл
 	void JsonReader::ProcessSerialization()
 	{
@@ -49,32 +69,181 @@ namespace jsonReader {
 		if (it != jDoc_.GetRoot().AsMap().end()) {
 			json::Node& fileName = it->second.AsMap().find("file")->second;
 
-			transport_catalogue::serialize::Serialize serialize(data_base_, filesystem::path(fileName.AsString()));
-			serialize.SetSVGSettings(GetRenderSettings());
-			GetRoutingSettings();
+			svgSettings_ = GetRenderSettings();
+			{
+				profiling::Phase phase("routing"sv);
+				GetRoutingSettings();
+			}
+			SaveBase(filesystem::path(fileName.AsString()));
+		}
+	}
+
+	void JsonReader::SaveBase(filesystem::path&& file)
+	{
+		const filesystem::path routeTableFile = transport_router::RouteTablePath(file);
+		transport_catalogue::serialize::Serialize serialize(data_base_, move(file));
+		serialize.SetSVGSettings(svgSettings_);
+		// Без routing_settings маршрутизатор не строится: в базу попадают справочник и настройки карты
+		if (router_) {
 			serialize.SetRoutingSettings(routingSettings_);
 			serialize.SetGraph(router_->GetGrahpPtr());
-			serialize.SetRouter(router_->GetRouterPtr());
-			serialize.Save();
 		}
+		// Проекция остановок небольшая, поэтому сохраняется всегда: отрисовка после загрузки не пересчитывает координаты
+		shared_ptr<const renderer::StopProjection> stopProjection;
+		{
+			profiling::Phase phase("stop_projection"sv);
+			stopProjection = GetStopProjection();
+		}
+		serialize.SetStopProjection(stopProjection.get());
+		// "store_map": true — карта отрисовывается заранее, и запросы Map после загрузки её только копируют
+		shared_ptr<const renderer::RenderedMap> renderedMap;
+		if (StoreMapInBase()) {
+			profiling::Phase phase("render_map"sv);
+			renderedMap = GetRenderedMap();
+			serialize.SetRenderedMap(renderedMap.get());
+		}
+		// "store_router": false — в базу попадают только справочник и граф,
+		// таблица маршрутов перестраивается при загрузке.
+		// "external_router": true — таблица строится блоками строк прямо в файл рядом с базой,
+		// не занимая больше "router_memory_limit_mb", а запросы потом читают её из файла по ячейкам
+		if (router_ && ExternalRouterInBase()) {
+			if (transport_router::WriteRouteTable(*router_->GetRouterPtr(), *router_->GetGrahpPtr(), routeTableFile, GetRouteTableMemoryLimit())) {
+				serialize.SetRouteTableFile(routeTableFile);
+			}
+			else {
+				cerr << "Cannot write route table to "sv << routeTableFile.string() << '\n';
+			}
+		}
+		else {
+			// Таблица прежней версии базы больше не нужна
+			error_code ec;
+			filesystem::remove(routeTableFile, ec);
+			if (router_ && StoreRouterInBase()) {
+				serialize.SetRouter(router_->GetRouterPtr());
+			}
+		}
+		serialize.Save();
+	}
+
+	// Обновляет существующую базу: загружает её целиком, применяет update_requests и сохраняет в тот же файл.
+	// Граф строится заново, а таблица маршрутов, если рёбра только добавились или подешевели,
+	// дополняется через изменённые рёбра; иначе она строится заново целиком. Если удалить остановку
+	// не удалось, база остаётся прежней.
+	bool JsonReader::ProcessBaseUpdate()
+	{
+		auto it = jDoc_.GetRoot().AsMap().find("serialization_settings");
+		if (it == jDoc_.GetRoot().AsMap().end()) {
+			return true;
+		}
+		filesystem::path file(it->second.AsMap().at("file").AsString());
+
+		transport_catalogue::serialize::Deserialize deserialize(data_base_, filesystem::path(file));
+		// Повреждённая база не перезаписывается: обновлять в ней нечего
+		if (!deserialize.Load(transport_catalogue::serialize::ALL_SECTIONS)) {
+			cerr << "Cannot load base "sv << file.string() << '\n';
+			return false;
+		}
+		if (optional<renderer::SVG_Settings> svgSetts = deserialize.GetSVGSettings()) {
+			svgSettings_ = move(svgSetts.value());
+		}
+		svgSettings_ = GetRenderSettings();
+
+		// Ключи рёбер запоминаются до изменения справочника: указатели на маршруты в рёбрах могут стать недействительными
+		const vector<transport_router::EdgeKey> old_edges = transport_router::GraphBuilder::GetEdgeKeys(deserialize.GetEdges());
+		graph::Router<double>::RoutesInternalData& routes_data = deserialize.GetRoutesInternalData();
+		// Базу с внешней таблицей нельзя пересохранить с таблицей в памяти: ради этого таблица и вынесена из базы
+		if (deserialize.GetRouteTableFile()) {
+			loadedRouterStorage_ = RouterStorage::External;
+		}
+		else {
+			loadedRouterStorage_ = routes_data.empty() ? RouterStorage::Rebuilt : RouterStorage::InBase;
+		}
+
+		auto update_it = jDoc_.GetRoot().AsMap().find("update_requests");
+		if (update_it != jDoc_.GetRoot().AsMap().end()) {
+			profiling::Phase phase("parse_requests"sv);
+			UpdateRequests(update_it->second);
+		}
+		optional<profiling::Phase> phase;
+		phase.emplace("update_catalogue"sv);
+		const UpdateResult update = ProcessUpdatePool(request_pool_);
+		// Обновление применяется целиком или не применяется: база с частью изменений не сохраняется
+		if (!update.kept_stops.empty()) {
+			for (const string& stop : update.kept_stops) {
+				cerr << "Cannot remove stop "sv << stop << ": it is missing or still used by buses\n"sv;
+			}
+			return false;
+		}
+		renderedMap_.reset();
+		mapLayouts_.clear();
+		stopProjection_.reset();
+
+		phase.reset();
+		phase.emplace("routing"sv);
+		// Новые настройки маршрутизации меняют веса всех рёбер, таблица строится заново
+		if (jDoc_.GetRoot().AsMap().count("routing_settings") > 0) {
+			GetRoutingSettings();
+		}
+		else if (optional<domain::RoutingSettings> routingSetts = deserialize.GetRoutingSettings()) {
+			routingSettings_ = move(routingSetts.value());
+			transport_router::GraphBuilder graphBuilder(data_base_, routingSettings_);
+			if (!update.shifted && !routes_data.empty() && StoreRouterInBase() && graphBuilder.UpdateRoutes(old_edges, routes_data)) {
+				router_ = make_unique<transport_router::RouteHandler>(
+					data_base_,
+					routingSettings_,
+					move(graphBuilder),
+					move(routes_data)
+					);
+			}
+			else {
+				router_ = make_unique<transport_router::RouteHandler>(
+					data_base_,
+					routingSettings_,
+					move(graphBuilder),
+					StoreRouterInBase() ? transport_router::RouterMode::Precomputed : transport_router::RouterMode::Lazy
+					);
+			}
+		}
+
+		phase.reset();
+		SaveBase(move(file));
+		return true;
+	}
+
+	// Десериализует данные из бинарного файла в справочник. Загружаются только разделы базы,
+	// нужные для stat_requests.
+	bool JsonReader::ProcessDeserialization()
+	{
+		return ProcessDeserialization(RequiredSections());
 	}
 
-	// Десериализует данные из бинарного файла в справочник
-	void JsonReader::ProcessDeserialization()
+	bool JsonReader::ProcessDeserialization(unsigned sections)
 	{
 		auto it = jDoc_.GetRoot().AsMap().find("serialization_settings");
 		if (it != jDoc_.GetRoot().AsMap().end()) {
 			json::Node& fileName = it->second.AsMap().find("file")->second;
 			transport_catalogue::serialize::Deserialize deserialize(data_base_, filesystem::path(fileName.AsString()));
-			deserialize.Load();
+			if (!deserialize.Load(sections)) {
+				cerr << "Cannot load base "sv << fileName.AsString() << '\n';
+				return false;
+			}
 
 			optional<renderer::SVG_Settings> svgSetts = deserialize.GetSVGSettings();
 			if (svgSetts) {
 				svgSettings_ = move(svgSetts.value());
 			}
+			// render_settings из запроса разбираются один раз, а не при каждом запросе Map
+			svgSettings_ = GetRenderSettings();
+			if (optional<renderer::RenderedMap>& renderedMap = deserialize.GetRenderedMap()) {
+				renderedMap_ = make_shared<const renderer::RenderedMap>(move(renderedMap.value()));
+			}
+			if (optional<renderer::StopProjection>& stopProjection = deserialize.GetStopProjection()) {
+				stopProjection_ = make_shared<const renderer::StopProjection>(move(stopProjection.value()));
+			}
 
 			std::optional<domain::RoutingSettings> routigSettings = deserialize.GetRoutingSettings();
 			if (routigSettings) {
+				profiling::Phase phase("routing"sv);
 				routingSettings_ = move(routigSettings.value());
 
 				transport_router::GraphBuilder graphBuilder(
@@ -84,16 +253,231 @@ namespace jsonReader {
 					move(deserialize.GetIncidence_lists())
 					);
 
-				router_ = make_unique<transport_router::RouteHandler>(
-					data_base_,
-					routingSettings_,
-					forward<transport_router::GraphBuilder>(graphBuilder),
-					forward<graph::Router<double>::RoutesInternalData>(deserialize.GetRoutesInternalData())
-					);
+				// Таблица во внешнем файле не загружается, а читается по ячейкам. Если файл потерян или
+				// построен для другого графа, строки считаются по мере запросов: полная таблица такой сети
+				// в память не помещается
+				const optional<filesystem::path>& routeTableFile = deserialize.GetRouteTableFile();
+				shared_ptr<const transport_router::MappedRouteTable> routeTable;
+				if (routeTableFile && deserialize.GetRoutesInternalData().empty()) {
+					routeTable = transport_router::MappedRouteTable::Open(*routeTableFile, graphBuilder.GetGraph());
+					if (!routeTable) {
+						cerr << "Route table "sv << routeTableFile->string() << " does not match the base, routes are computed on demand\n"sv;
+					}
+				}
+
+				if (routeTable) {
+					router_ = make_unique<transport_router::RouteHandler>(
+						data_base_,
+						routingSettings_,
+						forward<transport_router::GraphBuilder>(graphBuilder),
+						move(routeTable)
+						);
+				}
+				else if (deserialize.GetRoutesInternalData().empty()) {
+					router_ = make_unique<transport_router::RouteHandler>(
+						data_base_,
+						routingSettings_,
+						forward<transport_router::GraphBuilder>(graphBuilder),
+						routeTableFile ? transport_router::RouterMode::Lazy : GetRouterMode()
+						);
+				}
+				else {
+					router_ = make_unique<transport_router::RouteHandler>(
+						data_base_,
+						routingSettings_,
+						forward<transport_router::GraphBuilder>(graphBuilder),
+						forward<graph::Router<double>::RoutesInternalData>(deserialize.GetRoutesInternalData())
+						);
+				}
+				ApplyRouteCacheSettings();
+			}
+		}
+		return true;
+	}
+
+
+	// Сравнивает стоимость загрузки базы и перестроения таблицы маршрутов, чтобы выбрать
+	// для развёртывания, хранить ли таблицу в базе ("store_router"). Результат выводится в формате JSON.
+	void JsonReader::ProcessBaseBenchmark(std::ostream& os)
+	{
+		using Clock = chrono::steady_clock;
+		const auto ToMs = [](Clock::duration duration) {
+			return chrono::duration<double, milli>(duration).count();
+		};
+
+		auto it = jDoc_.GetRoot().AsMap().find("serialization_settings");
+		if (it == jDoc_.GetRoot().AsMap().end()) {
+			return;
+		}
+		const filesystem::path file(it->second.AsMap().at("file").AsString());
+
+		const Clock::time_point load_start = Clock::now();
+		ProcessDeserialization(transport_catalogue::serialize::ALL_SECTIONS);
+		const Clock::time_point load_end = Clock::now();
+
+		json::Builder jbuilder = json::Builder{};
+		auto jresult = jbuilder.StartDict();
+		error_code ec;
+		const uintmax_t file_size = filesystem::file_size(file, ec);
+		jresult.Key("base_kb"s).Value(ec ? 0 : static_cast<int>(file_size / 1024));
+		jresult.Key("load_ms"s).Value(ToMs(load_end - load_start));
+		jresult.Key("threads"s).Value(static_cast<int>(thread::hardware_concurrency()));
+
+		if (router_) {
+			const graph::DirectedWeightedGraph<double>& graph = *router_->GetGrahpPtr();
+			jresult.Key("vertex_count"s).Value(static_cast<int>(graph.GetVertexCount()));
+			jresult.Key("edge_count"s).Value(static_cast<int>(graph.GetEdgeCount()));
+
+			const Clock::time_point rebuild_start = Clock::now();
+			graph::Router<double> rebuilt(graph);
+			const Clock::time_point rebuild_end = Clock::now();
+			jresult.Key("rebuild_router_ms"s).Value(ToMs(rebuild_end - rebuild_start));
+
+			const Clock::time_point single_start = Clock::now();
+			graph::Router<double> rebuilt_single(graph, 1);
+			const Clock::time_point single_end = Clock::now();
+			jresult.Key("rebuild_router_single_thread_ms"s).Value(ToMs(single_end - single_start));
+		}
+
+		json::Print(json::Document(jresult.EndDict().Build()), os);
+	}
+
+	void JsonReader::ProcessMemoryReport(std::ostream& os)
+	{
+		vector<memory::Usage> usage = data_base_.GetMemoryUsage();
+		json::Dict graph_info;
+		if (ReadRoutingSettings()) {
+			const transport_router::GraphBuilder graphBuilder(data_base_, routingSettings_);
+			const graph::DirectedWeightedGraph<double>& graph = graphBuilder.GetGraph();
+			for (memory::Usage& item : graph.GetMemoryUsage()) {
+				usage.push_back(move(item));
+			}
+			const size_t vertex_count = graph.GetVertexCount();
+			usage.push_back({ "router_routes"s, vertex_count * vertex_count,
+				graph::Router<double>::EstimateTableBytes(vertex_count), true });
+			graph_info.emplace("vertex_count"s, static_cast<int>(vertex_count));
+			graph_info.emplace("edge_count"s, static_cast<int>(graph.GetEdgeCount()));
+		}
+
+		json::Dict result = MemoryUsageToJson(usage).AsMap();
+		result.merge(graph_info);
+		json::Print(json::Document(move(result)), os);
+	}
+
+	// Определяет по stat_requests, какие разделы базы понадобятся для ответа.
+	// Без stat_requests (например, при замерах) загружается всё.
+	unsigned JsonReader::RequiredSections() const
+	{
+		namespace ser = transport_catalogue::serialize;
+
+		auto it = jDoc_.GetRoot().AsMap().find("stat_requests");
+		if (it == jDoc_.GetRoot().AsMap().end()) {
+			return ser::ALL_SECTIONS;
+		}
+
+		unsigned sections = ser::CATALOGUE;
+		for (const json::Node& request : it->second.AsArray()) {
+			const map<string, json::Node>& item = request.AsMap();
+			auto type = item.find("type");
+			if (type == item.end()) {
+				continue;
+			}
+			const string& request_type = type->second.AsString();
+			if (request_type == "Map" || request_type == "MapTile" || request_type == "MapViewport") {
+				sections |= ser::RENDER_SETTINGS;
+			}
+			else if (request_type == "Route" || request_type == "Matrix" || request_type == "Isochrone"
+				|| request_type == "RouteCacheStats") {
+				sections |= ser::ROUTING;
+				auto with_map = item.find("with_map");
+				if (with_map != item.end() && with_map->second.AsBool()) {
+					sections |= ser::RENDER_SETTINGS;
+				}
+			}
+			// Отчёт о памяти описывает базу целиком
+			else if (request_type == "MemoryStats") {
+				sections |= ser::ALL_SECTIONS;
+			}
+		}
+		return sections;
+	}
+
+	// "router_mode": "lazy" в "serialization_settings" — если таблицы маршрутов нет в базе,
+	// её строки вычисляются по мере запросов, а не целиком при загрузке.
+	transport_router::RouterMode JsonReader::GetRouterMode() const
+	{
+		auto it = jDoc_.GetRoot().AsMap().find("serialization_settings");
+		if (it != jDoc_.GetRoot().AsMap().end()) {
+			const map<string, json::Node>& settings = it->second.AsMap();
+			auto mode = settings.find("router_mode");
+			if (mode != settings.end() && mode->second.AsString() == "lazy"s) {
+				return transport_router::RouterMode::Lazy;
+			}
+		}
+		return transport_router::RouterMode::Precomputed;
+	}
+
+	// Логический ключ "serialization_settings"; nullopt, если он не задан
+	optional<bool> JsonReader::GetSerializationFlag(string_view key) const
+	{
+		auto it = jDoc_.GetRoot().AsMap().find("serialization_settings");
+		if (it != jDoc_.GetRoot().AsMap().end()) {
+			const map<string, json::Node>& settings = it->second.AsMap();
+			if (auto flag = settings.find(string(key)); flag != settings.end()) {
+				return flag->second.AsBool();
 			}
 		}
+		return nullopt;
+	}
+
+	// Таблица маршрутов сохраняется в самой базе, если она не выносится во внешний файл
+	bool JsonReader::StoreRouterInBase() const
+	{
+		if (ExternalRouterInBase()) {
+			return false;
+		}
+		if (optional<bool> store = GetSerializationFlag("store_router"sv)) {
+			return *store;
+		}
+		return !loadedRouterStorage_ || *loadedRouterStorage_ == RouterStorage::InBase;
+	}
+
+	// Явный "store_router" в документе обновления выбирает хранение в базе и отменяет внешнюю таблицу
+	bool JsonReader::ExternalRouterInBase() const
+	{
+		if (optional<bool> external = GetSerializationFlag("external_router"sv)) {
+			return *external;
+		}
+		if (GetSerializationFlag("store_router"sv)) {
+			return false;
+		}
+		return loadedRouterStorage_ == RouterStorage::External;
 	}
 
+	// Ограничение памяти на построение внешней таблицы маршрутов в байтах: "router_memory_limit_mb"
+	size_t JsonReader::GetRouteTableMemoryLimit() const
+	{
+		size_t megabytes = transport_router::DEFAULT_ROUTE_TABLE_MEMORY_MB;
+		auto it = jDoc_.GetRoot().AsMap().find("serialization_settings");
+		if (it != jDoc_.GetRoot().AsMap().end()) {
+			const map<string, json::Node>& settings = it->second.AsMap();
+			if (auto limit = settings.find("router_memory_limit_mb"); limit != settings.end()) {
+				megabytes = static_cast<size_t>(max(limit->second.AsInt(), 1));
+			}
+		}
+		return megabytes << 20;
+	}
+
+	bool JsonReader::StoreMapInBase() const
+	{
+		auto it = jDoc_.GetRoot().AsMap().find("serialization_settings");
+		if (it != jDoc_.GetRoot().AsMap().end()) {
+			const map<string, json::Node>& settings = it->second.AsMap();
+			auto store = settings.find("store_map");
+			return store != settings.end() && store->second.AsBool();
+		}
+		return false;
+	}
 
 	// Загружает настройки визуализации
 	const renderer::SVG_Settings JsonReader::GetRenderSettings() const
@@ -106,16 +490,48 @@ namespace jsonReader {
 		return svgSettings_;
 	}
 
+	// Читает настройки маршрутизации из запроса. Возвращает false, если их нет.
+	bool JsonReader::ReadRoutingSettings()
+	{
+		auto it = jDoc_.GetRoot().AsMap().find("routing_settings");
+		if (it == jDoc_.GetRoot().AsMap().end()) {
+			return false;
+		}
+		const map<string, json::Node>& routing_settings_node = it->second.AsMap();
+		routingSettings_.bus_velocity = routing_settings_node.at("bus_velocity").AsInt();
+		routingSettings_.bus_wait_time = routing_settings_node.at("bus_wait_time").AsDouble();
+		// Скорость пешехода делит расстояние во времени пешего подхода: нулевая или отрицательная
+		// дала бы бесконечное или отрицательное время, поэтому, как и при загрузке базы, остаётся значение по умолчанию
+		if (auto pedestrian = routing_settings_node.find("pedestrian_velocity"); pedestrian != routing_settings_node.end()) {
+			if (const double velocity = pedestrian->second.AsDouble(); velocity > 0) {
+				routingSettings_.pedestrian_velocity = velocity;
+			}
+			else {
+				cerr << "Ignoring non-positive pedestrian_velocity "sv << velocity << '\n';
+			}
+		}
+		return true;
+	}
+
 	// Загружает настройки маршрутизации и инициализирует построение маршрутизатора.
 	void JsonReader::GetRoutingSettings()
 	{
-		auto it = jDoc_.GetRoot().AsMap().find("routing_settings");
-		if (it != jDoc_.GetRoot().AsMap().end()) {
-			const map<string, json::Node>& routing_settings_node = it->second.AsMap();
-			routingSettings_.bus_velocity = routing_settings_node.at("bus_velocity").AsInt();
-			routingSettings_.bus_wait_time = routing_settings_node.at("bus_wait_time").AsDouble();
+		if (ReadRoutingSettings()) {
+			// Если таблица маршрутов не попадёт в базу, строить её при создании базы незачем
+			router_ = make_unique<transport_router::RouteHandler>(data_base_, routingSettings_,
+				StoreRouterInBase() ? transport_router::RouterMode::Precomputed : transport_router::RouterMode::Lazy);
+		}
+	}
 
-			router_ = make_unique<transport_router::RouteHandler>(data_base_, routingSettings_);
+	// Настройки кэша маршрутов: "route_cache": {"capacity": N}. Ёмкость 0 отключает кэш.
+	void JsonReader::ApplyRouteCacheSettings()
+	{
+		auto it = jDoc_.GetRoot().AsMap().find("route_cache");
+		if (it != jDoc_.GetRoot().AsMap().end() && router_) {
+			const map<string, json::Node>& cache_settings = it->second.AsMap();
+			if (auto capacity = cache_settings.find("capacity"); capacity != cache_settings.end()) {
+				router_->SetRouteCacheCapacity(static_cast<size_t>(max(capacity->second.AsInt(), 0)));
+			}
 		}
 	}
 
@@ -146,8 +562,40 @@ namespace jsonReader {
 			}
 		}
 	}
+	// Запросы на изменение базы: те же Stop и Bus, что и в base_requests, описание заменяет прежнее.
+	// С "remove": true остановка или маршрут удаляются.
+	void JsonReader::UpdateRequests(const json::Node& requests)
+	{
+		for (const json::Node& request : requests.AsArray()) {
+			const map<string, json::Node>& item = request.AsMap();
+			auto it = item.find("type");
+			if (it == item.end()) {
+				continue;
+			}
+			const string& request_type = it->second.AsString();
+			auto remove = item.find("remove");
+			const bool is_removal = remove != item.end() && remove->second.AsBool();
+			if (request_type == "Stop") {
+				if (is_removal) {
+					request_pool_.removed_stops.push_back(item.at("name"s).AsString());
+				}
+				else {
+					LoadStopInfo(item);
+				}
+			}
+			else if (request_type == "Bus") {
+				if (is_removal) {
+					request_pool_.removed_buses.push_back(item.at("name"s).AsString());
+				}
+				else {
+					LoadBusInfo(item);
+				}
+			}
+		}
+	}
+
 	// Обрабатывает json массив с запросами к базе
-	json::Document JsonReader::StatRequests(const json::Node& requests)
+	json::Document JsonReader::StatRequests(const json::Node& requests) const
 	{
 		json::Builder jbuild = json::Builder{};
 		auto jarray = jbuild.StartArray();
@@ -157,6 +605,8 @@ namespace jsonReader {
 			auto it = item.find("type");
 			if (it != item.end()) {
 				string request_type = it->second.AsString();
+				auto id = item.find("id"s);
+				latency::Request measured(request_type, id != item.end() && id->second.IsInt() ? id->second.AsInt() : 0);
 				if (request_type == "Stop") {
 					jarray.Value(StopInfo(item));
 				}
@@ -166,9 +616,27 @@ namespace jsonReader {
 				else if (request_type == "Map") {
 					jarray.Value(SvgMap(item));
 				}
+				else if (request_type == "MapTile" || request_type == "MapViewport") {
+					jarray.Value(SvgMapViewport(item));
+				}
 				else if (request_type == "Route") {
 					jarray.Value(RouteInfo(item));
 				}
+				else if (request_type == "Matrix") {
+					jarray.Value(MatrixInfo(item));
+				}
+				else if (request_type == "Isochrone") {
+					jarray.Value(IsochroneInfo(item));
+				}
+				else if (request_type == "RouteCacheStats") {
+					jarray.Value(RouteCacheInfo(item));
+				}
+				else if (request_type == "LatencyStats") {
+					jarray.Value(LatencyInfo(item));
+				}
+				else if (request_type == "MemoryStats") {
+					jarray.Value(MemoryInfo(item));
+				}
 
 				// ... новые типы запросов
 			}
@@ -200,6 +668,12 @@ namespace jsonReader {
 		settings.stop_label_offset.dy = jpointS[1].AsDouble();
 
 		settings.underlayer_color = GetColorAsString(jsetings.at("underlayer_color"));
+		if (auto tolerance = jsetings.find("simplify_tolerance"); tolerance != jsetings.end()) {
+			settings.simplify_tolerance = tolerance->second.AsDouble();
+		}
+		if (auto thin = jsetings.find("thin_labels"); thin != jsetings.end()) {
+			settings.thin_labels = thin->second.AsBool();
+		}
 		settings.underlayer_width = jsetings.at("underlayer_width").AsDouble();
 
 		if (jsetings.count("color_palette") == 1) {
@@ -264,7 +738,7 @@ namespace jsonReader {
 	}
 
 	// Формирует json ветку с информацией об остановке
-	json::Node JsonReader::StopInfo(const std::map<std::string, json::Node>& stop)
+	json::Node JsonReader::StopInfo(const std::map<std::string, json::Node>& stop) const
 	{
 		domain::StopInfo stopInfo = this->GetStopInfo(stop.at("name"s).AsString());
 		json::Builder jbuilder = json::Builder{};
@@ -292,7 +766,7 @@ namespace jsonReader {
 	}
 
 	// Формирует json ветку с информацией о маршруте
-	json::Node JsonReader::BusInfo(const std::map<std::string, json::Node>& bus)
+	json::Node JsonReader::BusInfo(const std::map<std::string, json::Node>& bus) const
 	{
 		domain::BusInfo busInfo = this->GetBusInfo(bus.at("name").AsString());
 		json::Builder jbuilder = json::Builder{};
@@ -313,41 +787,148 @@ namespace jsonReader {
 	}
 
 	// Формирует json ветку с картой всех маршрутов в формате svg
-	json::Node jsonReader::JsonReader::SvgMap(const std::map<std::string, json::Node>& item)
+	json::Node jsonReader::JsonReader::SvgMap(const std::map<std::string, json::Node>& item) const
 	{
 		json::Builder jbuilder = json::Builder{};
 		auto jresult = jbuilder.StartDict();
 
-		renderer::SVG_Settings svgSet = GetRenderSettings();
-		requestHandler::MapRequestHandler mapreq(data_base_, svgSet);
-		svg::Document svgDoc = mapreq.RenderMap();
+		shared_ptr<const renderer::RenderedMap> renderedMap;
+		{
+			latency::Stage stage("render"sv);
+			renderedMap = GetRenderedMap();
+		}
+		jresult.Key("map"s).Value(string(renderedMap->svg));
+		jresult.Key("request_id"s).Value(item.at("id"s).AsInt());
 
-		std::stringstream ss;
-		svgDoc.Render(ss);
+		return jresult.EndDict().Build();;
+	}
 
-		jresult.Key("map"s).Value(ss.str());
+	// Формирует json ветку с частью карты: плиткой {"z", "x", "y"} для MapTile
+	// или областью "bbox" из двух противоположных углов {"latitude", "longitude"} для MapViewport
+	json::Node JsonReader::SvgMapViewport(const std::map<std::string, json::Node>& item) const
+	{
+		json::Builder jbuilder = json::Builder{};
+		auto jresult = jbuilder.StartDict();
 		jresult.Key("request_id"s).Value(item.at("id"s).AsInt());
 
-		return jresult.EndDict().Build();;
+		// Границы плитки не зависят от уровня детализации, а области — вычисляются по проекции уровня 0
+		optional<latency::Stage> stage;
+		stage.emplace("layout"sv);
+		optional<renderer::Viewport> viewport;
+		if (item.at("type"s).AsString() == "MapTile"s) {
+			const int z = item.at("z"s).AsInt();
+			viewport = GetMapLayout(renderer::HasLevelOfDetail(svgSettings_) ? z : 0)->TileViewport(z, item.at("x"s).AsInt(), item.at("y"s).AsInt());
+		}
+		else {
+			const json::Array& bbox = item.at("bbox"s).AsArray();
+			if (bbox.size() == 2) {
+				viewport = GetMapLayout(0)->BoundsViewport(PointFromJson(bbox[0]), PointFromJson(bbox[1]));
+			}
+		}
+
+		if (!viewport) {
+			jresult.Key("error_message"s).Value("invalid viewport"s);
+			return jresult.EndDict().Build();
+		}
+
+		const int level = renderer::HasLevelOfDetail(svgSettings_) ? renderer::MapLayout::DetailLevel(*viewport) : 0;
+		const shared_ptr<const renderer::MapLayout> layout = GetMapLayout(level);
+		stage.reset();
+		stage.emplace("render"sv);
+		requestHandler::MapRequestHandler mapreq(data_base_, svgSettings_);
+		string svg = mapreq.RenderViewport(*layout, *viewport);
+		stage.reset();
+		jresult.Key("map"s).Value(move(svg));
+		return jresult.EndDict().Build();
+	}
+
+	// Раскладка уровня строится один раз на справочник и настройки визуализации, как и полная карта
+	shared_ptr<const renderer::MapLayout> JsonReader::GetMapLayout(int level) const
+	{
+		const uint64_t settings_hash = renderer::SettingsHash(svgSettings_);
+
+		lock_guard lock(mapLayoutsMutex_);
+		if (mapLayoutsHash_ != settings_hash) {
+			mapLayouts_.clear();
+			mapLayoutsHash_ = settings_hash;
+		}
+		shared_ptr<const renderer::MapLayout>& layout = mapLayouts_[level];
+		if (!layout) {
+			requestHandler::MapRequestHandler mapreq(data_base_, svgSettings_, GetStopProjection());
+			layout = make_shared<const renderer::MapLayout>(mapreq.MakeLayout(level));
+		}
+		return layout;
+	}
+
+	// Возвращает карту всех маршрутов, отрисовывая её только при смене настроек визуализации.
+	// Отрисовка выполняется под блокировкой, чтобы одновременные запросы Map не строили одну и ту же карту.
+	shared_ptr<const renderer::RenderedMap> JsonReader::GetRenderedMap() const
+	{
+		const uint64_t settings_hash = renderer::SettingsHash(svgSettings_);
+
+		lock_guard lock(renderedMapMutex_);
+		if (renderedMap_ && renderedMap_->settings_hash == settings_hash) {
+			return renderedMap_;
+		}
+
+		requestHandler::MapRequestHandler mapreq(data_base_, svgSettings_, GetStopProjection());
+		auto renderedMap = make_shared<renderer::RenderedMap>();
+		renderedMap->settings_hash = settings_hash;
+		// С упрощением полная карта — это часть карты уровня 0, совпадающая с ней целиком
+		renderedMap->svg = renderer::HasLevelOfDetail(svgSettings_)
+			? mapreq.RenderViewport(*GetMapLayout(0), renderer::Viewport{})
+			: mapreq.RenderMap();
+		renderedMap_ = move(renderedMap);
+		return renderedMap_;
+	}
+
+	// Проекция загружается из базы или вычисляется один раз на справочник и настройки визуализации
+	shared_ptr<const renderer::StopProjection> JsonReader::GetStopProjection() const
+	{
+		const uint64_t settings_hash = renderer::SettingsHash(svgSettings_);
+
+		lock_guard lock(stopProjectionMutex_);
+		if (!stopProjection_ || stopProjection_->settings_hash != settings_hash) {
+			requestHandler::MapRequestHandler mapreq(data_base_, svgSettings_);
+			stopProjection_ = make_shared<const renderer::StopProjection>(mapreq.MakeStopProjection());
+		}
+		return stopProjection_;
 	}
 
 	// Обрабатывает запрос на построение маршрута из точки А в точку Б
-	json::Node JsonReader::RouteInfo(const std::map<std::string, json::Node>& route) {
+	json::Node JsonReader::RouteInfo(const std::map<std::string, json::Node>& route) const {
 		json::Builder jbuilder = json::Builder{};
 		auto jresult = jbuilder.StartDict();
 		jresult.Key("request_id"s).Value(route.at("id"s).AsInt());
 
-		const optional<transport_router::Route> routeItems = router_->BuildRoute(route.at("from").AsString(), route.at("to").AsString());
-		if (routeItems) {
-			//&& !holds_alternative<domain::RouteItem_NoWay>(routeItems->route_items[0] ?
-			jresult.Key("total_time"s).Value(routeItems->total_time);
-			auto jarray = jresult.Key("items"s).StartArray();
-			for (const transport_router::Items& item : routeItems->route_items) {
-				visit([&jarray](const auto& value) {
-					JsonReader::RouteItem{}(value, jarray);
-					}, item);
+		if (!route.count("from_point"s) && !router_->IsRouteCacheEnabled()) {
+			// Буферы переиспользуются между запросами своего потока
+			static thread_local transport_router::RouteBuffers routeBuffers;
+			bool found = false;
+			{
+				latency::Stage stage("search"sv);
+				found = router_->BuildRoute(route.at("from").AsString(), route.at("to").AsString(), routeBuffers);
+			}
+			if (found) {
+				RouteItemsInfo(routeBuffers.route, jresult);
+				RouteMapInfo(route, routeBuffers.route, jresult);
 			}
-			jarray.EndArray();
+			else {
+				jresult.Key("error_message"s).Value("not found"s);
+			}
+			return jresult.EndDict().Build();
+		}
+
+		shared_ptr<const transport_router::Route> routeItems;
+		{
+			latency::Stage stage("search"sv);
+			routeItems = route.count("from_point"s)
+				? RouteBetweenPoints(route)
+				: router_->BuildRoute(route.at("from").AsString(), route.at("to").AsString());
+		}
+		if (routeItems) {
+			RouteItemsInfo(*routeItems, jresult);
+			RouteMapInfo(route, *routeItems, jresult);
 		}
 		else {
 			jresult.Key("error_message"s).Value("not found"s);
@@ -356,6 +937,231 @@ namespace jsonReader {
 		return jresult.EndDict().Build();;
 	}
 
+	void JsonReader::RouteItemsInfo(const transport_router::Route& route, json::DictItemContext& jresult) const
+	{
+		jresult.Key("total_time"s).Value(route.total_time);
+		auto jarray = jresult.Key("items"s).StartArray();
+		for (const transport_router::Items& item : route.route_items) {
+			visit([&jarray](const auto& value) {
+				JsonReader::RouteItem{}(value, jarray);
+				}, item);
+		}
+		jarray.EndArray();
+	}
+
+	// При "with_map": true добавляет svg-слой с участками маршрута в проекции полной карты.
+	// Слой строится по элементам маршрута, полная карта при этом не отрисовывается.
+	void JsonReader::RouteMapInfo(const std::map<std::string, json::Node>& request, const transport_router::Route& route,
+		json::DictItemContext& jresult) const
+	{
+		auto with_map = request.find("with_map"s);
+		if (with_map == request.end() || !with_map->second.AsBool()) {
+			return;
+		}
+		vector<domain::RouteItem_Bus> legs;
+		for (const transport_router::Items& item : route.route_items) {
+			if (const domain::RouteItem_Bus* leg = get_if<domain::RouteItem_Bus>(&item)) {
+				legs.push_back(*leg);
+			}
+		}
+		string svg;
+		{
+			latency::Stage stage("render"sv);
+			requestHandler::MapRequestHandler mapreq(data_base_, svgSettings_, GetStopProjection());
+			svg = mapreq.RenderRoute(legs);
+		}
+		jresult.Key("map"s).Value(move(svg));
+	}
+
+	// Обрабатывает запрос матрицы времён в пути: {"from": [...], "to": [...]}.
+	// Ответ — массив строк, по одной на источник; недостижимые пары выводятся как null.
+	json::Node JsonReader::MatrixInfo(const std::map<std::string, json::Node>& matrix) const
+	{
+		vector<string_view> from;
+		for (const json::Node& name : matrix.at("from"s).AsArray()) {
+			from.push_back(name.AsString());
+		}
+		vector<string_view> to;
+		for (const json::Node& name : matrix.at("to"s).AsArray()) {
+			to.push_back(name.AsString());
+		}
+
+		transport_router::TravelTimeMatrix times;
+		{
+			latency::Stage stage("search"sv);
+			times = router_->BuildMatrix(from, to);
+		}
+
+		json::Array rows;
+		rows.reserve(times.sources);
+		for (size_t i = 0; i < times.sources; ++i) {
+			json::Array row;
+			row.reserve(times.targets);
+			for (size_t j = 0; j < times.targets; ++j) {
+				const optional<double>& time = times.total_times[i * times.targets + j];
+				if (time) {
+					row.emplace_back(*time);
+				}
+				else {
+					row.emplace_back(nullptr);
+				}
+			}
+			rows.emplace_back(move(row));
+		}
+
+		json::Builder jbuilder = json::Builder{};
+		auto jresult = jbuilder.StartDict();
+		jresult.Key("request_id"s).Value(matrix.at("id"s).AsInt());
+		jresult.Key("total_times"s).Value(move(rows));
+		return jresult.EndDict().Build();
+	}
+
+	// Обрабатывает запрос на все остановки, достижимые из stop_name за time_budget минут.
+	// При "with_map": true добавляет svg-слой с этими остановками в проекции полной карты.
+	json::Node JsonReader::IsochroneInfo(const std::map<std::string, json::Node>& isochrone) const
+	{
+		json::Builder jbuilder = json::Builder{};
+		auto jresult = jbuilder.StartDict();
+		jresult.Key("request_id"s).Value(isochrone.at("id"s).AsInt());
+
+		optional<vector<transport_router::ReachableStop>> reachable;
+		{
+			latency::Stage stage("search"sv);
+			reachable = router_->FindReachableStops(isochrone.at("stop_name"s).AsString(), isochrone.at("time_budget"s).AsDouble());
+		}
+		if (!reachable) {
+			jresult.Key("error_message"s).Value("not found"s);
+			return jresult.EndDict().Build();
+		}
+
+		auto jarray = jresult.Key("stops"s).StartArray();
+		for (const transport_router::ReachableStop& item : *reachable) {
+			jarray.StartDict()
+				.Key("stop_name"s).Value(item.stop->name)
+				.Key("time"s).Value(item.time)
+				.EndDict();
+		}
+		jarray.EndArray();
+
+		auto with_map = isochrone.find("with_map"s);
+		if (with_map != isochrone.end() && with_map->second.AsBool()) {
+			vector<const domain::Stop*> stops;
+			stops.reserve(reachable->size());
+			for (const transport_router::ReachableStop& item : *reachable) {
+				stops.push_back(item.stop);
+			}
+			string svg;
+			{
+				latency::Stage stage("render"sv);
+				requestHandler::MapRequestHandler mapreq(data_base_, svgSettings_, GetStopProjection());
+				svg = mapreq.RenderStopsOverlay(stops);
+			}
+			jresult.Key("map"s).Value(move(svg));
+		}
+
+		return jresult.EndDict().Build();
+	}
+
+	// Формирует json ветку со статистикой кэша маршрутов
+	json::Node JsonReader::RouteCacheInfo(const std::map<std::string, json::Node>& request) const
+	{
+		const transport_router::RouteCacheStats stats = router_->GetRouteCacheStats();
+
+		json::Builder jbuilder = json::Builder{};
+		auto jresult = jbuilder.StartDict();
+		jresult.Key("request_id"s).Value(request.at("id"s).AsInt());
+		jresult.Key("capacity"s).Value(static_cast<int>(stats.capacity));
+		jresult.Key("entries"s).Value(static_cast<int>(stats.entries));
+		jresult.Key("hits"s).Value(static_cast<int>(stats.hits));
+		jresult.Key("misses"s).Value(static_cast<int>(stats.misses));
+		jresult.Key("evictions"s).Value(static_cast<int>(stats.evictions));
+		jresult.Key("hit_rate"s).Value(stats.HitRate());
+		jresult.Key("memory_bytes"s).Value(static_cast<double>(stats.memory_bytes));
+		return jresult.EndDict().Build();
+	}
+
+	// Формирует json ветку с гистограммами задержек по типам запросов и журналом медленных запросов.
+	// Пока запись задержек не включена, гистограммы пусты.
+	json::Node JsonReader::LatencyInfo(const std::map<std::string, json::Node>& request) const
+	{
+		json::Dict result = latency::MakeReport().AsMap();
+		result.emplace("request_id"s, request.at("id"s).AsInt());
+		result.emplace("enabled"s, latency::IsEnabled());
+		return result;
+	}
+
+	// Формирует json ветку с памятью, занятой справочником, графом, таблицей маршрутов и кэшами
+	json::Node JsonReader::MemoryInfo(const std::map<std::string, json::Node>& request) const
+	{
+		json::Dict result = MemoryUsageToJson(GetMemoryUsage()).AsMap();
+		result.emplace("request_id"s, request.at("id"s).AsInt());
+		return result;
+	}
+
+	vector<memory::Usage> JsonReader::GetMemoryUsage() const
+	{
+		vector<memory::Usage> usage = data_base_.GetMemoryUsage();
+		if (router_) {
+			for (memory::Usage& item : router_->GetMemoryUsage()) {
+				usage.push_back(move(item));
+			}
+		}
+		{
+			lock_guard lock(renderedMapMutex_);
+			if (renderedMap_) {
+				usage.push_back({ "rendered_map"s, renderedMap_->svg.size(), memory::StringBytes(renderedMap_->svg) });
+			}
+		}
+		{
+			lock_guard lock(stopProjectionMutex_);
+			if (stopProjection_) {
+				usage.push_back({ "stop_projection"s, stopProjection_->screen.size(),
+					memory::VectorBytes(stopProjection_->screen) + memory::VectorBytes(stopProjection_->order) });
+			}
+		}
+		return usage;
+	}
+
+	// Размеры выводятся как double: таблица маршрутов большого города не помещается в int
+	json::Node JsonReader::MemoryUsageToJson(const vector<memory::Usage>& usage)
+	{
+		json::Builder jbuilder = json::Builder{};
+		auto jresult = jbuilder.StartDict();
+		auto jarray = jresult.Key("structures"s).StartArray();
+		for (const memory::Usage& item : usage) {
+			auto jitem = jarray.StartDict();
+			jitem.Key("name"s).Value(item.name)
+				.Key("elements"s).Value(static_cast<double>(item.elements))
+				.Key("bytes"s).Value(static_cast<double>(item.bytes));
+			if (item.estimated) {
+				jitem.Key("estimated"s).Value(true);
+			}
+			jitem.EndDict();
+		}
+		jarray.EndArray();
+		jresult.Key("total_bytes"s).Value(static_cast<double>(memory::TotalBytes(usage)));
+		jresult.Key("peak_rss_kb"s).Value(static_cast<double>(profiling::PeakRssKb()));
+		return jresult.EndDict().Build();
+	}
+
+	// Маршрут между произвольными точками: {"from_point": {"latitude", "longitude"}, "to_point": {...}, "nearest_stops": k}
+	std::shared_ptr<const transport_router::Route> JsonReader::RouteBetweenPoints(const std::map<std::string, json::Node>& route) const
+	{
+		const size_t DEFAULT_NEAREST_STOPS = 3;
+
+		size_t candidates = DEFAULT_NEAREST_STOPS;
+		if (auto it = route.find("nearest_stops"s); it != route.end()) {
+			candidates = static_cast<size_t>(max(it->second.AsInt(), 1));
+		}
+		return router_->BuildRoute(PointFromJson(route.at("from_point"s)), PointFromJson(route.at("to_point"s)), candidates);
+	}
+
+	geo::Coordinates JsonReader::PointFromJson(const json::Node& point)
+	{
+		const map<string, json::Node>& coords = point.AsMap();
+		return { coords.at("latitude"s).AsDouble(), coords.at("longitude"s).AsDouble() };
+	}
+
 	void JsonReader::RouteItem::operator()(const domain::RouteItem_Wait& value, json::ArrayItemContext& jitem)
 	{
 		auto jdict = jitem.StartDict();
@@ -375,6 +1181,20 @@ namespace jsonReader {
 		jdict.EndDict();
 	}
 
+	void JsonReader::RouteItem::operator()(const domain::RouteItem_Walk& value, json::ArrayItemContext& jitem)
+	{
+		auto jdict = jitem.StartDict();
+		if (!value.from_stop.empty()) {
+			jdict.Key("from"s).Value(value.from_stop);
+		}
+		jdict.Key("time"s).Value(value.time);
+		if (!value.to_stop.empty()) {
+			jdict.Key("to"s).Value(value.to_stop);
+		}
+		jdict.Key("type"s).Value("Walk"s);
+		jdict.EndDict();
+	}
+
 	void JsonReader::RouteItem::operator()([[maybe_unused]] const domain::RouteItem_NoWay value, [[maybe_unused]] json::ArrayItemContext& jitem)
 	{
 		// Может быть позже...
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <chrono>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <string_view>
 #include <sstream>
 
@@ -19,8 +24,19 @@ namespace jsonReader {
 		void LoadJson(std::istream&);
 		void ProcessBaseRequests();
 		void ProcessStatRequests(std::ostream&);
+		// Отвечает на запросы requests, не изменяя ни справочник, ни маршрутизатор:
+		// один и тот же JsonReader можно опрашивать из нескольких потоков.
+		json::Document ProcessStatRequests(const json::Node& requests) const;
 		void ProcessSerialization();
-		void ProcessDeserialization();
+		// false, если базу не удалось загрузить или обновление не применилось целиком; база тогда не меняется
+		bool ProcessBaseUpdate();
+		// Возвращают false, если базу не удалось загрузить
+		bool ProcessDeserialization();
+		bool ProcessDeserialization(unsigned sections);
+		void ProcessBaseBenchmark(std::ostream&);
+		// Пробный прогон для оценки памяти: справочник и граф строятся по base_requests,
+		// а объём таблицы маршрутов оценивается по числу вершин без её построения
+		void ProcessMemoryReport(std::ostream&);
 
 		const renderer::SVG_Settings GetRenderSettings() const;
 		void GetRoutingSettings();
@@ -32,9 +48,31 @@ namespace jsonReader {
 		Base::Request_pool request_pool_;
 		json::Document jDoc_;
 		renderer::SVG_Settings svgSettings_;
+		// Карта всех маршрутов, отрисованная при первом запросе Map или загруженная из базы.
+		// Годится, пока справочник не менялся, а хеш настроек визуализации совпадает с сохранённым.
+		mutable std::mutex renderedMapMutex_;
+		mutable std::shared_ptr<const renderer::RenderedMap> renderedMap_;
+		// Раскладки карты для запросов MapTile и MapViewport по уровням детализации, строятся при первом запросе уровня.
+		// Без упрощения карты используется только уровень 0.
+		mutable std::mutex mapLayoutsMutex_;
+		mutable uint64_t mapLayoutsHash_ = 0;
+		mutable std::map<int, std::shared_ptr<const renderer::MapLayout>> mapLayouts_;
+		// Экранные координаты остановок на полной карте, общие для Map, раскладок и слоёв остановок
+		mutable std::mutex stopProjectionMutex_;
+		mutable std::shared_ptr<const renderer::StopProjection> stopProjection_;
+		// Как хранилась таблица маршрутов в обновляемой базе. update_base сохраняет базу так же,
+		// если "serialization_settings" документа обновления не задают "store_router" или "external_router"
+		enum class RouterStorage {
+			InBase,
+			Rebuilt,
+			External,
+		};
+		std::optional<RouterStorage> loadedRouterStorage_;
 
 		void BaseRequests(const json::Node&);
-		json::Document StatRequests(const json::Node&);
+		void UpdateRequests(const json::Node&);
+		void SaveBase(std::filesystem::path&& file);
+		json::Document StatRequests(const json::Node&) const;
 
 		const renderer::SVG_Settings RenderSettings(const std::map<std::string, json::Node>&) const;
 		std::string GetColorAsString(const json::Node&) const;
@@ -42,15 +80,42 @@ namespace jsonReader {
 		void LoadStopInfo(const std::map<std::string, json::Node>&);
 		void LoadBusInfo(const std::map<std::string, json::Node>&);
 
-		json::Node StopInfo(const std::map<std::string, json::Node>&);
-		json::Node BusInfo(const std::map<std::string, json::Node>&);
-		json::Node SvgMap(const std::map<std::string, json::Node>&);
-		json::Node RouteInfo(const std::map<std::string, json::Node>& route);
+		json::Node StopInfo(const std::map<std::string, json::Node>&) const;
+		json::Node BusInfo(const std::map<std::string, json::Node>&) const;
+		json::Node SvgMap(const std::map<std::string, json::Node>&) const;
+		json::Node SvgMapViewport(const std::map<std::string, json::Node>&) const;
+		json::Node RouteInfo(const std::map<std::string, json::Node>& route) const;
+		void RouteItemsInfo(const transport_router::Route& route, json::DictItemContext& jresult) const;
+		void RouteMapInfo(const std::map<std::string, json::Node>& request, const transport_router::Route& route,
+			json::DictItemContext& jresult) const;
+		json::Node MatrixInfo(const std::map<std::string, json::Node>& matrix) const;
+		json::Node IsochroneInfo(const std::map<std::string, json::Node>& isochrone) const;
+		json::Node RouteCacheInfo(const std::map<std::string, json::Node>& request) const;
+		json::Node LatencyInfo(const std::map<std::string, json::Node>& request) const;
+		json::Node MemoryInfo(const std::map<std::string, json::Node>& request) const;
+		std::vector<memory::Usage> GetMemoryUsage() const;
+		static json::Node MemoryUsageToJson(const std::vector<memory::Usage>& usage);
+
+		bool ReadRoutingSettings();
+		void ApplyRouteCacheSettings();
+		std::optional<bool> GetSerializationFlag(std::string_view key) const;
+		bool StoreRouterInBase() const;
+		bool ExternalRouterInBase() const;
+		size_t GetRouteTableMemoryLimit() const;
+		bool StoreMapInBase() const;
+		std::shared_ptr<const renderer::RenderedMap> GetRenderedMap() const;
+		std::shared_ptr<const renderer::MapLayout> GetMapLayout(int level) const;
+		std::shared_ptr<const renderer::StopProjection> GetStopProjection() const;
+		transport_router::RouterMode GetRouterMode() const;
+		unsigned RequiredSections() const;
+		std::shared_ptr<const transport_router::Route> RouteBetweenPoints(const std::map<std::string, json::Node>& route) const;
+		static geo::Coordinates PointFromJson(const json::Node& point);
 
 		struct RouteItem {
 			void operator()(const domain::RouteItem_Wait& value, json::ArrayItemContext& jitem);
 			void operator()(const domain::RouteItem_Bus& value, json::ArrayItemContext& jitem);
 			void operator()(const domain::RouteItem_NoWay value, json::ArrayItemContext& jitem);
+			void operator()(const domain::RouteItem_Walk& value, json::ArrayItemContext& jitem);
 		};
 	};
 
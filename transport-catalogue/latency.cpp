@@ -0,0 +1,336 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+
+namespace latency {
+	using namespace std;
+	using Clock = chrono::steady_clock;
+
+	namespace {
+		struct SlowRequest {
+			int id = 0;
+			string type;
+			uint64_t total = 0;
+			vector<pair<string_view, uint64_t>> stages;
+		};
+
+		struct State {
+			mutex guard;
+			string destination;
+			size_t slow_capacity = DEFAULT_SLOW_REQUESTS;
+			map<string, Histogram, less<>> histograms;
+			// Куча с самым быстрым из сохранённых запросов в вершине
+			vector<SlowRequest> slow;
+		};
+
+		atomic<bool> enabled{ false };
+		// Время самого быстрого запроса в заполненном журнале: более быстрые запросы не берут блокировку ради журнала
+		atomic<uint64_t> slow_threshold{ 0 };
+
+		State& GetState()
+		{
+			static State state;
+			return state;
+		}
+
+		// Стадии запроса, выполняемого сейчас в этом потоке
+		struct ActiveRequest {
+			bool active = false;
+			vector<pair<string_view, uint64_t>> stages;
+		};
+		thread_local ActiveRequest current_request;
+
+		bool SlowerFirst(const SlowRequest& lhs, const SlowRequest& rhs)
+		{
+			return lhs.total > rhs.total;
+		}
+
+		uint64_t Nanoseconds(Clock::duration duration)
+		{
+			return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(duration).count());
+		}
+
+		double Microseconds(uint64_t nanoseconds)
+		{
+			return static_cast<double>(nanoseconds) / 1000.0;
+		}
+
+		int BitWidth(uint64_t value)
+		{
+			int width = 0;
+			for (; value != 0; value >>= 1) {
+				++width;
+			}
+			return width;
+		}
+	} // namespace
+
+	Histogram::Histogram()
+		: buckets_((MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS, 0)
+	{
+	}
+
+	// Значения меньше 2 * SUB_BUCKETS хранятся точно, дальше в корзине сохраняются старшие SUB_BUCKET_BITS + 1 бит
+	size_t Histogram::BucketIndex(uint64_t value)
+	{
+		if (value < 2 * SUB_BUCKETS) {
+			return static_cast<size_t>(value);
+		}
+		const int shift = BitWidth(value) - (SUB_BUCKET_BITS + 1);
+		return static_cast<size_t>(shift * SUB_BUCKETS + (value >> shift));
+	}
+
+	uint64_t Histogram::BucketUpperBound(size_t index)
+	{
+		if (index < 2 * SUB_BUCKETS) {
+			return index;
+		}
+		const int shift = static_cast<int>(index / SUB_BUCKETS) - 1;
+		const uint64_t lower = (index - shift * SUB_BUCKETS) << shift;
+		return lower + (uint64_t{ 1 } << shift) - 1;
+	}
+
+	void Histogram::Record(uint64_t value)
+	{
+		buckets_[min(BucketIndex(value), buckets_.size() - 1)] += 1;
+		++count_;
+		sum_ += value;
+		max_ = max(max_, value);
+	}
+
+	uint64_t Histogram::Count() const
+	{
+		return count_;
+	}
+
+	uint64_t Histogram::Max() const
+	{
+		return max_;
+	}
+
+	double Histogram::Mean() const
+	{
+		return count_ == 0 ? 0. : static_cast<double>(sum_) / count_;
+	}
+
+	uint64_t Histogram::ValueAtQuantile(double q) const
+	{
+		if (count_ == 0) {
+			return 0;
+		}
+		const uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(q * count_ + 0.999999));
+		uint64_t seen = 0;
+		for (size_t index = 0; index < buckets_.size(); ++index) {
+			seen += buckets_[index];
+			if (seen >= rank) {
+				return min(BucketUpperBound(index), max_);
+			}
+		}
+		return max_;
+	}
+
+	json::Node Histogram::ToJson() const
+	{
+		return json::Dict{
+			{ "count"s, count_ <= static_cast<uint64_t>(INT_MAX) ? json::Node(static_cast<int>(count_)) : json::Node(static_cast<double>(count_)) },
+			{ "mean_us"s, Mean() / 1000.0 },
+			{ "p50_us"s, Microseconds(ValueAtQuantile(0.5)) },
+			{ "p90_us"s, Microseconds(ValueAtQuantile(0.9)) },
+			{ "p99_us"s, Microseconds(ValueAtQuantile(0.99)) },
+			{ "p999_us"s, Microseconds(ValueAtQuantile(0.999)) },
+			{ "max_us"s, Microseconds(max_) } };
+	}
+
+	void Enable(string destination, size_t slow_requests)
+	{
+		State& state = GetState();
+		lock_guard lock(state.guard);
+		state.destination = destination.empty() || destination == "1"s ? "stderr"s : move(destination);
+		state.slow_capacity = slow_requests;
+		state.histograms.clear();
+		state.slow.clear();
+		slow_threshold.store(0, memory_order_relaxed);
+		enabled.store(true, memory_order_relaxed);
+	}
+
+	bool EnableFromArgument(string_view arg)
+	{
+		const auto value_of = [arg](string_view flag) -> optional<string_view> {
+			if (arg.size() > flag.size() && arg.substr(0, flag.size()) == flag && arg[flag.size()] == '=') {
+				return arg.substr(flag.size() + 1);
+			}
+			return nullopt;
+		};
+
+		if (arg == LATENCY_FLAG) {
+			Enable("stderr"s, GetState().slow_capacity);
+			return true;
+		}
+		if (optional<string_view> destination = value_of(LATENCY_FLAG)) {
+			Enable(string(*destination), GetState().slow_capacity);
+			return true;
+		}
+		if (optional<string_view> count = value_of(SLOW_REQUESTS_FLAG)) {
+			State& state = GetState();
+			lock_guard lock(state.guard);
+			state.slow_capacity = static_cast<size_t>(max(atoi(string(*count).c_str()), 0));
+			return true;
+		}
+		return false;
+	}
+
+	void EnableFromEnvironment()
+	{
+		if (const char* destination = getenv(LATENCY_ENV); destination != nullptr && *destination != '\0') {
+			Enable(destination);
+		}
+	}
+
+	bool IsEnabled()
+	{
+		return enabled.load(memory_order_relaxed);
+	}
+
+	Request::Request(string_view type, int id)
+	{
+		// Вложенные запросы не замеряются: их время входит во внешний
+		if (!IsEnabled() || current_request.active) {
+			return;
+		}
+		active_ = true;
+		type_ = type;
+		id_ = id;
+		current_request.active = true;
+		current_request.stages.clear();
+		start_ = Clock::now();
+	}
+
+	Request::~Request()
+	{
+		if (!active_) {
+			return;
+		}
+		const uint64_t total = Nanoseconds(Clock::now() - start_);
+		current_request.active = false;
+
+		State& state = GetState();
+		const bool slow = total > slow_threshold.load(memory_order_relaxed);
+		lock_guard lock(state.guard);
+		auto it = state.histograms.find(type_);
+		if (it == state.histograms.end()) {
+			it = state.histograms.emplace(string(type_), Histogram{}).first;
+		}
+		it->second.Record(total);
+
+		if (!slow || state.slow_capacity == 0) {
+			return;
+		}
+		if (state.slow.size() == state.slow_capacity) {
+			if (total <= state.slow.front().total) {
+				return;
+			}
+			pop_heap(state.slow.begin(), state.slow.end(), SlowerFirst);
+			state.slow.pop_back();
+		}
+		state.slow.push_back(SlowRequest{ id_, string(type_), total, current_request.stages });
+		push_heap(state.slow.begin(), state.slow.end(), SlowerFirst);
+		if (state.slow.size() == state.slow_capacity) {
+			slow_threshold.store(state.slow.front().total, memory_order_relaxed);
+		}
+	}
+
+	Stage::Stage(string_view name)
+	{
+		if (!current_request.active) {
+			return;
+		}
+		active_ = true;
+		name_ = name;
+		start_ = Clock::now();
+	}
+
+	Stage::~Stage()
+	{
+		if (!active_) {
+			return;
+		}
+		const uint64_t elapsed = Nanoseconds(Clock::now() - start_);
+		// Повторная стадия с тем же именем (например, два поиска в одном запросе) суммируется
+		for (auto& [name, time] : current_request.stages) {
+			if (name == name_) {
+				time += elapsed;
+				return;
+			}
+		}
+		current_request.stages.emplace_back(name_, elapsed);
+	}
+
+	json::Node MakeReport()
+	{
+		State& state = GetState();
+		lock_guard lock(state.guard);
+
+		json::Dict histograms;
+		for (const auto& [type, histogram] : state.histograms) {
+			histograms.emplace(type, histogram.ToJson());
+		}
+
+		vector<SlowRequest> slow = state.slow;
+		sort(slow.begin(), slow.end(), SlowerFirst);
+		json::Array slow_requests;
+		for (const SlowRequest& request : slow) {
+			json::Dict stages;
+			uint64_t staged = 0;
+			for (const auto& [name, time] : request.stages) {
+				stages.emplace(string(name), Microseconds(time));
+				staged += time;
+			}
+			// Время вне стадий: разбор запроса и построение JSON-ответа
+			stages.emplace("other"s, Microseconds(request.total > staged ? request.total - staged : 0));
+			json::Dict item;
+			item.emplace("id"s, request.id);
+			item.emplace("type"s, request.type);
+			item.emplace("total_us"s, Microseconds(request.total));
+			item.emplace("stages_us"s, move(stages));
+			slow_requests.emplace_back(move(item));
+		}
+
+		return json::Dict{
+			{ "requests"s, move(histograms) },
+			{ "slow_requests"s, move(slow_requests) } };
+	}
+
+	void WriteReport()
+	{
+		if (!IsEnabled()) {
+			return;
+		}
+		const json::Document report(MakeReport());
+		string destination;
+		{
+			State& state = GetState();
+			lock_guard lock(state.guard);
+			destination = state.destination;
+		}
+		if (destination == "stderr"s) {
+			json::Print(report, cerr);
+			cerr << '\n';
+			return;
+		}
+		ofstream out(destination);
+		if (!out) {
+			cerr << "Cannot write latency report to "sv << destination << '\n';
+			return;
+		}
+		json::Print(report, out);
+	}
+
+} // namespace latency
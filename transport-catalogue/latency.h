@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "json.h"
+
+// Задержки ответов на stat_requests: гистограммы по типам запросов и журнал самых медленных запросов
+// с разбивкой по стадиям. Пока запись не включена, запрос и стадия стоят одну проверку флага.
+namespace latency {
+
+	// Переменная окружения с назначением отчёта: "1" или "stderr" — стандартный поток ошибок, иначе имя файла
+	inline const char* const LATENCY_ENV = "TRANSPORT_CATALOGUE_LATENCY";
+	inline const std::string_view LATENCY_FLAG = "--latency";
+	// Размер журнала медленных запросов: "--slow-requests=N"
+	inline const std::string_view SLOW_REQUESTS_FLAG = "--slow-requests";
+	inline const size_t DEFAULT_SLOW_REQUESTS = 10;
+
+	// Гистограмма с логарифмически-линейными корзинами, как в HdrHistogram: каждая степень двойки
+	// делится на SUB_BUCKETS равных корзин, поэтому относительная погрешность квантилей не больше 1/SUB_BUCKETS
+	// при фиксированном объёме памяти. Значения — наносекунды.
+	class Histogram {
+	public:
+		static const int SUB_BUCKET_BITS = 5;
+		static const uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+		// Значения больше 2^MAX_VALUE_BITS (около 4,9 часа) попадают в последнюю корзину
+		static const int MAX_VALUE_BITS = 44;
+
+		Histogram();
+
+		void Record(uint64_t value);
+
+		uint64_t Count() const;
+		uint64_t Max() const;
+		double Mean() const;
+		// Верхняя граница корзины, в которую попадает квантиль q, но не больше максимума
+		uint64_t ValueAtQuantile(double q) const;
+
+		json::Node ToJson() const;
+
+	private:
+		std::vector<uint64_t> buckets_;
+		uint64_t count_ = 0;
+		uint64_t sum_ = 0;
+		uint64_t max_ = 0;
+
+		static size_t BucketIndex(uint64_t value);
+		static uint64_t BucketUpperBound(size_t index);
+	};
+
+	void Enable(std::string destination, size_t slow_requests = DEFAULT_SLOW_REQUESTS);
+	// Разбирает ключи "--latency[=файл]" и "--slow-requests=N". Возвращает true, если arg — один из них
+	bool EnableFromArgument(std::string_view arg);
+	void EnableFromEnvironment();
+	bool IsEnabled();
+
+	// Замер одного запроса от создания до разрушения объекта: время попадает в гистограмму типа type
+	// и, если запрос среди самых медленных, в журнал вместе со стадиями.
+	class Request {
+	public:
+		Request(std::string_view type, int id);
+		~Request();
+
+		Request(const Request&) = delete;
+		Request& operator=(const Request&) = delete;
+
+	private:
+		bool active_ = false;
+		std::string_view type_;
+		int id_ = 0;
+		std::chrono::steady_clock::time_point start_;
+	};
+
+	// Стадия текущего запроса этого потока, например поиск маршрута или отрисовка.
+	// name должен быть строковым литералом: он хранится без копирования.
+	class Stage {
+	public:
+		explicit Stage(std::string_view name);
+		~Stage();
+
+		Stage(const Stage&) = delete;
+		Stage& operator=(const Stage&) = delete;
+
+	private:
+		bool active_ = false;
+		std::string_view name_;
+		std::chrono::steady_clock::time_point start_;
+	};
+
+	json::Node MakeReport();
+	// Записывает отчёт в назначение, заданное при включении записи
+	void WriteReport();
+
+} // namespace latency
@@ -3,20 +3,35 @@
 #include <string_view>
 
 #include "json_reader.h"
+#include "latency.h"
+#include "profiling.h"
+#include "snapshot.h"
 
 
 using namespace std;
 
 void PrintUsage(std::ostream& stream = std::cerr) {
-	stream << "Usage: transport_catalogue [make_base|process_requests]\n"sv;
+	stream << "Usage: transport_catalogue [make_base|update_base|process_requests|benchmark_base|memory_report|serve] [--profile[=file]] [--latency[=file]] [--slow-requests=N]\n"sv;
 }
 
 int main(int argc, char* argv[]) {
-	if (argc != 2) {
+	if (argc < 2) {
 		PrintUsage();
 		return 1;
 	}
 
+	// Отчёт о времени и памяти по этапам: ключ --profile выводит его в stderr, --profile=файл — в файл.
+	// Задержки ответов по типам запросов и самые медленные запросы: --latency и --latency=файл.
+	// Переменные окружения TRANSPORT_CATALOGUE_PROFILE и TRANSPORT_CATALOGUE_LATENCY действуют так же, ключи имеют приоритет
+	profiling::EnableFromEnvironment();
+	latency::EnableFromEnvironment();
+	for (int arg = 2; arg < argc; ++arg) {
+		if (!profiling::EnableFromArgument(argv[arg]) && !latency::EnableFromArgument(argv[arg])) {
+			PrintUsage();
+			return 1;
+		}
+	}
+
 	const std::string_view mode(argv[1]);
 
 	transport_catalogue::TransportCatalogue db;
@@ -24,26 +39,85 @@ int main(int argc, char* argv[]) {
 
 	if (mode == "make_base"sv) {
 		// make_base: создание базы транспортного справочника по запросам base_requests и её сериализация в файл.
-		reader.LoadJson(std::cin);
+		{
+			profiling::Phase phase("load_json"sv);
+			reader.LoadJson(std::cin);
+		}
 
 		// загружаем данные в базу
-		reader.ProcessBaseRequests();
+		{
+			profiling::Phase phase("base_requests"sv);
+			reader.ProcessBaseRequests();
+		}
 
 		// обрабатываем запросы к базе
+		profiling::Phase phase("serialization"sv);
 		reader.ProcessSerialization();
 	}
+	else if (mode == "update_base"sv) {
+		// update_base: применение update_requests к существующей базе и её сохранение на прежнее место.
+		{
+			profiling::Phase phase("load_json"sv);
+			reader.LoadJson(std::cin);
+		}
+
+		profiling::Phase phase("update"sv);
+		if (!reader.ProcessBaseUpdate()) {
+			return 1;
+		}
+	}
 	else if (mode == "process_requests"sv) {
 		// process_requests: десериализация базы из файла и использование её для ответов на запросы stat_requests.
-		reader.LoadJson(std::cin);
+		{
+			profiling::Phase phase("load_json"sv);
+			reader.LoadJson(std::cin);
+		}
 
-		// загружаем информацию из бинарного файла
-		reader.ProcessDeserialization();
+		// загружаем информацию из бинарного файла; по повреждённой базе на запросы не отвечаем
+		{
+			profiling::Phase phase("deserialization"sv);
+			if (!reader.ProcessDeserialization()) {
+				return 1;
+			}
+		}
 
 		// обрабатываем запросы к базе
+		profiling::Phase phase("stat_requests"sv);
 		reader.ProcessStatRequests(std::cout);
 	}
+	else if (mode == "benchmark_base"sv) {
+		// benchmark_base: размер базы, время её загрузки и время перестроения таблицы маршрутов.
+		{
+			profiling::Phase phase("load_json"sv);
+			reader.LoadJson(std::cin);
+		}
+
+		reader.ProcessBaseBenchmark(std::cout);
+	}
+	else if (mode == "memory_report"sv) {
+		// memory_report: память справочника и графа по base_requests и оценка таблицы маршрутов без сохранения базы.
+		{
+			profiling::Phase phase("load_json"sv);
+			reader.LoadJson(std::cin);
+		}
+		{
+			profiling::Phase phase("base_requests"sv);
+			reader.ProcessBaseRequests();
+		}
+		reader.ProcessMemoryReport(std::cout);
+	}
+	else if (mode == "serve"sv) {
+		// serve: ответы на поток JSON-документов; новая база загружается в фоне, не прерывая ответов по прежней.
+		snapshot::Serve(std::cin, std::cout);
+	}
 	else {
 		PrintUsage();
 		return 1;
 	}
+
+	profiling::WriteReport(mode);
+	latency::WriteReport();
+
+	// Библиотека protobuf освобождается один раз в конце: в режиме serve базы загружаются многократно
+	google::protobuf::ShutdownProtobufLibrary();
 }
@@ -1,180 +1,934 @@
 #include "map_renderer.h"
 
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
 namespace renderer {
 	using namespace std::literals;
 
-	renderer::MapRenderer::MapRenderer(const SVG_Settings& svg_settings)
+	namespace {
+		// Обрезает отрезок from-to по прямоугольнику clip (алгоритм Лианга — Барски).
+		// Возвращает false, если отрезок целиком снаружи; *_clipped отмечают сдвинутые концы.
+		bool ClipSegment(const spatial::RectIndex::Rect& clip, svg::Point& from, svg::Point& to,
+			bool& from_clipped, bool& to_clipped)
+		{
+			const double dx = to.x - from.x;
+			const double dy = to.y - from.y;
+			double t_from = 0;
+			double t_to = 1;
+			const double p[] = { -dx, dx, -dy, dy };
+			const double q[] = { from.x - clip.min_x, clip.max_x - from.x, from.y - clip.min_y, clip.max_y - from.y };
+			for (int i = 0; i < 4; ++i) {
+				if (p[i] == 0) {
+					if (q[i] < 0) {
+						return false;
+					}
+					continue;
+				}
+				const double t = q[i] / p[i];
+				if (p[i] < 0) {
+					t_from = std::max(t_from, t);
+				}
+				else {
+					t_to = std::min(t_to, t);
+				}
+			}
+			if (t_from > t_to) {
+				return false;
+			}
+
+			from_clipped = t_from > 0;
+			to_clipped = t_to < 1;
+			const svg::Point start = from;
+			if (from_clipped) {
+				from = { start.x + t_from * dx, start.y + t_from * dy };
+			}
+			if (to_clipped) {
+				to = { start.x + t_to * dx, start.y + t_to * dy };
+			}
+			return true;
+		}
+
+		// Упрощает ломаную алгоритмом Дугласа — Пекера: точка остаётся, если без неё линия отклонилась бы
+		// больше чем на tolerance. points — экранные координаты линии, geo — её точки начиная с first;
+		// обе последовательности сокращаются до оставшихся точек.
+		void SimplifyLine(std::vector<geo::Coordinates>& geo, std::vector<svg::Point>& points, size_t first, double tolerance)
+		{
+			const size_t count = points.size();
+			std::vector<bool> keep(count, false);
+			keep.front() = true;
+			keep.back() = true;
+
+			std::vector<std::pair<size_t, size_t>> ranges{ { 0, count - 1 } };
+			while (!ranges.empty()) {
+				const auto [begin, end] = ranges.back();
+				ranges.pop_back();
+
+				const svg::Point a = points[begin];
+				const svg::Point b = points[end];
+				const double dx = b.x - a.x;
+				const double dy = b.y - a.y;
+				const double length = std::hypot(dx, dy);
+				double max_distance = 0;
+				size_t farthest = begin;
+				for (size_t i = begin + 1; i < end; ++i) {
+					// У кольцевого маршрута концы совпадают, тогда отклонение считается до самой точки
+					const double distance = length > 0
+						? std::abs(dy * (points[i].x - a.x) - dx * (points[i].y - a.y)) / length
+						: std::hypot(points[i].x - a.x, points[i].y - a.y);
+					if (distance > max_distance) {
+						max_distance = distance;
+						farthest = i;
+					}
+				}
+				if (max_distance > tolerance) {
+					keep[farthest] = true;
+					ranges.push_back({ begin, farthest });
+					ranges.push_back({ farthest, end });
+				}
+			}
+
+			size_t kept = 0;
+			for (size_t i = 0; i < count; ++i) {
+				if (keep[i]) {
+					points[kept] = points[i];
+					geo[first + kept] = geo[first + i];
+					++kept;
+				}
+			}
+			points.resize(kept);
+			geo.resize(first + kept);
+		}
+
+		// Жадно расставляет надписи: надпись принимается, если не перекрывает уже принятые.
+		// Принятые прямоугольники хранятся в хеш-сетке с ячейками размера cell.
+		class LabelPlacer {
+		public:
+			explicit LabelPlacer(double cell)
+				: cell_(std::max(cell, 1.))
+			{
+			}
+
+			bool TryPlace(const spatial::RectIndex::Rect& rect)
+			{
+				const int64_t min_col = CellOf(rect.min_x);
+				const int64_t max_col = CellOf(rect.max_x);
+				const int64_t min_row = CellOf(rect.min_y);
+				const int64_t max_row = CellOf(rect.max_y);
+				for (int64_t row = min_row; row <= max_row; ++row) {
+					for (int64_t col = min_col; col <= max_col; ++col) {
+						auto it = cells_.find(Key(row, col));
+						if (it == cells_.end()) {
+							continue;
+						}
+						for (const spatial::RectIndex::Rect& placed : it->second) {
+							if (placed.Intersects(rect)) {
+								return false;
+							}
+						}
+					}
+				}
+				for (int64_t row = min_row; row <= max_row; ++row) {
+					for (int64_t col = min_col; col <= max_col; ++col) {
+						cells_[Key(row, col)].push_back(rect);
+					}
+				}
+				return true;
+			}
+
+		private:
+			double cell_;
+			std::unordered_map<uint64_t, std::vector<spatial::RectIndex::Rect>> cells_;
+
+			int64_t CellOf(double value) const
+			{
+				return static_cast<int64_t>(std::floor(value / cell_));
+			}
+
+			static uint64_t Key(int64_t row, int64_t col)
+			{
+				return (static_cast<uint64_t>(row) << 32) ^ static_cast<uint32_t>(col);
+			}
+		};
+
+		spatial::RectIndex::Rect Union(const spatial::RectIndex::Rect& lhs, const spatial::RectIndex::Rect& rhs)
+		{
+			return { std::min(lhs.min_x, rhs.min_x), std::min(lhs.min_y, rhs.min_y),
+				std::max(lhs.max_x, rhs.max_x), std::max(lhs.max_y, rhs.max_y) };
+		}
+
+		spatial::RectIndex::Rect Shift(const spatial::RectIndex::Rect& rect, double dx, double dy)
+		{
+			return { rect.min_x + dx, rect.min_y + dy, rect.max_x + dx, rect.max_y + dy };
+		}
+
+		// Область поиска точек привязки: всё, что дотягивается до area надписью размера reach в пикселях
+		spatial::RectIndex::Rect Reach(const spatial::RectIndex::Rect& area, const spatial::RectIndex::Rect& reach, double scale)
+		{
+			return { area.min_x - reach.max_x / scale, area.min_y - reach.max_y / scale,
+				area.max_x - reach.min_x / scale, area.max_y - reach.min_y / scale };
+		}
+
+		// FNV-1a по байтам значений
+		class SettingsHasher {
+		public:
+			void Add(const void* data, size_t size)
+			{
+				const unsigned char* bytes = static_cast<const unsigned char*>(data);
+				for (size_t i = 0; i < size; ++i) {
+					hash_ = (hash_ ^ bytes[i]) * 1099511628211ull;
+				}
+			}
+
+			void Add(double value)
+			{
+				uint64_t bits = 0;
+				std::memcpy(&bits, &value, sizeof(bits));
+				Add(&bits, sizeof(bits));
+			}
+
+			void Add(int value)
+			{
+				const int64_t wide = value;
+				Add(&wide, sizeof(wide));
+			}
+
+			// Длина добавляется перед строкой, чтобы соседние строки не склеивались
+			void Add(const std::string& value)
+			{
+				const uint64_t size = value.size();
+				Add(&size, sizeof(size));
+				Add(value.data(), value.size());
+			}
+
+			uint64_t Get() const
+			{
+				return hash_;
+			}
+
+		private:
+			uint64_t hash_ = 14695981039346656037ull;
+		};
+
+		// Остановки участка в stop_for_bus_forward: участок проходит span_count перегонов от from_stop до to_stop,
+		// по некольцевому маршруту — в любую сторону. Возвращает номера первой и последней остановки участка.
+		std::optional<std::pair<size_t, size_t>> FindLegStops(const domain::RouteItem_Bus& leg)
+		{
+			if (leg.bus == nullptr || leg.span_count <= 0) {
+				return std::nullopt;
+			}
+			const std::vector<domain::Stop*>& stops = leg.bus->stop_for_bus_forward;
+			const size_t span = static_cast<size_t>(leg.span_count);
+			for (size_t i = 0; i < stops.size(); ++i) {
+				if (stops[i]->id != leg.from_stop) {
+					continue;
+				}
+				if (i + span < stops.size() && stops[i + span]->id == leg.to_stop) {
+					return std::pair{ i, i + span };
+				}
+				if (!leg.bus->is_ring && i >= span && stops[i - span]->id == leg.to_stop) {
+					return std::pair{ i, i - span };
+				}
+			}
+			return std::nullopt;
+		}
+	} // namespace
+
+	bool HasLevelOfDetail(const SVG_Settings& settings)
+	{
+		return settings.simplify_tolerance > 0 || settings.thin_labels;
+	}
+
+	uint64_t SettingsHash(const SVG_Settings& settings)
+	{
+		SettingsHasher hasher;
+		hasher.Add(settings.width);
+		hasher.Add(settings.height);
+		hasher.Add(settings.padding);
+		hasher.Add(settings.line_width);
+		hasher.Add(settings.stop_radius);
+		hasher.Add(settings.bus_label_font_size);
+		hasher.Add(settings.bus_label_offset.dx);
+		hasher.Add(settings.bus_label_offset.dy);
+		hasher.Add(settings.stop_label_font_size);
+		hasher.Add(settings.stop_label_offset.dx);
+		hasher.Add(settings.stop_label_offset.dy);
+		hasher.Add(settings.underlayer_color);
+		hasher.Add(settings.underlayer_width);
+		hasher.Add(static_cast<int>(settings.color_palette.size()));
+		for (const std::string& color : settings.color_palette) {
+			hasher.Add(color);
+		}
+		hasher.Add(settings.simplify_tolerance);
+		hasher.Add(static_cast<int>(settings.thin_labels));
+		return hasher.Get();
+	}
+
+	renderer::MapRenderer::MapRenderer(const SVG_Settings& svg_settings, const std::deque<domain::Stop>& stops)
 		: svg_settings_(svg_settings)
-		, palette_index_(0)
+		, stops_(stops)
 		, max_pallete_index_(svg_settings.color_palette.size())
-		, firstPallete_(true)
 	{
 	}
 
-	svg::Document MapRenderer::DrawMap(const std::map<std::string_view, domain::Bus*>& buses) {
-		svg::Document svgDoc;
+	void MapRenderer::SetStopProjection(std::shared_ptr<const StopProjection> projection)
+	{
+		projection_ = std::move(projection);
+	}
 
-		PrepareSphereProjector(buses);
-		DrawRouteLines(buses, svgDoc);
-		DrawBusName(buses, svgDoc);
-		DrawStopPoint(svgDoc);
-		DrawStopName(svgDoc);
+	// Проектор настраивается по остановкам, через которые проходят маршруты; каждая остановка
+	// учитывается один раз, сколько бы маршрутов через неё ни проходило.
+	StopProjection MapRenderer::MakeStopProjection(const std::map<std::string_view, domain::Bus*>& buses) const
+	{
+		StopProjection projection;
+		projection.settings_hash = SettingsHash(svg_settings_);
 
+		std::vector<bool> on_map(stops_.size(), false);
+		std::vector<geo::Coordinates> geo_coords;
+		for (const auto& [sv, bus] : buses) {
+			for (const domain::Stop* stop : bus->stop_for_bus_forward) {
+				if (stop != nullptr && !stop->isRaw && !on_map[stop->id]) {
+					on_map[stop->id] = true;
+					geo_coords.push_back({ stop->latitude, stop->longitude });
+					projection.order.push_back(static_cast<uint32_t>(stop->id));
+				}
+			}
+		}
+		projection.projector.SetSphereProjector(
+			geo_coords.begin(), geo_coords.end(), svg_settings_.width, svg_settings_.height, svg_settings_.padding);
+
+		std::sort(projection.order.begin(), projection.order.end(), [this](uint32_t lhs, uint32_t rhs) {
+			return stops_[lhs].name < stops_[rhs].name;
+		});
+		projection.screen.reserve(stops_.size());
+		for (const domain::Stop& stop : stops_) {
+			projection.screen.push_back(projection.projector({ stop.latitude, stop.longitude }));
+		}
+		return projection;
+	}
+
+	const StopProjection& MapRenderer::PrepareStopProjection(const std::map<std::string_view, domain::Bus*>& buses)
+	{
+		if (!projection_ || projection_->settings_hash != SettingsHash(svg_settings_) || projection_->screen.size() != stops_.size()) {
+			projection_ = std::make_shared<const StopProjection>(MakeStopProjection(buses));
+		}
+		return *projection_;
+	}
+
+	svg::Document MapRenderer::DrawMap(const std::map<std::string_view, domain::Bus*>& buses) {
+		svg::Document svgDoc;
+		PrepareStopProjection(buses);
+		DrawLayers(buses, svgDoc);
 		return svgDoc;
 	}
 
+	void MapRenderer::RenderMap(const std::map<std::string_view, domain::Bus*>& buses, std::string& out, size_t thread_count)
+	{
+		// Меньшие части не окупают запуск потока и склейку строк
+		const size_t MIN_ITEMS_PER_CHUNK = 64;
+
+		svg::StreamDocument svgDoc(out);
+		const StopProjection& projection = PrepareStopProjection(buses);
+		const size_t chunk_count = std::min(thread_count, std::max(buses.size(), projection.order.size()) / MIN_ITEMS_PER_CHUNK);
+		if (chunk_count > 1) {
+			RenderLayersParallel(buses, chunk_count, thread_count, svgDoc);
+		}
+		else {
+			DrawLayers(buses, svgDoc);
+		}
+		svgDoc.Finish();
+	}
 
-	int MapRenderer::GetNextPaletteIndex()
+	void MapRenderer::RenderStopsOverlay(const std::map<std::string_view, domain::Bus*>& buses,
+		const std::vector<const domain::Stop*>& stops, std::string& out)
 	{
-		if (!firstPallete_ && max_pallete_index_ > 0) {
-			if (palette_index_ < max_pallete_index_ - 1) {
-				++palette_index_;
-			}
-			else {
-				palette_index_ = 0;
+		svg::StreamDocument svgDoc(out);
+
+		PrepareStopProjection(buses);
+		std::vector<uint32_t> order;
+		order.reserve(stops.size());
+		for (const domain::Stop* stop : stops) {
+			if (stop != nullptr && !stop->isRaw) {
+				order.push_back(static_cast<uint32_t>(stop->id));
 			}
-			return palette_index_;
 		}
-		firstPallete_ = false;
-		return 0;
+		std::sort(order.begin(), order.end(), [this](uint32_t lhs, uint32_t rhs) {
+			return stops_[lhs].name < stops_[rhs].name;
+		});
+		order.erase(std::unique(order.begin(), order.end()), order.end());
+		DrawStopPoint(order.begin(), order.end(), svgDoc);
+		DrawStopName(order.begin(), order.end(), svgDoc);
+
+		svgDoc.Finish();
 	}
 
-	// Настраивает проектор сферических координат на плоскость.
-	void MapRenderer::PrepareSphereProjector(const std::map<std::string_view, domain::Bus*>& buses)
+	// Слои выводятся в том же порядке, что и на полной карте. Цвета автобусов берутся те же, что на полной карте,
+	// поэтому проходится список маршрутов, но рисуются только участки найденного маршрута.
+	void MapRenderer::RenderRoute(const std::map<std::string_view, domain::Bus*>& buses,
+		const std::vector<domain::RouteItem_Bus>& legs, std::string& out)
 	{
-		// нужен вектор всех гео локаций остановок
-		std::vector<geo::Coordinates> geo_coords;
+		svg::StreamDocument svgDoc(out);
+		const StopProjection& projection = PrepareStopProjection(buses);
 
+		std::unordered_map<const domain::Bus*, std::pair<int, int>> colors;
+		for (const domain::RouteItem_Bus& leg : legs) {
+			colors.emplace(leg.bus, std::pair{ 0, 0 });
+		}
+		size_t line_ordinal = 0;
+		size_t label_ordinal = 0;
 		for (const auto& [sv, bus] : buses) {
-			for (const domain::Stop* stop : bus->stop_for_bus_forward) {
-				if (stop != nullptr && !stop->isRaw) {
-					geo_coords.push_back({ stop->latitude, stop->longitude });
-					stopsGeo_[stop->name] = { stop->latitude, stop->longitude };
+			auto color = colors.find(bus);
+			if (color != colors.end()) {
+				color->second = { PaletteIndex(line_ordinal), PaletteIndex(label_ordinal) };
+			}
+			line_ordinal += HasRouteLine(*bus) ? 1 : 0;
+			label_ordinal += bus->stop_for_bus_forward.empty() ? 0 : 1;
+		}
+
+		// Остановки посадки и высадки в порядке поездки, без повторов
+		std::vector<uint32_t> transfer_stops;
+		const auto addTransferStop = [&transfer_stops](const domain::Stop* stop) {
+			if (!stop->isRaw && std::find(transfer_stops.begin(), transfer_stops.end(), stop->id) == transfer_stops.end()) {
+				transfer_stops.push_back(static_cast<uint32_t>(stop->id));
+			}
+		};
+
+		svg::Polyline line = RouteLineStyle();
+		for (const domain::RouteItem_Bus& leg : legs) {
+			const std::optional<std::pair<size_t, size_t>> bounds = FindLegStops(leg);
+			if (!bounds) {
+				continue;
+			}
+			const std::vector<domain::Stop*>& stops = leg.bus->stop_for_bus_forward;
+			const auto [first, last] = *bounds;
+			line.ClearPoints();
+			for (size_t i = first;; i = first < last ? i + 1 : i - 1) {
+				if (!stops[i]->isRaw) {
+					line.AddPoint(projection.screen[stops[i]->id]);
+				}
+				if (i == last) {
+					break;
 				}
 			}
+			line.SetStrokeColor(svg_settings_.color_palette[colors.at(leg.bus).first]);
+			svgDoc.Add(line);
+			addTransferStop(stops[first]);
+			addTransferStop(stops[last]);
 		}
 
-		// Создаём проектор сферических координат на карту
-		proj_.SetSphereProjector(
-			geo_coords.begin(), geo_coords.end(), svg_settings_.width, svg_settings_.height, svg_settings_.padding);
+		svg::Text busName = BusLabelStyle();
+		svg::Text busNameBg = UnderlayerStyle(busName);
+		for (const domain::RouteItem_Bus& leg : legs) {
+			const std::optional<std::pair<size_t, size_t>> bounds = FindLegStops(leg);
+			if (!bounds || leg.bus->stop_for_bus_forward[bounds->first]->isRaw) {
+				continue;
+			}
+			const svg::Point position = projection.screen[leg.from_stop];
+			busNameBg.SetPosition(position).SetData(leg.bus->name);
+			busName.SetPosition(position).SetData(leg.bus->name);
+			busName.SetFillColor(svg_settings_.color_palette[colors.at(leg.bus).second]);
+			svgDoc.Add(busNameBg);
+			svgDoc.Add(busName);
+		}
+
+		DrawStopPoint(transfer_stops.begin(), transfer_stops.end(), svgDoc);
+		DrawStopName(transfer_stops.begin(), transfer_stops.end(), svgDoc);
+
+		svgDoc.Finish();
 	}
 
-	void MapRenderer::DrawRouteLines(const std::map<std::string_view, domain::Bus*>& buses, svg::Document& svgDoc)
+	// Каждый слой делится на chunk_count частей примерно поровну, для частей маршрутов заранее
+	// считается, сколько цветов палитры израсходовано до них. Части выводятся в свои строки,
+	// потоки разбирают их по очереди, а затем строки склеиваются в порядке слоёв.
+	void MapRenderer::RenderLayersParallel(const std::map<std::string_view, domain::Bus*>& buses, size_t chunk_count,
+		size_t thread_count, svg::StreamDocument& svgDoc) const
 	{
+		struct BusChunk {
+			BusIterator first;
+			size_t line_ordinal = 0;
+			size_t label_ordinal = 0;
+		};
+
+		std::vector<BusChunk> busChunks;
+		busChunks.reserve(chunk_count + 1);
+		BusChunk current{ buses.begin() };
+		for (size_t index = 0; index < buses.size(); ++index, ++current.first) {
+			if (busChunks.size() < chunk_count && index == buses.size() * busChunks.size() / chunk_count) {
+				busChunks.push_back(current);
+			}
+			const domain::Bus& bus = *current.first->second;
+			current.line_ordinal += HasRouteLine(bus) ? 1 : 0;
+			current.label_ordinal += bus.stop_for_bus_forward.empty() ? 0 : 1;
+		}
+		busChunks.resize(chunk_count, current);
+		busChunks.push_back(current);
+
+		const std::vector<uint32_t>& order = projection_->order;
+		std::vector<StopIterator> stopChunks;
+		stopChunks.reserve(chunk_count + 1);
+		for (size_t chunk = 0; chunk <= chunk_count; ++chunk) {
+			stopChunks.push_back(order.begin() + order.size() * chunk / chunk_count);
+		}
+
+		// Части нумеруются подряд: сначала все части линий, затем надписей маршрутов, кругов и названий остановок
+		const size_t LAYER_COUNT = 4;
+		std::vector<std::string> fragments(LAYER_COUNT * chunk_count);
+		const auto drawFragment = [&](size_t task) {
+			const size_t chunk = task % chunk_count;
+			svg::StreamFragment fragment(fragments[task]);
+			switch (task / chunk_count) {
+			case 0:
+				DrawRouteLines(busChunks[chunk].first, busChunks[chunk + 1].first, busChunks[chunk].line_ordinal, fragment);
+				break;
+			case 1:
+				DrawBusName(busChunks[chunk].first, busChunks[chunk + 1].first, busChunks[chunk].label_ordinal, fragment);
+				break;
+			case 2:
+				DrawStopPoint(stopChunks[chunk], stopChunks[chunk + 1], fragment);
+				break;
+			default:
+				DrawStopName(stopChunks[chunk], stopChunks[chunk + 1], fragment);
+				break;
+			}
+		};
+
+		std::atomic<size_t> nextTask = 0;
+		const auto worker = [&]() {
+			for (size_t task = nextTask++; task < fragments.size(); task = nextTask++) {
+				drawFragment(task);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count - 1);
+		for (size_t index = 1; index < std::min(thread_count, fragments.size()); ++index) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+
+		for (const std::string& fragment : fragments) {
+			svgDoc.Append(fragment);
+		}
+	}
+
+	template <typename Container>
+	void MapRenderer::DrawLayers(const std::map<std::string_view, domain::Bus*>& buses, Container& svgDoc) const
+	{
+		DrawRouteLines(buses.begin(), buses.end(), 0, svgDoc);
+		DrawBusName(buses.begin(), buses.end(), 0, svgDoc);
+		DrawStopPoint(projection_->order.begin(), projection_->order.end(), svgDoc);
+		DrawStopName(projection_->order.begin(), projection_->order.end(), svgDoc);
+	}
+
+	int MapRenderer::PaletteIndex(size_t ordinal) const
+	{
+		return max_pallete_index_ > 0 ? static_cast<int>(ordinal % max_pallete_index_) : 0;
+	}
+
+	bool MapRenderer::HasRouteLine(const domain::Bus& bus)
+	{
+		return std::count_if(bus.stop_for_bus_forward.begin(), bus.stop_for_bus_forward.end(),
+			[](const domain::Stop* stop) { return stop != nullptr && !stop->isRaw; }) > 1;
+	}
+
+	template <typename Container>
+	void MapRenderer::DrawRouteLines(BusIterator first, BusIterator last, size_t ordinal, Container& svgDoc) const
+	{
+		// настройки вывода общие для всех линий, меняются только вершины и цвет
+		svg::Polyline line = RouteLineStyle();
+
 		// задаем коодринаты остановкам
-		for (const auto& [sv, bus] : buses) {
-			svg::Polyline line;
-			int noraw_count = 0;
+		for (; first != last; ++first) {
+			const domain::Bus* bus = first->second;
+			if (!HasRouteLine(*bus)) {
+				continue;
+			}
 
+			line.ClearPoints();
 			for (const domain::Stop* stop : bus->stop_for_bus_forward) {
 				if (stop != nullptr && !stop->isRaw) {
-					svg::Point screen_coord = proj_({ stop->latitude, stop->longitude });
-					line.AddPoint({ screen_coord.x, screen_coord.y });
-					++noraw_count;
+					line.AddPoint(projection_->screen[stop->id]);
 				}
 			}
 
-			if (bus->stop_for_bus_forward.size() > 0 && noraw_count > 1) {
-				// задаем настройки вывода
-				line.SetFillColor("none");
-				line.SetStrokeColor(svg_settings_.color_palette[GetNextPaletteIndex()]);
-				line.SetStrokeWidth(svg_settings_.line_width);
-				line.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
-				line.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
-
-				svgDoc.Add(line);
-			}
+			line.SetStrokeColor(svg_settings_.color_palette[PaletteIndex(ordinal++)]);
+			svgDoc.Add(line);
 		}
 	}
 
-	void MapRenderer::DrawBusName(const std::map<std::string_view, domain::Bus*>& buses, svg::Document& svgDoc)
+	template <typename Container>
+	void MapRenderer::DrawBusName(BusIterator first, BusIterator last, size_t ordinal, Container& svgDoc) const
 	{
-		palette_index_ = 0;
-		firstPallete_ = true;
-		int curentPalleteId = 0;
-		for (const auto& [sv, bus] : buses) {
+		svg::Text busName = BusLabelStyle();
+		svg::Text busNameBg = UnderlayerStyle(busName);
+
+		// подложка выводится перед надписью в той же точке
+		const auto drawName = [&](const domain::Stop* stop) {
+			const svg::Point position = projection_->screen[stop->id];
+			busNameBg.SetPosition(position);
+			busName.SetPosition(position);
+			svgDoc.Add(busNameBg);
+			svgDoc.Add(busName);
+		};
+
+		for (; first != last; ++first) {
+			const domain::Bus* bus = first->second;
 			if (bus->stop_for_bus_forward.size() > 0) {
-				svg::Text busNameFirst;
 				domain::Stop* firstStop = bus->stop_for_bus_forward[0];
-				curentPalleteId = GetNextPaletteIndex();
-
-				busNameFirst.SetData(std::string(bus->name));
-				busNameFirst.SetPosition(proj_({ firstStop->latitude, firstStop->longitude }));
-				busNameFirst.SetOffset({ svg_settings_.bus_label_offset.dx, svg_settings_.bus_label_offset.dy });
-				busNameFirst.SetFontSize(svg_settings_.bus_label_font_size);
-				busNameFirst.SetFontFamily("Verdana"s);
-				busNameFirst.SetFontWeight("bold"s);
-				busNameFirst.SetFillColor(svg_settings_.color_palette[curentPalleteId]);
-
-				svg::Text busNameFirstBg(busNameFirst);
-				busNameFirstBg.SetFillColor(svg_settings_.underlayer_color);
-				busNameFirstBg.SetStrokeColor(svg_settings_.underlayer_color);
-				busNameFirstBg.SetStrokeWidth(svg_settings_.underlayer_width);
-				busNameFirstBg.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
-				busNameFirstBg.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
-
-				svgDoc.Add(busNameFirstBg);
-				svgDoc.Add(busNameFirst);
-
-				if (!bus->is_ring && (bus->stop_for_bus_forward[0]->name != bus->secondFinalStop->name)) {
-					svg::Text busNameSecond;
-					domain::Stop* secondStop = bus->secondFinalStop;
 
-					busNameSecond.SetData(std::string(bus->name));
-					busNameSecond.SetPosition(proj_({ secondStop->latitude, secondStop->longitude }));
-					busNameSecond.SetOffset({ svg_settings_.bus_label_offset.dx, svg_settings_.bus_label_offset.dy });
-					busNameSecond.SetFontSize(svg_settings_.bus_label_font_size);
-					busNameSecond.SetFontFamily("Verdana"s);
-					busNameSecond.SetFontWeight("bold"s);
-					busNameSecond.SetFillColor(svg_settings_.color_palette[curentPalleteId]);
+				busName.SetData(bus->name);
+				busNameBg.SetData(bus->name);
+				busName.SetFillColor(svg_settings_.color_palette[PaletteIndex(ordinal++)]);
 
-					svg::Text busNameSecondBg(busNameSecond);
-					busNameSecondBg.SetFillColor(svg_settings_.underlayer_color);
-					busNameSecondBg.SetStrokeColor(svg_settings_.underlayer_color);
-					busNameSecondBg.SetStrokeWidth(svg_settings_.underlayer_width);
-					busNameSecondBg.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
-					busNameSecondBg.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
+				drawName(firstStop);
 
-					svgDoc.Add(busNameSecondBg);
-					svgDoc.Add(busNameSecond);
+				if (!bus->is_ring && (bus->stop_for_bus_forward[0]->name != bus->secondFinalStop->name)) {
+					drawName(bus->secondFinalStop);
 				}
 			}
 		}
 	}
 
-	void renderer::MapRenderer::DrawStopPoint(svg::Document& svgDoc)
+	template <typename Container>
+	void renderer::MapRenderer::DrawStopPoint(StopIterator first, StopIterator last, Container& svgDoc) const
 	{
-		for (const auto& [name, geo] : stopsGeo_) {
-			svg::Circle cr;
-			cr.SetCenter(proj_(geo));
-			cr.SetRadius(svg_settings_.stop_radius);
-			cr.SetFillColor("white");
+		svg::Circle cr = StopPointStyle();
+		for (; first != last; ++first) {
+			cr.SetCenter(projection_->screen[*first]);
 			svgDoc.Add(cr);
 		}
 	}
 
-	void renderer::MapRenderer::DrawStopName(svg::Document& svgDoc)
+	template <typename Container>
+	void renderer::MapRenderer::DrawStopName(StopIterator first, StopIterator last, Container& svgDoc) const
 	{
-		for (const auto& [name, geo] : stopsGeo_) {
-			svg::Text textName;
+		svg::Text textName = StopLabelStyle();
+		svg::Text textNameBg = UnderlayerStyle(textName);
 
-			textName.SetPosition(proj_(geo));
-			textName.SetOffset({ svg_settings_.stop_label_offset.dx, svg_settings_.stop_label_offset.dy });
-			textName.SetFontSize(svg_settings_.stop_label_font_size);
-			textName.SetFontFamily("Verdana");
-			textName.SetData(std::string(name));
-			textName.SetFillColor("black");
+		for (; first != last; ++first) {
+			const svg::Point position = projection_->screen[*first];
+			const std::string_view name = stops_[*first].name;
+			textNameBg.SetPosition(position).SetData(name);
+			textName.SetPosition(position).SetData(name);
 
-			svg::Text textNameBg(textName);
-			textNameBg.SetFillColor(svg_settings_.underlayer_color);
-			textNameBg.SetStrokeColor(svg_settings_.underlayer_color);
-			textNameBg.SetStrokeWidth(svg_settings_.underlayer_width);
-			textNameBg.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
-			textNameBg.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
+			svgDoc.Add(textNameBg);
+			svgDoc.Add(textName);
+		}
+	}
+
+	svg::Polyline MapRenderer::RouteLineStyle() const
+	{
+		svg::Polyline line;
+		line.SetFillColor("none");
+		line.SetStrokeWidth(svg_settings_.line_width);
+		line.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
+		line.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
+		return line;
+	}
+
+	svg::Text MapRenderer::BusLabelStyle() const
+	{
+		svg::Text label;
+		label.SetOffset({ svg_settings_.bus_label_offset.dx, svg_settings_.bus_label_offset.dy });
+		label.SetFontSize(svg_settings_.bus_label_font_size);
+		label.SetFontFamily("Verdana"sv);
+		label.SetFontWeight("bold"sv);
+		return label;
+	}
+
+	svg::Circle MapRenderer::StopPointStyle() const
+	{
+		svg::Circle cr;
+		cr.SetRadius(svg_settings_.stop_radius);
+		cr.SetFillColor("white");
+		return cr;
+	}
+
+	svg::Text MapRenderer::StopLabelStyle() const
+	{
+		svg::Text label;
+		label.SetOffset({ svg_settings_.stop_label_offset.dx, svg_settings_.stop_label_offset.dy });
+		label.SetFontSize(svg_settings_.stop_label_font_size);
+		label.SetFontFamily("Verdana");
+		label.SetFillColor("black");
+		return label;
+	}
+
+	// Подложка повторяет надпись и обводит её цветом фона
+	svg::Text MapRenderer::UnderlayerStyle(svg::Text label) const
+	{
+		label.SetFillColor(svg_settings_.underlayer_color);
+		label.SetStrokeColor(svg_settings_.underlayer_color);
+		label.SetStrokeWidth(svg_settings_.underlayer_width);
+		label.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
+		label.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
+		return label;
+	}
+
+	// С запасом ширина символа принимается равной размеру шрифта, а каждый байт UTF-8 — символом.
+	// Средняя ширина символа Verdana — около 0,6 размера шрифта, символы считаются по первым байтам.
+	// Подложка расширяет надпись на свою толщину.
+	spatial::RectIndex::Rect MapRenderer::LabelExtent(Point offset, int font_size, std::string_view text, bool average) const
+	{
+		double width = static_cast<double>(text.size()) * font_size;
+		if (average) {
+			const auto chars = std::count_if(text.begin(), text.end(), [](char c) { return (c & 0xC0) != 0x80; });
+			width = static_cast<double>(chars) * font_size * 0.6;
+		}
+		const double margin = svg_settings_.underlayer_width;
+		return {
+			offset.dx - margin,
+			offset.dy - font_size - margin,
+			offset.dx + width + margin,
+			offset.dy + font_size / 2. + margin
+		};
+	}
+
+	// Раскладка повторяет порядок и цвета элементов DrawLayers, чтобы часть карты
+	// совпадала с соответствующим местом полной карты. При включённом упрощении линии упрощаются,
+	// а надписи прореживаются для масштаба 2^level.
+	MapLayout MapRenderer::MakeLayout(const std::map<std::string_view, domain::Bus*>& buses, int level)
+	{
+		MapLayout layout;
+		const StopProjection& projection = PrepareStopProjection(buses);
+		layout.projector_ = projection.projector;
+		layout.width_ = svg_settings_.width;
+		layout.height_ = svg_settings_.height;
+
+		const double scale = std::ldexp(1., level);
+		// Допуск упрощения в координатах полной карты
+		const double tolerance = svg_settings_.simplify_tolerance / scale;
+
+		std::vector<spatial::RectIndex::Segment> segment_lines;
+		std::vector<svg::Point> screen_points;
+		size_t line_ordinal = 0;
+		for (const auto& [sv, bus] : buses) {
+			MapLayout::Line line;
+			line.first_point = layout.points_.size();
+			screen_points.clear();
+			for (const domain::Stop* stop : bus->stop_for_bus_forward) {
+				if (stop != nullptr && !stop->isRaw) {
+					layout.points_.push_back({ stop->latitude, stop->longitude });
+					screen_points.push_back(projection.screen[stop->id]);
+				}
+			}
+			if (bus->stop_for_bus_forward.empty() || screen_points.size() < 2) {
+				layout.points_.resize(line.first_point);
+				continue;
+			}
+			line.color = PaletteIndex(line_ordinal++);
 
+			if (tolerance > 0) {
+				SimplifyLine(layout.points_, screen_points, line.first_point, tolerance);
+			}
+			line.point_count = screen_points.size();
+
+			const size_t line_id = layout.lines_.size();
+			layout.lines_.push_back(line);
+			for (size_t i = 0; i + 1 < screen_points.size(); ++i) {
+				layout.segments_.push_back({ line_id, line.first_point + i });
+				segment_lines.push_back({ screen_points[i].x, screen_points[i].y, screen_points[i + 1].x, screen_points[i + 1].y });
+			}
+		}
+
+		// Надписи маршрутов расставляются первыми и при прореживании вытесняют надписи остановок.
+		// Круги остановок прореживаются отдельно, только между собой.
+		LabelPlacer labelPlacer(std::max(svg_settings_.bus_label_font_size, svg_settings_.stop_label_font_size) * 2.);
+		LabelPlacer pointPlacer(svg_settings_.stop_radius * 4.);
+		const auto place = [&](LabelPlacer& placer, svg::Point position, const spatial::RectIndex::Rect& extent) {
+			return !svg_settings_.thin_labels || placer.TryPlace(Shift(extent, position.x * scale, position.y * scale));
+		};
+
+		std::vector<spatial::RectIndex::Rect> bus_label_anchors;
+		size_t label_ordinal = 0;
+		const auto addBusLabel = [&](std::string_view name, const domain::Stop* stop, int color) {
+			const geo::Coordinates position{ stop->latitude, stop->longitude };
+			const svg::Point screen = projection.screen[stop->id];
+			const spatial::RectIndex::Rect extent = LabelExtent(svg_settings_.bus_label_offset, svg_settings_.bus_label_font_size, name);
+			if (!place(labelPlacer, screen, LabelExtent(svg_settings_.bus_label_offset, svg_settings_.bus_label_font_size, name, true))) {
+				return;
+			}
+			layout.bus_label_reach_ = Union(layout.bus_label_reach_, extent);
+			layout.bus_labels_.push_back({ name, position, color });
+			bus_label_anchors.push_back({ screen.x, screen.y, screen.x, screen.y });
+		};
+		for (const auto& [sv, bus] : buses) {
+			if (bus->stop_for_bus_forward.empty()) {
+				continue;
+			}
+			const int color = PaletteIndex(label_ordinal++);
+			addBusLabel(bus->name, bus->stop_for_bus_forward[0], color);
+			if (!bus->is_ring && (bus->stop_for_bus_forward[0]->name != bus->secondFinalStop->name)) {
+				addBusLabel(bus->name, bus->secondFinalStop, color);
+			}
+		}
+
+		const double radius = svg_settings_.stop_radius;
+		std::vector<spatial::RectIndex::Rect> stop_anchors;
+		layout.stops_.reserve(projection.order.size());
+		stop_anchors.reserve(projection.order.size());
+		for (uint32_t id : projection.order) {
+			const std::string_view name = stops_[id].name;
+			const geo::Coordinates geo{ stops_[id].latitude, stops_[id].longitude };
+			const svg::Point screen = projection.screen[id];
+			const spatial::RectIndex::Rect point_extent{ -radius, -radius, radius, radius };
+			MapLayout::StopMark stop{ name, geo };
+			stop.has_point = place(pointPlacer, screen, point_extent);
+			stop.has_label = place(labelPlacer, screen,
+				LabelExtent(svg_settings_.stop_label_offset, svg_settings_.stop_label_font_size, name, true));
+			if (!stop.has_point && !stop.has_label) {
+				continue;
+			}
+			layout.stop_reach_ = Union(layout.stop_reach_, point_extent);
+			if (stop.has_label) {
+				layout.stop_reach_ = Union(layout.stop_reach_,
+					LabelExtent(svg_settings_.stop_label_offset, svg_settings_.stop_label_font_size, name));
+			}
+			layout.stops_.push_back(stop);
+			stop_anchors.push_back({ screen.x, screen.y, screen.x, screen.y });
+		}
+
+		layout.segments_index_ = spatial::RectIndex(segment_lines);
+		layout.bus_labels_index_ = spatial::RectIndex(std::move(bus_label_anchors));
+		layout.stops_index_ = spatial::RectIndex(std::move(stop_anchors));
+		return layout;
+	}
+
+	void MapRenderer::RenderViewport(const MapLayout& layout, const Viewport& viewport, std::string& out) const
+	{
+		const SphereProjector proj = layout.projector_.Viewport(viewport.origin, viewport.scale);
+		// Видимая область в координатах полной карты
+		const spatial::RectIndex::Rect area{
+			viewport.origin.x,
+			viewport.origin.y,
+			viewport.origin.x + layout.width_ / viewport.scale,
+			viewport.origin.y + layout.height_ / viewport.scale
+		};
+		// Линии обрезаются с запасом на толщину, чтобы скругления концов не появлялись на краю изображения
+		const double margin = svg_settings_.line_width;
+		const spatial::RectIndex::Rect clip{ -margin, -margin, layout.width_ + margin, layout.height_ + margin };
+		const double area_margin = margin / viewport.scale;
+		const spatial::RectIndex::Rect line_area{
+			area.min_x - area_margin, area.min_y - area_margin, area.max_x + area_margin, area.max_y + area_margin };
+
+		svg::StreamDocument svgDoc(out);
+
+		// Участки одной линии идут подряд; соседние участки, не обрезанные в общей точке, выводятся одной ломаной
+		svg::Polyline line = RouteLineStyle();
+		size_t current_line = 0;
+		size_t next_point = 0;
+		const auto flush = [&] {
+			if (!line.GetPoints().empty()) {
+				line.SetStrokeColor(svg_settings_.color_palette[layout.lines_[current_line].color]);
+				svgDoc.Add(line);
+				line.ClearPoints();
+			}
+		};
+		for (size_t id : layout.segments_index_.Find(line_area)) {
+			const MapLayout::Segment& segment = layout.segments_[id];
+			svg::Point from = proj(layout.points_[segment.point]);
+			svg::Point to = proj(layout.points_[segment.point + 1]);
+			bool from_clipped = false;
+			bool to_clipped = false;
+			if (!ClipSegment(clip, from, to, from_clipped, to_clipped)) {
+				continue;
+			}
+			const bool continues = !line.GetPoints().empty() && segment.line == current_line
+				&& segment.point == next_point && !from_clipped;
+			if (!continues) {
+				flush();
+				current_line = segment.line;
+				line.AddPoint(from);
+			}
+			line.AddPoint(to);
+			// Обрезанный конец обрывает ломаную: следующий видимый участок начнёт новую
+			next_point = to_clipped ? SIZE_MAX : segment.point + 1;
+		}
+		flush();
+
+		svg::Text busName = BusLabelStyle();
+		svg::Text busNameBg = UnderlayerStyle(busName);
+		for (size_t id : layout.bus_labels_index_.Find(Reach(area, layout.bus_label_reach_, viewport.scale))) {
+			const MapLayout::BusLabel& label = layout.bus_labels_[id];
+			const svg::Point position = proj(label.position);
+			busNameBg.SetPosition(position).SetData(label.name);
+			busName.SetPosition(position).SetData(label.name);
+			busName.SetFillColor(svg_settings_.color_palette[label.color]);
+			svgDoc.Add(busNameBg);
+			svgDoc.Add(busName);
+		}
+
+		const std::vector<size_t> stops = layout.stops_index_.Find(Reach(area, layout.stop_reach_, viewport.scale));
+		svg::Circle cr = StopPointStyle();
+		for (size_t id : stops) {
+			if (layout.stops_[id].has_point) {
+				cr.SetCenter(proj(layout.stops_[id].position));
+				svgDoc.Add(cr);
+			}
+		}
+
+		svg::Text textName = StopLabelStyle();
+		svg::Text textNameBg = UnderlayerStyle(textName);
+		for (size_t id : stops) {
+			const MapLayout::StopMark& stop = layout.stops_[id];
+			if (!stop.has_label) {
+				continue;
+			}
+			const svg::Point position = proj(stop.position);
+			textNameBg.SetPosition(position).SetData(stop.name);
+			textName.SetPosition(position).SetData(stop.name);
 			svgDoc.Add(textNameBg);
 			svgDoc.Add(textName);
 		}
+
+		svgDoc.Finish();
+	}
+
+	std::optional<Viewport> MapLayout::TileViewport(int z, int x, int y) const
+	{
+		if (z < 0 || z > MAX_TILE_ZOOM) {
+			return std::nullopt;
+		}
+		const int tiles = 1 << z;
+		if (x < 0 || x >= tiles || y < 0 || y >= tiles) {
+			return std::nullopt;
+		}
+		return Viewport{ { x * width_ / tiles, y * height_ / tiles }, static_cast<double>(tiles) };
+	}
+
+	int MapLayout::DetailLevel(const Viewport& viewport)
+	{
+		const double level = std::floor(std::log2(viewport.scale) + EPSILON);
+		return static_cast<int>(std::clamp(level, 0., static_cast<double>(MAX_TILE_ZOOM)));
+	}
+
+	std::optional<Viewport> MapLayout::BoundsViewport(geo::Coordinates first, geo::Coordinates second) const
+	{
+		const svg::Point a = projector_(first);
+		const svg::Point b = projector_(second);
+		const double area_width = std::abs(a.x - b.x);
+		const double area_height = std::abs(a.y - b.y);
+		if (IsZero(area_width) && IsZero(area_height)) {
+			return std::nullopt;
+		}
+
+		// Область вписывается в изображение целиком, лишнее место остаётся справа или снизу
+		double scale = 0;
+		if (IsZero(area_width)) {
+			scale = height_ / area_height;
+		}
+		else if (IsZero(area_height)) {
+			scale = width_ / area_width;
+		}
+		else {
+			scale = std::min(width_ / area_width, height_ / area_height);
+		}
+		return Viewport{ { std::min(a.x, b.x), std::min(a.y, b.y) }, scale };
 	}
 
 	bool IsZero(double value) {
@@ -183,11 +937,34 @@ namespace renderer {
 
 	svg::Point SphereProjector::operator()(geo::Coordinates coords) const {
 		return {
-			(coords.lng - min_lon_) * zoom_coeff_ + padding_,
-			(max_lat_ - coords.lat) * zoom_coeff_ + padding_
+			(coords.lng - min_lon_) * zoom_coeff_ + offset_x_,
+			(max_lat_ - coords.lat) * zoom_coeff_ + offset_y_
 		};
 	}
 
+	SphereProjector::SphereProjector(const Parameters& parameters)
+		: offset_x_(parameters.offset_x)
+		, offset_y_(parameters.offset_y)
+		, min_lon_(parameters.min_lon)
+		, max_lat_(parameters.max_lat)
+		, zoom_coeff_(parameters.zoom_coeff)
+	{
+	}
+
+	SphereProjector::Parameters SphereProjector::GetParameters() const
+	{
+		return { offset_x_, offset_y_, min_lon_, max_lat_, zoom_coeff_ };
+	}
+
+	SphereProjector SphereProjector::Viewport(svg::Point origin, double scale) const
+	{
+		SphereProjector result(*this);
+		result.zoom_coeff_ = zoom_coeff_ * scale;
+		result.offset_x_ = (offset_x_ - origin.x) * scale;
+		result.offset_y_ = (offset_y_ - origin.y) * scale;
+		return result;
+	}
+
 
 
 }
\ No newline at end of file
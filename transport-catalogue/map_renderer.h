@@ -1,20 +1,27 @@
 #pragma once
 
 #include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <deque>
+#include <memory>
 #include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <vector>
 #include <map>
 
 #include "geo.h"
 #include "svg.h"
 #include "domain.h"
+#include "spatial_index.h"
 
 namespace renderer {
 
     inline const double EPSILON = 1e-6;
+    // Наибольший уровень плиток: на нём полная карта делится на 2^24 x 2^24 плиток
+    inline const int MAX_TILE_ZOOM = 24;
 
     struct Point {
         double dx = 0;
@@ -40,19 +47,49 @@ namespace renderer {
         double underlayer_width = 0;
 
         std::vector<std::string> color_palette;
+
+        // Упрощение линий маршрутов: наибольшее отклонение упрощённой линии в пикселях, 0 — не упрощать
+        double simplify_tolerance = 0;
+        // Пропускать остановки и надписи маршрутов, которые перекрыли бы уже выведенные надписи
+        bool thin_labels = false;
+    };
+
+    // Включено ли упрощение карты в зависимости от масштаба
+    bool HasLevelOfDetail(const SVG_Settings& settings);
+
+    // Хеш настроек визуализации. Не зависит от реализации стандартной библиотеки,
+    // поэтому его можно сохранить в базе вместе с заранее отрисованной картой.
+    uint64_t SettingsHash(const SVG_Settings& settings);
+
+    // Svg-карта всех маршрутов и хеш настроек, по которым она отрисована
+    struct RenderedMap {
+        uint64_t settings_hash = 0;
+        std::string svg;
     };
 
     bool IsZero(double value);
 
     class SphereProjector {
     public:
+        // Параметры проекции, по которым её можно восстановить без исходных точек
+        struct Parameters {
+            double offset_x = 0;
+            double offset_y = 0;
+            double min_lon = 0;
+            double max_lat = 0;
+            double zoom_coeff = 0;
+        };
+
         SphereProjector() = default;
+        explicit SphereProjector(const Parameters& parameters);
+
         // points_begin и points_end задают начало и конец интервала элементов geo::Coordinates
         template <typename PointInputIt>
         void SetSphereProjector(PointInputIt points_begin, PointInputIt points_end,
             double max_width, double max_height, double padding)
         {
-            padding_ = padding;
+            offset_x_ = padding;
+            offset_y_ = padding;
             // Если точки поверхности сферы не заданы, вычислять нечего
             if (points_begin == points_end) {
                 return;
@@ -102,33 +139,170 @@ namespace renderer {
         // Проецирует широту и долготу в координаты внутри SVG-изображения
         svg::Point operator()(geo::Coordinates coords) const;
 
+        // Проектор для части карты: точка origin полной карты переходит в начало координат,
+        // а расстояния на карте умножаются на scale
+        SphereProjector Viewport(svg::Point origin, double scale) const;
+
+        Parameters GetParameters() const;
+
     private:
-        double padding_ = 0;
+        double offset_x_ = 0;
+        double offset_y_ = 0;
         double min_lon_ = 0;
         double max_lat_ = 0;
         double zoom_coeff_ = 0;
     };
 
 
+    // Проекция остановок на полную карту. Зависит только от справочника и настроек визуализации,
+    // поэтому строится при make_base и хранится в базе, а при отрисовке координаты только читаются.
+    struct StopProjection {
+        uint64_t settings_hash = 0;
+        SphereProjector projector;
+        // Координаты на полной карте по номеру остановки
+        std::vector<svg::Point> screen;
+        // Номера остановок, через которые проходят маршруты, по алфавиту названий — в этом порядке они выводятся
+        std::vector<uint32_t> order;
+    };
+
+    // Видимая часть полной карты: левый верхний угол в координатах полной карты
+    // и масштаб, с которым эта часть растягивается на всё изображение
+    struct Viewport {
+        svg::Point origin;
+        double scale = 1;
+    };
+
+    // Раскладка полной карты для вывода её частей. Строится один раз на справочник и настройки:
+    // хранит проекцию, цвета маршрутов и индексы участков линий, надписей и остановок,
+    // поэтому вывод части карты зависит от числа видимых элементов, а не от размера города.
+    class MapLayout {
+    public:
+        // Плитка z/x/y: полная карта делится на 2^z x 2^z плиток, x растёт вправо, y — вниз
+        std::optional<Viewport> TileViewport(int z, int x, int y) const;
+        // Область, в которую вписан прямоугольник с противоположными углами first и second
+        std::optional<Viewport> BoundsViewport(geo::Coordinates first, geo::Coordinates second) const;
+
+        // Уровень детализации для масштаба: целая часть log2(scale). Упрощённые линии и прореженные
+        // надписи строятся отдельно для каждого уровня, и раскладка уровня годится для всех масштабов в нём.
+        static int DetailLevel(const Viewport& viewport);
+
+    private:
+        friend class MapRenderer;
+
+        // Линия маршрута — отрезок points_ с нередуцированными остановками
+        struct Line {
+            size_t first_point = 0;
+            size_t point_count = 0;
+            int color = 0;
+        };
+
+        // Участок линии между точками point и point + 1
+        struct Segment {
+            size_t line = 0;
+            size_t point = 0;
+        };
+
+        struct BusLabel {
+            std::string_view name;
+            geo::Coordinates position;
+            int color = 0;
+        };
+
+        struct StopMark {
+            std::string_view name;
+            geo::Coordinates position;
+            // При прореживании круг и надпись остановки проверяются на перекрытие по отдельности
+            bool has_point = true;
+            bool has_label = true;
+        };
+
+        SphereProjector projector_;
+        double width_ = 0;
+        double height_ = 0;
+        std::vector<geo::Coordinates> points_;
+        std::vector<Line> lines_;
+        std::vector<Segment> segments_;
+        std::vector<BusLabel> bus_labels_;
+        std::vector<StopMark> stops_;
+        spatial::RectIndex segments_index_;
+        // Надписи и остановки индексируются по точкам привязки. Их размер в пикселях не зависит
+        // от масштаба, поэтому область поиска расширяется на *_reach_, делённое на масштаб.
+        spatial::RectIndex bus_labels_index_;
+        spatial::RectIndex stops_index_;
+        spatial::RectIndex::Rect bus_label_reach_;
+        // Остановка занимает прямоугольник, охватывающий и круг, и надпись
+        spatial::RectIndex::Rect stop_reach_;
+    };
+
     class MapRenderer {
     public:
-        MapRenderer(const SVG_Settings& svg_settings);
+        // stops — все остановки справочника, номер остановки равен её индексу
+        MapRenderer(const SVG_Settings& svg_settings, const std::deque<domain::Stop>& stops);
+
+        // Проекция с тем же хешем настроек используется вместо вычисления своей
+        void SetStopProjection(std::shared_ptr<const StopProjection> projection);
+        StopProjection MakeStopProjection(const std::map<std::string_view, domain::Bus*>& buses) const;
+
         svg::Document DrawMap(const std::map<std::string_view, domain::Bus*>& buses);
+        // То же, что DrawMap, но элементы сразу выводятся в конец out, без промежуточного документа.
+        // Слои делятся на части, которые выводятся в thread_count потоках и склеиваются по порядку;
+        // результат совпадает с выводом в одном потоке байт в байт.
+        void RenderMap(const std::map<std::string_view, domain::Bus*>& buses, std::string& out,
+            size_t thread_count = std::thread::hardware_concurrency());
+        // Рисует только заданные остановки в проекции полной карты, чтобы результат можно было наложить на неё.
+        void RenderStopsOverlay(const std::map<std::string_view, domain::Bus*>& buses,
+            const std::vector<const domain::Stop*>& stops, std::string& out);
+
+        // Рисует только участки найденного маршрута в проекции полной карты: линии участков,
+        // названия автобусов у остановок посадки, круги и названия остановок посадки и высадки.
+        void RenderRoute(const std::map<std::string_view, domain::Bus*>& buses,
+            const std::vector<domain::RouteItem_Bus>& legs, std::string& out);
+
+        // При включённом упрощении линии и надписи готовятся для уровня детализации level
+        MapLayout MakeLayout(const std::map<std::string_view, domain::Bus*>& buses, int level = 0);
+        // Выводит в конец out только элементы, видимые в viewport. Линии обрезаются по краю изображения.
+        void RenderViewport(const MapLayout& layout, const Viewport& viewport, std::string& out) const;
 
     private:
         SVG_Settings svg_settings_;
-        SphereProjector proj_;
-        std::map<std::string_view, geo::Coordinates> stopsGeo_;
-        int palette_index_;
+        const std::deque<domain::Stop>& stops_;
+        std::shared_ptr<const StopProjection> projection_;
         int max_pallete_index_;
-        bool firstPallete_;
-
-        int GetNextPaletteIndex();
-        void PrepareSphereProjector(const std::map<std::string_view, domain::Bus*>& buses);
-        void DrawRouteLines(const std::map<std::string_view, domain::Bus*>& buses, svg::Document& svgDoc);
-        void DrawBusName(const std::map<std::string_view, domain::Bus*>& buses, svg::Document& svgDoc);
-        void DrawStopPoint(svg::Document& svgDoc);
-        void DrawStopName(svg::Document& svgDoc);
+
+        using BusIterator = std::map<std::string_view, domain::Bus*>::const_iterator;
+        using StopIterator = std::vector<uint32_t>::const_iterator;
+
+        // Цвет палитры для ordinal-го по счёту маршрута слоя: палитра проходится по кругу
+        int PaletteIndex(size_t ordinal) const;
+        // Линия рисуется только для маршрута хотя бы с двумя остановками, у которых есть координаты
+        static bool HasRouteLine(const domain::Bus& bus);
+        // Берёт заданную проекцию, если она построена для текущих настроек, иначе вычисляет её
+        const StopProjection& PrepareStopProjection(const std::map<std::string_view, domain::Bus*>& buses);
+        void RenderLayersParallel(const std::map<std::string_view, domain::Bus*>& buses, size_t chunk_count,
+            size_t thread_count, svg::StreamDocument& svgDoc) const;
+        // Container — svg::Document, svg::StreamDocument или svg::StreamFragment. Каждый слой переиспользует
+        // одни и те же объекты svg, поэтому при потоковом выводе память почти не выделяется.
+        // Слой можно вывести по частям: ordinal — число маршрутов этого слоя перед first, от него зависит цвет.
+        template <typename Container>
+        void DrawLayers(const std::map<std::string_view, domain::Bus*>& buses, Container& svgDoc) const;
+        template <typename Container>
+        void DrawRouteLines(BusIterator first, BusIterator last, size_t ordinal, Container& svgDoc) const;
+        template <typename Container>
+        void DrawBusName(BusIterator first, BusIterator last, size_t ordinal, Container& svgDoc) const;
+        template <typename Container>
+        void DrawStopPoint(StopIterator first, StopIterator last, Container& svgDoc) const;
+        template <typename Container>
+        void DrawStopName(StopIterator first, StopIterator last, Container& svgDoc) const;
+
+        // Оформление элементов карты, общее для полной карты и её частей
+        svg::Polyline RouteLineStyle() const;
+        svg::Text BusLabelStyle() const;
+        svg::Circle StopPointStyle() const;
+        svg::Text StopLabelStyle() const;
+        svg::Text UnderlayerStyle(svg::Text label) const;
+        // Прямоугольник надписи в пикселях относительно точки привязки: с запасом (для поиска видимых надписей)
+        // или по средней ширине символов (для прореживания)
+        spatial::RectIndex::Rect LabelExtent(Point offset, int font_size, std::string_view text, bool average = false) const;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Оценка памяти, занятой структурами данных, вместе со служебными расходами контейнеров.
+// Размеры узлов и блоков соответствуют libstdc++; служебные данные распределителя памяти не учитываются.
+namespace memory {
+
+	// Память одной структуры: elements — число её элементов, bytes — всё, что она занимает в куче
+	struct Usage {
+		std::string name;
+		size_t elements = 0;
+		size_t bytes = 0;
+		// Структура не построена, размер рассчитан по её параметрам
+		bool estimated = false;
+	};
+
+	// Буфер строки в куче; короткие строки хранятся внутри объекта и памяти в куче не занимают
+	inline size_t StringBytes(const std::string& str)
+	{
+		const char* data = str.data();
+		const char* object = reinterpret_cast<const char*>(&str);
+		if (data >= object && data < object + sizeof(str)) {
+			return 0;
+		}
+		return str.capacity() + 1;
+	}
+
+	template <typename T>
+	size_t VectorBytes(const std::vector<T>& vec)
+	{
+		return vec.capacity() * sizeof(T);
+	}
+
+	// Дек хранит элементы блоками по 512 байт и массив указателей на блоки
+	template <typename T>
+	size_t DequeBytes(const std::deque<T>& deq)
+	{
+		const size_t per_block = sizeof(T) < 512 ? 512 / sizeof(T) : 1;
+		const size_t blocks = deq.size() / per_block + 1;
+		return blocks * per_block * sizeof(T) + (blocks + 2) * sizeof(void*);
+	}
+
+	// Узел хеш-таблицы: указатель на следующий узел, значение и сохранённый хеш; плюс массив корзин
+	template <typename HashTable>
+	size_t HashTableBytes(const HashTable& table)
+	{
+		return table.bucket_count() * sizeof(void*)
+			+ table.size() * (sizeof(void*) + sizeof(typename HashTable::value_type) + sizeof(size_t));
+	}
+
+	// Узел красно-чёрного дерева: три указателя, цвет и значение
+	template <typename Tree>
+	size_t TreeBytes(const Tree& tree)
+	{
+		return tree.size() * (4 * sizeof(void*) + sizeof(typename Tree::value_type));
+	}
+
+	inline size_t TotalBytes(const std::vector<Usage>& usage)
+	{
+		size_t total = 0;
+		for (const Usage& item : usage) {
+			total += item.bytes;
+		}
+		return total;
+	}
+
+} // namespace memory
@@ -0,0 +1,281 @@
+#include "profiling.h"
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+namespace profiling {
+	using namespace std;
+
+	namespace {
+		// Счётчики выделений памяти читаются только разностью между началом и концом этапа
+		using allocation_counter::enabled;
+		using allocation_counter::allocations;
+		using allocation_counter::allocated_bytes;
+
+		struct Sample {
+			chrono::steady_clock::time_point wall;
+			clock_t cpu = 0;
+			uint64_t allocations = 0;
+			uint64_t allocated_bytes = 0;
+		};
+
+		struct Record {
+			string name;
+			size_t parent;
+			Sample start;
+			double wall_ms = 0;
+			double cpu_ms = 0;
+			uint64_t allocations = 0;
+			uint64_t allocated_bytes = 0;
+			long peak_rss_kb = 0;
+			bool finished = false;
+		};
+
+		const size_t NO_PARENT = static_cast<size_t>(-1);
+
+		struct State {
+			mutex guard;
+			string destination;
+			Sample start;
+			vector<Record> records;
+			map<string, uint64_t, less<>> counters;
+		};
+
+		State& GetState()
+		{
+			static State state;
+			return state;
+		}
+
+		// Открытые этапы текущего потока: вершина стека — родитель следующего этапа
+		thread_local vector<size_t> open_phases;
+
+		Sample TakeSample()
+		{
+			return Sample{
+				chrono::steady_clock::now(),
+				clock(),
+				allocations.load(memory_order_relaxed),
+				allocated_bytes.load(memory_order_relaxed) };
+		}
+
+		double WallMs(const Sample& from, const Sample& to)
+		{
+			return chrono::duration<double, milli>(to.wall - from.wall).count();
+		}
+
+		double CpuMs(const Sample& from, const Sample& to)
+		{
+			return 1000.0 * static_cast<double>(to.cpu - from.cpu) / CLOCKS_PER_SEC;
+		}
+
+		// Большие счётчики не помещаются в int, поэтому выводятся как double
+		json::Node Number(uint64_t value)
+		{
+			if (value <= static_cast<uint64_t>(INT_MAX)) {
+				return static_cast<int>(value);
+			}
+			return static_cast<double>(value);
+		}
+
+		json::Node PhaseNode(const vector<Record>& records, const vector<vector<size_t>>& children, size_t index)
+		{
+			const Record& record = records[index];
+			json::Dict phase{
+				{ "name"s, record.name },
+				{ "wall_ms"s, record.wall_ms },
+				{ "cpu_ms"s, record.cpu_ms },
+				{ "peak_rss_kb"s, Number(static_cast<uint64_t>(record.peak_rss_kb)) },
+				{ "allocations"s, Number(record.allocations) },
+				{ "allocated_bytes"s, Number(record.allocated_bytes) } };
+			if (!record.finished) {
+				phase["unfinished"s] = true;
+			}
+			if (!children[index].empty()) {
+				json::Array nested;
+				for (size_t child : children[index]) {
+					nested.push_back(PhaseNode(records, children, child));
+				}
+				phase["phases"s] = move(nested);
+			}
+			return phase;
+		}
+	} // namespace
+
+	long PeakRssKb()
+	{
+#if defined(__APPLE__)
+		rusage usage{};
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<long>(usage.ru_maxrss / 1024) : 0;
+#elif defined(__unix__)
+		rusage usage{};
+		return getrusage(RUSAGE_SELF, &usage) == 0 ? static_cast<long>(usage.ru_maxrss) : 0;
+#else
+		return 0;
+#endif
+	}
+
+	void Enable(string destination)
+	{
+		State& state = GetState();
+		lock_guard lock(state.guard);
+		state.destination = destination.empty() || destination == "1"s ? "stderr"s : move(destination);
+		state.records.clear();
+		state.counters.clear();
+		enabled.store(true, memory_order_relaxed);
+		state.start = TakeSample();
+	}
+
+	bool EnableFromArgument(string_view arg)
+	{
+		if (arg == PROFILE_FLAG) {
+			Enable("stderr"s);
+			return true;
+		}
+		if (arg.size() > PROFILE_FLAG.size() && arg.substr(0, PROFILE_FLAG.size()) == PROFILE_FLAG
+			&& arg[PROFILE_FLAG.size()] == '=') {
+			Enable(string(arg.substr(PROFILE_FLAG.size() + 1)));
+			return true;
+		}
+		return false;
+	}
+
+	void EnableFromEnvironment()
+	{
+		if (const char* destination = getenv(PROFILE_ENV); destination != nullptr && *destination != '\0') {
+			Enable(destination);
+		}
+	}
+
+	bool IsEnabled()
+	{
+		return enabled.load(memory_order_relaxed);
+	}
+
+	Phase::Phase(string_view name)
+	{
+		if (!IsEnabled()) {
+			return;
+		}
+		State& state = GetState();
+		{
+			lock_guard lock(state.guard);
+			record_ = state.records.size();
+			state.records.push_back(Record{ string(name), open_phases.empty() ? NO_PARENT : open_phases.back(), {} });
+		}
+		open_phases.push_back(record_);
+		// Замер начинается после учёта этапа, чтобы его выделения памяти не попали в этап
+		const Sample start = TakeSample();
+		lock_guard lock(state.guard);
+		state.records[record_].start = start;
+	}
+
+	Phase::~Phase()
+	{
+		if (record_ == NO_RECORD) {
+			return;
+		}
+		const Sample end = TakeSample();
+		const long peak_rss_kb = PeakRssKb();
+		open_phases.pop_back();
+
+		State& state = GetState();
+		lock_guard lock(state.guard);
+		Record& record = state.records[record_];
+		record.wall_ms = WallMs(record.start, end);
+		record.cpu_ms = CpuMs(record.start, end);
+		record.allocations = end.allocations - record.start.allocations;
+		record.allocated_bytes = end.allocated_bytes - record.start.allocated_bytes;
+		record.peak_rss_kb = peak_rss_kb;
+		record.finished = true;
+	}
+
+	void AddCounter(string_view name, uint64_t value)
+	{
+		if (!IsEnabled()) {
+			return;
+		}
+		State& state = GetState();
+		lock_guard lock(state.guard);
+		auto it = state.counters.find(name);
+		if (it == state.counters.end()) {
+			state.counters.emplace(string(name), value);
+		}
+		else {
+			it->second += value;
+		}
+	}
+
+	json::Node MakeReport(string_view mode)
+	{
+		const Sample end = TakeSample();
+		State& state = GetState();
+		lock_guard lock(state.guard);
+
+		vector<vector<size_t>> children(state.records.size());
+		json::Array phases;
+		for (size_t index = 0; index < state.records.size(); ++index) {
+			if (state.records[index].parent != NO_PARENT) {
+				children[state.records[index].parent].push_back(index);
+			}
+		}
+		for (size_t index = 0; index < state.records.size(); ++index) {
+			if (state.records[index].parent == NO_PARENT) {
+				phases.push_back(PhaseNode(state.records, children, index));
+			}
+		}
+
+		json::Dict counters;
+		for (const auto& [name, value] : state.counters) {
+			counters.emplace(name, Number(value));
+		}
+
+		return json::Dict{
+			{ "mode"s, string(mode) },
+			{ "wall_ms"s, WallMs(state.start, end) },
+			{ "cpu_ms"s, CpuMs(state.start, end) },
+			{ "peak_rss_kb"s, Number(static_cast<uint64_t>(PeakRssKb())) },
+			{ "allocations"s, Number(end.allocations - state.start.allocations) },
+			{ "allocated_bytes"s, Number(end.allocated_bytes - state.start.allocated_bytes) },
+			{ "phases"s, move(phases) },
+			{ "counters"s, move(counters) } };
+	}
+
+	void WriteReport(string_view mode)
+	{
+		if (!IsEnabled()) {
+			return;
+		}
+		const json::Document report(MakeReport(mode));
+		string destination;
+		{
+			State& state = GetState();
+			lock_guard lock(state.guard);
+			destination = state.destination;
+		}
+		if (destination == "stderr"s) {
+			json::Print(report, cerr);
+			cerr << '\n';
+			return;
+		}
+		ofstream out(destination);
+		if (!out) {
+			cerr << "Cannot write profile report to "sv << destination << '\n';
+			return;
+		}
+		json::Print(report, out);
+	}
+
+} // namespace profiling
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "json.h"
+
+// Замеры этапов работы программы: время, процессорное время, пиковый объём памяти и выделения памяти
+// по вложенным этапам, плюс именованные счётчики (вершины и рёбра графа, релаксации таблицы маршрутов).
+// Пока замеры не включены, этап стоит одну проверку флага, а подсчёт выделений памяти не выполняется.
+namespace profiling {
+
+	// Переменная окружения с назначением отчёта: "1" или "stderr" — стандартный поток ошибок, иначе имя файла
+	inline const char* const PROFILE_ENV = "TRANSPORT_CATALOGUE_PROFILE";
+	inline const std::string_view PROFILE_FLAG = "--profile";
+
+	// Включает замеры; отчёт будет записан в destination ("stderr" или имя файла)
+	void Enable(std::string destination);
+	// Включает замеры по ключу командной строки "--profile[=файл]" или по переменной окружения.
+	// Возвращает true, если arg — ключ замеров
+	bool EnableFromArgument(std::string_view arg);
+	void EnableFromEnvironment();
+	bool IsEnabled();
+
+	// Этап от создания до разрушения объекта. Этапы, начатые внутри другого этапа того же потока,
+	// попадают в отчёт как его вложенные этапы.
+	class Phase {
+	public:
+		explicit Phase(std::string_view name);
+		~Phase();
+
+		Phase(const Phase&) = delete;
+		Phase& operator=(const Phase&) = delete;
+
+	private:
+		static const size_t NO_RECORD = static_cast<size_t>(-1);
+		size_t record_ = NO_RECORD;
+	};
+
+	// Прибавляет value к счётчику name; без включённых замеров ничего не делает
+	void AddCounter(std::string_view name, uint64_t value);
+
+	// Пиковый объём резидентной памяти процесса с его запуска, 0 — если система его не сообщает
+	long PeakRssKb();
+
+	json::Node MakeReport(std::string_view mode);
+	// Записывает отчёт в назначение, заданное при включении замеров
+	void WriteReport(std::string_view mode);
+
+} // namespace profiling
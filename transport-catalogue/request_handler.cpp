@@ -43,18 +43,85 @@ namespace requestHandler {
 		}
 	}
 
+	LoadRequestHandler::UpdateResult LoadRequestHandler::ProcessUpdatePool(const Request_pool& req_pool)
+	{
+		for (const LoadRequestHandler::Stop& stop : req_pool.stops) {
+			domain::StopToAdd new_stop{ stop.name, stop.latitude, stop.longitude, {} };
+			for (auto distance_to_stop : stop.distance_to_stop) {
+				new_stop.distance_to_stop.push_back({ move(distance_to_stop.stop_name), distance_to_stop.distance });
+			}
+			data_base_.UpdateStop(new_stop);
+		}
+
+		UpdateResult result;
+		for (const std::string& bus : req_pool.removed_buses) {
+			result.shifted |= data_base_.RemoveBus(bus);
+		}
 
+		for (const LoadRequestHandler::Bus& bus : req_pool.buses) {
+			data_base_.UpdateBus(bus.name, bus.stop_for_bus, bus.is_ring);
+		}
+
+		// Остановки удаляются последними: к этому моменту маршруты через них уже изменены или удалены
+		for (const std::string& stop : req_pool.removed_stops) {
+			if (data_base_.RemoveStop(stop)) {
+				result.shifted = true;
+			}
+			else {
+				result.kept_stops.push_back(stop);
+			}
+		}
+
+		data_base_.RecalculateBusesStatistic();
+		return result;
+	}
 
-	MapRequestHandler::MapRequestHandler(const transport_catalogue::TransportCatalogue& db, const renderer::SVG_Settings& svg_settings)
+
+
+	MapRequestHandler::MapRequestHandler(const transport_catalogue::TransportCatalogue& db, const renderer::SVG_Settings& svg_settings,
+		std::shared_ptr<const renderer::StopProjection> projection)
 		: db_(db)
-		, renderer_(svg_settings)
+		, renderer_(svg_settings, db.GetStopsList())
+	{
+		renderer_.SetStopProjection(std::move(projection));
+	}
+
+	renderer::StopProjection MapRequestHandler::MakeStopProjection() const
+	{
+		return renderer_.MakeStopProjection(db_.GetAllBuses());
+	}
+
+	std::string MapRequestHandler::RenderMap()
 	{
+		std::string svg;
+		renderer_.RenderMap(db_.GetAllBuses(), svg);
+		return svg;
+	}
+
+	std::string MapRequestHandler::RenderStopsOverlay(const std::vector<const domain::Stop*>& stops)
+	{
+		std::string svg;
+		renderer_.RenderStopsOverlay(db_.GetAllBuses(), stops, svg);
+		return svg;
+	}
 
+	std::string MapRequestHandler::RenderRoute(const std::vector<domain::RouteItem_Bus>& legs)
+	{
+		std::string svg;
+		renderer_.RenderRoute(db_.GetAllBuses(), legs, svg);
+		return svg;
+	}
+
+	renderer::MapLayout MapRequestHandler::MakeLayout(int level)
+	{
+		return renderer_.MakeLayout(db_.GetAllBuses(), level);
 	}
 
-	svg::Document MapRequestHandler::RenderMap()
+	std::string MapRequestHandler::RenderViewport(const renderer::MapLayout& layout, const renderer::Viewport& viewport) const
 	{
-		return renderer_.DrawMap(db_.GetAllBuses());
+		std::string svg;
+		renderer_.RenderViewport(layout, viewport, svg);
+		return svg;
 	}
 
 } // namespace requestHandler
\ No newline at end of file
@@ -5,6 +5,7 @@
 // с другими подсистемами приложения.
 // См. паттерн проектирования Фасад: https://ru.wikipedia.org/wiki/Фасад_(шаблон_проектирования)
 
+#include <memory>
 #include <optional>
 #include <string>
 
@@ -19,10 +20,26 @@ namespace requestHandler {
 	class MapRequestHandler {
 	public:
 		// MapRenderer понадобится в следующей части итогового проекта
-		MapRequestHandler(const transport_catalogue::TransportCatalogue& db, const renderer::SVG_Settings& svg_settings);
+		// Без готовой проекции остановок она вычисляется при первой отрисовке
+		MapRequestHandler(const transport_catalogue::TransportCatalogue& db, const renderer::SVG_Settings& svg_settings,
+			std::shared_ptr<const renderer::StopProjection> projection = nullptr);
 
-		// Этот метод будет нужен в следующей части итогового проекта
-		svg::Document RenderMap();
+		// Проекция остановок для текущих настроек, которую можно сохранить в базу и передавать в следующие обработчики
+		renderer::StopProjection MakeStopProjection() const;
+
+		// Svg-карта всех маршрутов
+		std::string RenderMap();
+
+		// Слой с выбранными остановками в координатах полной карты
+		std::string RenderStopsOverlay(const std::vector<const domain::Stop*>& stops);
+
+		// Слой с участками найденного маршрута в координатах полной карты
+		std::string RenderRoute(const std::vector<domain::RouteItem_Bus>& legs);
+
+		// Раскладка полной карты для вывода её частей
+		renderer::MapLayout MakeLayout(int level);
+		// Svg с видимой в viewport частью карты
+		std::string RenderViewport(const renderer::MapLayout& layout, const renderer::Viewport& viewport) const;
 
 	private:
 		// RequestHandler использует агрегацию объектов "Транспортный Справочник" и "Визуализатор Карты"
@@ -62,6 +79,17 @@ namespace requestHandler {
 		struct Request_pool {
 			std::vector<Stop> stops;
 			std::vector<Bus> buses;
+			// Только для обновления базы: остановки и маршруты, которые нужно удалить
+			std::vector<std::string> removed_stops;
+			std::vector<std::string> removed_buses;
+		};
+
+		// Итог применения пула обновлений
+		struct UpdateResult {
+			// Номера остановок или маршрутов сдвинулись
+			bool shifted = false;
+			// Остановки, которые не удалось удалить: их нет в справочнике или через них проходят маршруты
+			std::vector<std::string> kept_stops;
 		};
 
 		explicit LoadRequestHandler(transport_catalogue::TransportCatalogue& db);
@@ -72,6 +100,10 @@ namespace requestHandler {
 		// Обрабатывает пул запросов, загружает данные в транспортный справочник.
 		void ProcessRequestPool(const Request_pool& req_pool);
 
+		// Применяет пул запросов к уже заполненному справочнику: остановки и маршруты добавляются
+		// или заменяются, затем удаляются.
+		UpdateResult ProcessUpdatePool(const Request_pool& req_pool);
+
 		transport_catalogue::TransportCatalogue& data_base_;
 		domain::RoutingSettings routingSettings_;
 		std::unique_ptr<transport_router::RouteHandler> router_;
@@ -0,0 +1,102 @@
+#include "route_cache.h"
+#include "transport_router.h"
+
+namespace transport_router {
+
+	double RouteCacheStats::HitRate() const
+	{
+		const size_t requests = hits + misses;
+		return requests == 0 ? 0. : static_cast<double>(hits) / requests;
+	}
+
+	RouteCache::RouteCache(size_t capacity)
+		: capacity_(capacity)
+	{
+	}
+
+	std::optional<RouteCache::Value> RouteCache::Find(const Key& key)
+	{
+		std::lock_guard lock(mutex_);
+		auto it = index_.find(key);
+		if (it == index_.end()) {
+			++misses_;
+			return std::nullopt;
+		}
+		++hits_;
+		// Поднимаем запись в начало списка — она становится самой свежей
+		entries_.splice(entries_.begin(), entries_, it->second);
+		return it->second->second;
+	}
+
+	void RouteCache::Insert(const Key& key, Value value)
+	{
+		std::lock_guard lock(mutex_);
+		if (capacity_ == 0) {
+			return;
+		}
+		auto it = index_.find(key);
+		if (it != index_.end()) {
+			items_bytes_ -= RouteBytes(it->second->second);
+			it->second->second = std::move(value);
+			items_bytes_ += RouteBytes(it->second->second);
+			entries_.splice(entries_.begin(), entries_, it->second);
+			return;
+		}
+		items_bytes_ += RouteBytes(value);
+		entries_.emplace_front(key, std::move(value));
+		index_.emplace(key, entries_.begin());
+		EvictExcess();
+	}
+
+	void RouteCache::SetCapacity(size_t capacity)
+	{
+		std::lock_guard lock(mutex_);
+		capacity_ = capacity;
+		EvictExcess();
+	}
+
+	RouteCacheStats RouteCache::GetStats() const
+	{
+		std::lock_guard lock(mutex_);
+		RouteCacheStats stats;
+		stats.capacity = capacity_;
+		stats.entries = entries_.size();
+		stats.hits = hits_;
+		stats.misses = misses_;
+		stats.evictions = evictions_;
+
+		// Узел списка: два указателя и значение; узел хеш-таблицы: указатель, ключ, итератор и хеш.
+		const size_t list_node = 2 * sizeof(void*) + sizeof(Entries::value_type);
+		const size_t index_node = sizeof(void*) + sizeof(Key) + sizeof(Entries::iterator) + sizeof(size_t);
+		stats.memory_bytes = sizeof(*this)
+			+ entries_.size() * (list_node + index_node)
+			+ index_.bucket_count() * sizeof(void*)
+			+ items_bytes_;
+		return stats;
+	}
+
+	void RouteCache::EvictExcess()
+	{
+		while (entries_.size() > capacity_) {
+			items_bytes_ -= RouteBytes(entries_.back().second);
+			index_.erase(entries_.back().first);
+			entries_.pop_back();
+			++evictions_;
+		}
+	}
+
+	size_t RouteCache::RouteBytes(const Value& value)
+	{
+		if (!value) {
+			return 0;
+		}
+		// Блок shared_ptr (счётчики + объект) и буфер элементов маршрута
+		return 2 * sizeof(long) + sizeof(Route) + value->route_items.capacity() * sizeof(Items);
+	}
+
+	size_t RouteCache::KeyHasher::operator()(const Key& key) const
+	{
+		return std::hash<size_t>{}(key.first) * 37 + std::hash<size_t>{}(key.second);
+	}
+
+} // namespace transport_router
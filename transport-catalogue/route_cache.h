@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace transport_router {
+
+	struct Route;
+
+	struct RouteCacheStats {
+		size_t capacity = 0;
+		size_t entries = 0;
+		size_t hits = 0;
+		size_t misses = 0;
+		size_t evictions = 0;
+		// Приблизительный объём памяти, занятый кэшем, включая накладные расходы контейнеров.
+		size_t memory_bytes = 0;
+
+		double HitRate() const;
+	};
+
+	// Потокобезопасный LRU-кэш готовых маршрутов с ключом (from_id, to_id).
+	// Хранит и отрицательные результаты (маршрут не найден) в виде пустого указателя.
+	class RouteCache {
+	public:
+		using Key = std::pair<size_t, size_t>;
+		using Value = std::shared_ptr<const Route>;
+
+		explicit RouteCache(size_t capacity);
+
+		// Возвращает сохранённый результат или nullopt при промахе.
+		std::optional<Value> Find(const Key& key);
+		void Insert(const Key& key, Value value);
+
+		void SetCapacity(size_t capacity);
+		RouteCacheStats GetStats() const;
+
+	private:
+		struct KeyHasher {
+			size_t operator()(const Key& key) const;
+		};
+
+		using Entries = std::list<std::pair<Key, Value>>;
+
+		mutable std::mutex mutex_;
+		size_t capacity_;
+		Entries entries_;
+		std::unordered_map<Key, Entries::iterator, KeyHasher> index_;
+		size_t hits_ = 0;
+		size_t misses_ = 0;
+		size_t evictions_ = 0;
+		size_t items_bytes_ = 0;
+
+		void EvictExcess();
+		static size_t RouteBytes(const Value& value);
+	};
+
+} // namespace transport_router
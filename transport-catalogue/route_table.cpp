@@ -0,0 +1,250 @@
+#include "route_table.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <vector>
+
+#include "profiling.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace transport_router {
+	using namespace std;
+
+	namespace {
+		using RouteInternalData = graph::Router<double>::RouteInternalData;
+
+		const char MAGIC[8] = { 'T', 'C', 'R', 'O', 'U', 'T', 'E', '1' };
+		// Записывается как число: на платформе с другим порядком байт прочитается иначе
+		const uint32_t BYTE_ORDER_MARK = 0x01020304;
+		const uint32_t NO_VALUE = numeric_limits<uint32_t>::max();
+
+		struct Header {
+			char magic[8];
+			uint32_t byte_order;
+			uint32_t cell_size;
+			uint64_t vertex_count;
+			// Отпечаток рёбер графа: таблица, построенная до обновления базы, не подойдёт новому графу
+			uint64_t graph_hash;
+		};
+
+		// Ячейка без маршрута отмечена hops == NO_VALUE, маршрут без рёбер — prev_edge == NO_VALUE
+		struct StoredCell {
+			double weight;
+			uint32_t prev_edge;
+			uint32_t hops;
+		};
+
+		static_assert(sizeof(Header) == 32 && sizeof(StoredCell) == 16, "Route table layout must not depend on padding");
+
+		// FNV-1a по концам и весам рёбер
+		uint64_t GraphHash(const graph::DirectedWeightedGraph<double>& graph)
+		{
+			uint64_t hash = 14695981039346656037ull;
+			const auto mix = [&hash](const auto& value) {
+				const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+				for (size_t i = 0; i < sizeof(value); ++i) {
+					hash = (hash ^ bytes[i]) * 1099511628211ull;
+				}
+			};
+			mix(static_cast<uint64_t>(graph.GetVertexCount()));
+			for (graph::EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+				const auto& edge = graph.GetEdge(edge_id);
+				mix(static_cast<uint64_t>(edge.from));
+				mix(static_cast<uint64_t>(edge.to));
+				mix(edge.weight);
+			}
+			return hash;
+		}
+
+		Header MakeHeader(const graph::DirectedWeightedGraph<double>& graph)
+		{
+			Header header{};
+			memcpy(header.magic, MAGIC, sizeof(MAGIC));
+			header.byte_order = BYTE_ORDER_MARK;
+			header.cell_size = sizeof(StoredCell);
+			header.vertex_count = graph.GetVertexCount();
+			header.graph_hash = GraphHash(graph);
+			return header;
+		}
+
+		void EncodeRow(const graph::Router<double>::Row& row, StoredCell* cells)
+		{
+			for (const auto& route : row) {
+				*cells++ = route
+					? StoredCell{ route->weight, route->prev_edge ? static_cast<uint32_t>(*route->prev_edge) : NO_VALUE, static_cast<uint32_t>(route->hops) }
+					: StoredCell{ 0., NO_VALUE, NO_VALUE };
+			}
+		}
+	} // namespace
+
+	filesystem::path RouteTablePath(const filesystem::path& base_file)
+	{
+		filesystem::path file = base_file;
+		file += ".routes"s;
+		return file;
+	}
+
+	bool WriteRouteTable(const graph::Router<double>& router, const graph::DirectedWeightedGraph<double>& graph,
+		const filesystem::path& file, size_t memory_limit, size_t thread_count)
+	{
+		profiling::Phase phase("save_route_table"sv);
+		// Номера рёбер и счётчики хранятся в 32 битах, NO_VALUE занят под отметки
+		if (graph.GetEdgeCount() >= NO_VALUE) {
+			return false;
+		}
+		// Таблица пишется во временный файл и подменяет прежнюю переименованием: процессы, которые
+		// отобразили прежнюю таблицу в память, дочитывают её, а не обрезанный файл
+		filesystem::path temp_file = file;
+		temp_file += ".tmp"s;
+		ofstream out(temp_file, ios::out | ios::trunc | ios::binary);
+		if (!out) {
+			return false;
+		}
+		const auto finish = [&out, &temp_file, &file] {
+			out.close();
+			error_code ec;
+			if (out) {
+				filesystem::rename(temp_file, file, ec);
+			}
+			if (!out || ec) {
+				filesystem::remove(temp_file, ec);
+				return false;
+			}
+			return true;
+		};
+		const Header header = MakeHeader(graph);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		const size_t vertex_count = graph.GetVertexCount();
+		if (vertex_count == 0) {
+			return finish();
+		}
+		// Поиск Дейкстры в каждом потоке держит строку RouteInternalData, блок — закодированные строки
+		const size_t search_bytes = vertex_count * sizeof(optional<RouteInternalData>);
+		const size_t row_bytes = vertex_count * sizeof(StoredCell);
+		thread_count = clamp<size_t>(min(thread_count, memory_limit / (search_bytes + row_bytes)), 1, vertex_count);
+		const size_t block_rows = clamp<size_t>((memory_limit - min(memory_limit, thread_count * search_bytes)) / row_bytes,
+			1, vertex_count);
+
+		vector<StoredCell> block(block_rows * vertex_count);
+		size_t blocks = 0;
+		for (graph::VertexId first_row = 0; first_row < vertex_count; first_row += block_rows) {
+			const size_t rows = min(block_rows, vertex_count - first_row);
+			atomic<size_t> next_row{ 0 };
+			exception_ptr error;
+			mutex error_guard;
+			const auto worker = [&] {
+				try {
+					for (size_t row = next_row.fetch_add(1); row < rows; row = next_row.fetch_add(1)) {
+						EncodeRow(router.ComputeRow(first_row + row), &block[row * vertex_count]);
+					}
+				}
+				catch (...) {
+					lock_guard lock(error_guard);
+					error = current_exception();
+					next_row = rows;
+				}
+			};
+
+			vector<thread> threads;
+			for (size_t index = 1; index < min(thread_count, rows); ++index) {
+				threads.emplace_back(worker);
+			}
+			worker();
+			for (thread& thread : threads) {
+				thread.join();
+			}
+			if (error) {
+				out.close();
+				error_code ec;
+				filesystem::remove(temp_file, ec);
+				rethrow_exception(error);
+			}
+
+			out.write(reinterpret_cast<const char*>(block.data()), rows * row_bytes);
+			if (!out) {
+				return finish();
+			}
+			++blocks;
+		}
+		profiling::AddCounter("route_table_blocks"sv, blocks);
+		return finish();
+	}
+
+	shared_ptr<const MappedRouteTable> MappedRouteTable::Open(const filesystem::path& file,
+		const graph::DirectedWeightedGraph<double>& graph)
+	{
+		shared_ptr<MappedRouteTable> table(new MappedRouteTable());
+		table->stream_.open(file, ios::in | ios::binary);
+		Header header{};
+		if (!table->stream_ || !table->stream_.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+			return nullptr;
+		}
+		const Header expected = MakeHeader(graph);
+		if (memcmp(&header, &expected, sizeof(header)) != 0) {
+			return nullptr;
+		}
+		error_code error;
+		const uintmax_t file_size = filesystem::file_size(file, error);
+		table->vertex_count_ = graph.GetVertexCount();
+		table->size_ = sizeof(Header) + table->vertex_count_ * table->vertex_count_ * sizeof(StoredCell);
+		if (error || file_size != table->size_) {
+			return nullptr;
+		}
+
+#if defined(__unix__) || defined(__APPLE__)
+		if (const int fd = ::open(file.c_str(), O_RDONLY); fd >= 0) {
+			void* data = mmap(nullptr, table->size_, PROT_READ, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (data != MAP_FAILED) {
+				// Запросы обращаются к разрозненным строкам, упреждающее чтение соседних страниц не поможет
+				madvise(data, table->size_, MADV_RANDOM);
+				table->data_ = static_cast<const char*>(data);
+				table->stream_.close();
+			}
+		}
+#endif
+		return table;
+	}
+
+	MappedRouteTable::~MappedRouteTable()
+	{
+#if defined(__unix__) || defined(__APPLE__)
+		if (data_ != nullptr) {
+			munmap(const_cast<char*>(data_), size_);
+		}
+#endif
+	}
+
+	optional<RouteInternalData> MappedRouteTable::GetCell(graph::VertexId from, graph::VertexId to) const
+	{
+		const size_t offset = sizeof(Header) + (from * vertex_count_ + to) * sizeof(StoredCell);
+		StoredCell cell;
+		if (data_ != nullptr) {
+			memcpy(&cell, data_ + offset, sizeof(cell));
+		}
+		else {
+			lock_guard lock(guard_);
+			stream_.seekg(static_cast<streamoff>(offset));
+			if (!stream_.read(reinterpret_cast<char*>(&cell), sizeof(cell))) {
+				stream_.clear();
+				return nullopt;
+			}
+		}
+		if (cell.hops == NO_VALUE) {
+			return nullopt;
+		}
+		return RouteInternalData{ cell.weight,
+			cell.prev_edge == NO_VALUE ? nullopt : optional<graph::EdgeId>(cell.prev_edge), cell.hops };
+	}
+
+} // namespace transport_router
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include "graph.h"
+#include "router.h"
+
+// Таблица маршрутов во внешнем файле для сетей, у которых V^2 ячеек не помещаются в память.
+// Файл состоит из заголовка и V строк по V ячеек фиксированного размера, поэтому ячейка (from, to)
+// читается по смещению без разбора остального файла. Числа хранятся в порядке байт платформы,
+// которая построила файл; файл с другой платформы не пройдёт проверку заголовка.
+namespace transport_router {
+
+	// Ограничение памяти на построение таблицы по умолчанию, в мегабайтах
+	inline const size_t DEFAULT_ROUTE_TABLE_MEMORY_MB = 256;
+
+	// Файл таблицы маршрутов для базы base_file: то же имя с расширением .routes
+	std::filesystem::path RouteTablePath(const std::filesystem::path& base_file);
+
+	// Строит таблицу маршрутов блоками строк: строки блока считаются параллельно поиском Дейкстры
+	// из каждой вершины блока, и блок сразу дописывается в файл. Одновременно в памяти находятся
+	// только блок и по строке поиска на поток; блок подбирается так, чтобы вместе они не превышали
+	// memory_limit байт (но не меньше одной строки). Возвращает false, если файл не удалось записать.
+	bool WriteRouteTable(const graph::Router<double>& router, const graph::DirectedWeightedGraph<double>& graph,
+		const std::filesystem::path& file, size_t memory_limit,
+		size_t thread_count = std::thread::hardware_concurrency());
+
+	// Таблица маршрутов, отображённая в память: страницы файла подгружаются системой при обращении
+	// и вытесняются при нехватке памяти. Если отобразить файл не удалось, ячейки читаются из файла.
+	class MappedRouteTable final : public graph::Router<double>::ExternalRows {
+	public:
+		// Пустой указатель, если файла нет, он повреждён или построен для другого графа
+		static std::shared_ptr<const MappedRouteTable> Open(const std::filesystem::path& file,
+			const graph::DirectedWeightedGraph<double>& graph);
+
+		~MappedRouteTable() override;
+
+		MappedRouteTable(const MappedRouteTable&) = delete;
+		MappedRouteTable& operator=(const MappedRouteTable&) = delete;
+
+		std::optional<graph::Router<double>::RouteInternalData> GetCell(graph::VertexId from, graph::VertexId to) const override;
+
+	private:
+		MappedRouteTable() = default;
+
+		size_t vertex_count_ = 0;
+		const char* data_ = nullptr;
+		size_t size_ = 0;
+		mutable std::mutex guard_;
+		mutable std::ifstream stream_;
+	};
+
+} // namespace transport_router
@@ -1,19 +1,61 @@
 #pragma once
 
 #include "graph.h"
+#include "memory_usage.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdint>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <functional>
 #include <optional>
+#include <queue>
 #include <stdexcept>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace graph {
 
+namespace detail {
+
+// Барьер для синхронизации потоков между итерациями алгоритма Флойда–Уоршелла.
+class Barrier {
+public:
+    explicit Barrier(size_t count)
+        : count_(count)
+        , waiting_(0)
+        , generation_(0) {
+    }
+
+    void Wait() {
+        std::unique_lock lock(mutex_);
+        const size_t generation = generation_;
+        if (++waiting_ == count_) {
+            waiting_ = 0;
+            ++generation_;
+            cv_.notify_all();
+            return;
+        }
+        cv_.wait(lock, [this, generation] { return generation != generation_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    const size_t count_;
+    size_t waiting_;
+    size_t generation_;
+};
+
+}  // namespace detail
+
 template <typename Weight>
 class Router {
 private:
@@ -23,13 +65,33 @@ public:
     struct RouteInternalData {
         Weight weight;
         std::optional<EdgeId> prev_edge;
+        // Количество рёбер в маршруте: позволяет восстановить путь сразу в прямом порядке.
+        size_t hops = 0;
     };
-    using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
+    using Row = std::vector<std::optional<RouteInternalData>>;
+    using RoutesInternalData = std::vector<Row>;
 
-    explicit Router(const Graph& graph);
+    // Строит таблицу маршрутов алгоритмом Флойда–Уоршелла. Строки таблицы на каждой итерации
+    // независимы, поэтому они делятся между thread_count потоками; результат не зависит от числа потоков.
+    explicit Router(const Graph& graph, size_t thread_count = std::thread::hardware_concurrency());
 
     Router(const Graph& graph, RoutesInternalData&& routes_data);
 
+    // Ленивый режим: строка таблицы для вершины-источника заполняется поиском Дейкстры
+    // при первом обращении и дальше хранится. Обращения из разных потоков безопасны.
+    struct LazyRows {};
+    Router(const Graph& graph, LazyRows);
+
+    // Таблица маршрутов вне памяти процесса, например в отображённом в память файле.
+    // GetCell вызывается из разных потоков одновременно.
+    class ExternalRows {
+    public:
+        virtual ~ExternalRows() = default;
+        virtual std::optional<RouteInternalData> GetCell(VertexId from, VertexId to) const = 0;
+    };
+    // Внешний режим: ячейки таблицы читаются из rows при каждом обращении и не хранятся.
+    Router(const Graph& graph, std::shared_ptr<const ExternalRows> rows);
+
     struct RouteInfo {
         Weight weight;
         std::vector<EdgeId> edges;
@@ -37,14 +99,74 @@ public:
 
     std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
 
+    // Восстанавливает путь в буфер вызывающей стороны в прямом порядке. Если ёмкости буфера
+    // хватает, память не выделяется. Возвращает вес маршрута или nullopt, если маршрута нет.
+    std::optional<Weight> BuildRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const;
+
+    // Вес кратчайшего маршрута без восстановления пути.
+    std::optional<Weight> GetRouteWeight(VertexId from, VertexId to) const;
+
+    // Все вершины, достижимые из from не дороже budget, в порядке возрастания веса.
+    // Поиск ограничен бюджетом и не трогает вершины за его пределами.
+    std::vector<std::pair<VertexId, Weight>> FindReachable(VertexId from, Weight budget) const;
+
+    // Начальная (или конечная) вершина поиска с уже накопленной стоимостью, например временем пешего подхода.
+    struct RouteSeed {
+        VertexId vertex;
+        Weight weight;
+    };
+
+    struct SeededRouteInfo {
+        RouteInfo route;
+        VertexId source;
+        VertexId target;
+    };
+
+    // Один поиск Дейкстры сразу из нескольких источников до нескольких целей.
+    // Вес найденного маршрута включает стоимости начальной и конечной вершин.
+    std::optional<SeededRouteInfo> BuildRoute(const std::vector<RouteSeed>& sources,
+                                              const std::vector<RouteSeed>& targets) const;
+
+    // В ленивом режиме содержит только уже вычисленные строки, остальные пусты.
     const RoutesInternalData& GetRoutesInternalData() const;
 
+    bool IsLazy() const;
+    bool IsExternal() const;
+
+    // Строка таблицы для источника from поиском Дейкстры, без сохранения в таблице.
+    // Нужна для построения таблицы по частям, когда она целиком не помещается в память.
+    Row ComputeRow(VertexId from) const;
+
+    // Число проверенных алгоритмом Флойда–Уоршелла пар путей при построении таблицы
+    size_t GetRelaxedCellCount() const;
+
+    // Память таблицы маршрутов; в ленивом режиме учитываются только вычисленные строки,
+    // во внешнем таблица памяти процесса не занимает
+    memory::Usage GetMemoryUsage() const;
+    // Память полной таблицы для графа с vertex_count вершинами, не строя её
+    static size_t EstimateTableBytes(size_t vertex_count);
+
+    // Дополняет готовую таблицу маршрутов после добавления рёбер changed_edges или уменьшения их веса.
+    // Таблица должна быть уже перенесена на graph: по строке и столбцу на вершину, номера рёбер новые.
+    // Улучшенный путь проходит хотя бы через одно изменённое ребро, поэтому достаточно найти пути
+    // между концами этих рёбер и провести через них остальные пары: O(S^3 + V^2 * S) вместо O(V^3),
+    // где S — число различных концов изменённых рёбер.
+    static void RelaxThroughEdges(const Graph& graph, RoutesInternalData& routes_data,
+                                  const std::vector<EdgeId>& changed_edges);
+
 private:
+    // Строка таблицы для источника from; в ленивом режиме вычисляет её при первом обращении.
+    const Row& GetRow(VertexId from) const;
+
+    // Восстанавливает путь до route по ячейкам строки источника: cell(vertex) возвращает ячейку до vertex.
+    // Возвращает false, если цепочка рёбер обрывается или длиннее числа вершин (таблица повреждена).
+    template <typename CellAccessor>
+    bool FillRouteEdges(const RouteInternalData& route, CellAccessor cell, std::vector<EdgeId>& edges) const;
 
     void InitializeRoutesInternalData(const Graph& graph) {
         const size_t vertex_count = graph.GetVertexCount();
         for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
-            routes_internal_data_[vertex][vertex] = RouteInternalData{ZERO_WEIGHT, std::nullopt};
+            routes_internal_data_[vertex][vertex] = RouteInternalData{ZERO_WEIGHT, std::nullopt, 0};
             for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
                 const auto& edge = graph.GetEdge(edge_id);
                 if (edge.weight < ZERO_WEIGHT) {
@@ -52,7 +174,7 @@ private:
                 }
                 auto& route_internal_data = routes_internal_data_[vertex][edge.to];
                 if (!route_internal_data || route_internal_data->weight > edge.weight) {
-                    route_internal_data = RouteInternalData{edge.weight, edge_id};
+                    route_internal_data = RouteInternalData{edge.weight, edge_id, 1};
                 }
             }
         }
@@ -64,38 +186,96 @@ private:
         const Weight candidate_weight = route_from.weight + route_to.weight;
         if (!route_relaxing || candidate_weight < route_relaxing->weight) {
             route_relaxing = {candidate_weight,
-                              route_to.prev_edge ? route_to.prev_edge : route_from.prev_edge};
+                              route_to.prev_edge ? route_to.prev_edge : route_from.prev_edge,
+                              route_from.hops + route_to.hops};
         }
     }
 
-    void RelaxRoutesInternalDataThroughVertex(size_t vertex_count, VertexId vertex_through) {
-        for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
+    // Строки vertex_through не меняются на итерации vertex_through (путь через саму вершину не короче),
+    // поэтому разные потоки могут обрабатывать непересекающиеся диапазоны vertex_from без блокировок.
+    // Возвращает число проверенных пар путей.
+    size_t RelaxRoutesInternalDataThroughVertex(size_t vertex_count, VertexId vertex_through,
+                                                VertexId from_begin, VertexId from_end) {
+        size_t relaxed = 0;
+        for (VertexId vertex_from = from_begin; vertex_from < from_end; ++vertex_from) {
             if (const auto& route_from = routes_internal_data_[vertex_from][vertex_through]) {
                 for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
                     if (const auto& route_to = routes_internal_data_[vertex_through][vertex_to]) {
                         RelaxRoute(vertex_from, vertex_to, *route_from, *route_to);
+                        ++relaxed;
                     }
                 }
             }
         }
+        return relaxed;
+    }
+
+    // Путь route_from, продолженный путём route_to, если он короче route_relaxing.
+    static bool Concatenate(std::optional<RouteInternalData>& route_relaxing, const RouteInternalData& route_from,
+                            const RouteInternalData& route_to) {
+        const Weight candidate_weight = route_from.weight + route_to.weight;
+        if (route_relaxing && !(candidate_weight < route_relaxing->weight)) {
+            return false;
+        }
+        route_relaxing = {candidate_weight,
+                          route_to.prev_edge ? route_to.prev_edge : route_from.prev_edge,
+                          route_from.hops + route_to.hops};
+        return true;
     }
 
     static constexpr Weight ZERO_WEIGHT{};
     const Graph& graph_;
-    RoutesInternalData routes_internal_data_;
+    // В ленивом режиме строки дозаполняются из константных методов под защитой row_flags_
+    mutable RoutesInternalData routes_internal_data_;
+    std::unique_ptr<std::once_flag[]> row_flags_;
+    // Число вычисленных строк в ленивом режиме: размеры строк нельзя читать, пока их заполняют другие потоки
+    std::unique_ptr<std::atomic<size_t>> computed_rows_;
+    std::shared_ptr<const ExternalRows> external_rows_;
+    size_t relaxed_cells_ = 0;
 };
 
 template <typename Weight>
-Router<Weight>::Router(const Graph& graph)
+Router<Weight>::Router(const Graph& graph, size_t thread_count)
     : graph_(graph)
     , routes_internal_data_(graph.GetVertexCount(),
                             std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount()))
 {
     InitializeRoutesInternalData(graph);
 
+    // Меньше нескольких десятков строк на поток не окупает синхронизацию
+    const size_t MIN_ROWS_PER_THREAD = 64;
     const size_t vertex_count = graph.GetVertexCount();
-    for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
-        RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
+    thread_count = std::clamp<size_t>(std::min(thread_count, vertex_count / MIN_ROWS_PER_THREAD), 1, vertex_count > 0 ? vertex_count : 1);
+
+    if (thread_count == 1) {
+        for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
+            relaxed_cells_ += RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through, 0, vertex_count);
+        }
+        return;
+    }
+
+    detail::Barrier barrier(thread_count);
+    std::vector<size_t> relaxed(thread_count, 0);
+    const auto worker = [&](size_t index) {
+        const VertexId from_begin = vertex_count * index / thread_count;
+        const VertexId from_end = vertex_count * (index + 1) / thread_count;
+        for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
+            relaxed[index] += RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through, from_begin, from_end);
+            barrier.Wait();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (size_t index = 1; index < thread_count; ++index) {
+        threads.emplace_back(worker, index);
+    }
+    worker(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (size_t count : relaxed) {
+        relaxed_cells_ += count;
     }
 }
 
@@ -106,24 +286,288 @@ inline Router<Weight>::Router(const Graph& graph, RoutesInternalData&& routes_da
 {
 }
 
+template <typename Weight>
+Router<Weight>::Router(const Graph& graph, LazyRows)
+    : graph_(graph)
+    , routes_internal_data_(graph.GetVertexCount())
+    , row_flags_(std::make_unique<std::once_flag[]>(graph.GetVertexCount()))
+    , computed_rows_(std::make_unique<std::atomic<size_t>>(0))
+{
+}
+
+template <typename Weight>
+Router<Weight>::Router(const Graph& graph, std::shared_ptr<const ExternalRows> rows)
+    : graph_(graph)
+    , external_rows_(std::move(rows))
+{
+}
+
+template <typename Weight>
+const typename Router<Weight>::Row& Router<Weight>::GetRow(VertexId from) const {
+    if (from >= routes_internal_data_.size()) {
+        throw std::out_of_range("Vertex id is out of range");
+    }
+    if (row_flags_) {
+        std::call_once(row_flags_[from], [this, from] {
+            routes_internal_data_[from] = ComputeRow(from);
+            computed_rows_->fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    return routes_internal_data_[from];
+}
+
+template <typename Weight>
+typename Router<Weight>::Row Router<Weight>::ComputeRow(VertexId from) const {
+    Row row(graph_.GetVertexCount());
+    row[from] = RouteInternalData{ZERO_WEIGHT, std::nullopt, 0};
+
+    using QueueItem = std::pair<Weight, VertexId>;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+    queue.push({ZERO_WEIGHT, from});
+
+    while (!queue.empty()) {
+        const auto [weight, vertex] = queue.top();
+        queue.pop();
+        if (weight > row[vertex]->weight) {
+            continue;
+        }
+        for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+            const auto& edge = graph_.GetEdge(edge_id);
+            if (edge.weight < ZERO_WEIGHT) {
+                throw std::domain_error("Edges' weights should be non-negative");
+            }
+            const Weight candidate = weight + edge.weight;
+            auto& route_to = row[edge.to];
+            if (!route_to || candidate < route_to->weight) {
+                route_to = RouteInternalData{candidate, edge_id, row[vertex]->hops + 1};
+                queue.push({candidate, edge.to});
+            }
+        }
+    }
+    return row;
+}
+
 template <typename Weight>
 std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from,
                                                                              VertexId to) const {
-    const auto& route_internal_data = routes_internal_data_.at(from).at(to);
+    std::vector<EdgeId> edges;
+    const std::optional<Weight> weight = BuildRoute(from, to, edges);
+    if (!weight) {
+        return std::nullopt;
+    }
+    return RouteInfo{*weight, std::move(edges)};
+}
+
+template <typename Weight>
+std::optional<Weight> Router<Weight>::BuildRoute(VertexId from, VertexId to, std::vector<EdgeId>& edges) const {
+    if (external_rows_) {
+        if (from >= graph_.GetVertexCount() || to >= graph_.GetVertexCount()) {
+            throw std::out_of_range("Vertex id is out of range");
+        }
+        const std::optional<RouteInternalData> route_internal_data = external_rows_->GetCell(from, to);
+        if (!route_internal_data) {
+            return std::nullopt;
+        }
+        if (!FillRouteEdges(*route_internal_data, [&](VertexId vertex) { return external_rows_->GetCell(from, vertex); },
+                            edges)) {
+            edges.clear();
+            return std::nullopt;
+        }
+        return route_internal_data->weight;
+    }
+
+    const Row& routes_from = GetRow(from);
+    if (to >= routes_from.size()) {
+        throw std::out_of_range("Vertex id is out of range");
+    }
+    const auto& route_internal_data = routes_from[to];
+    if (!route_internal_data) {
+        return std::nullopt;
+    }
+    if (!FillRouteEdges(*route_internal_data, [&](VertexId vertex) -> const auto& { return routes_from[vertex]; },
+                        edges)) {
+        edges.clear();
+        return std::nullopt;
+    }
+    return route_internal_data->weight;
+}
+
+template <typename Weight>
+template <typename CellAccessor>
+bool Router<Weight>::FillRouteEdges(const RouteInternalData& route, CellAccessor cell,
+                                    std::vector<EdgeId>& edges) const {
+    // Переходит к ребру, которое предшествует edge_id в пути; false, если ребра или ячейки его начала нет
+    const auto step_back = [&](std::optional<EdgeId>& edge_id) {
+        if (*edge_id >= graph_.GetEdgeCount()) {
+            return false;
+        }
+        const auto& prev = cell(graph_.GetEdge(*edge_id).from);
+        if (!prev) {
+            return false;
+        }
+        edge_id = prev->prev_edge;
+        return true;
+    };
+    const auto fill_edges = [&](size_t hops) {
+        edges.resize(hops);
+        size_t position = hops;
+        std::optional<EdgeId> edge_id = route.prev_edge;
+        while (edge_id && position > 0) {
+            edges[--position] = *edge_id;
+            if (!step_back(edge_id)) {
+                return false;
+            }
+        }
+        return position == 0 && !edge_id;
+    };
+
+    if (fill_edges(route.hops)) {
+        return true;
+    }
+    // Счётчик рёбер отсутствует (старая база) или не совпал с цепочкой prev_edge
+    // из-за равных по весу альтернатив — считаем длину пути отдельным проходом.
+    // Путь без повторов проходит не больше рёбер, чем вершин в графе: более длинная цепочка зациклена
+    size_t hops = 0;
+    for (std::optional<EdgeId> edge_id = route.prev_edge; edge_id;) {
+        if (++hops > graph_.GetVertexCount() || !step_back(edge_id)) {
+            return false;
+        }
+    }
+    return fill_edges(hops);
+}
+
+template <typename Weight>
+std::optional<Weight> Router<Weight>::GetRouteWeight(VertexId from, VertexId to) const {
+    if (external_rows_) {
+        if (from >= graph_.GetVertexCount() || to >= graph_.GetVertexCount()) {
+            throw std::out_of_range("Vertex id is out of range");
+        }
+        const std::optional<RouteInternalData> route_internal_data = external_rows_->GetCell(from, to);
+        if (!route_internal_data) {
+            return std::nullopt;
+        }
+        return route_internal_data->weight;
+    }
+    const auto& route_internal_data = GetRow(from).at(to);
     if (!route_internal_data) {
         return std::nullopt;
     }
-    const Weight weight = route_internal_data->weight;
+    return route_internal_data->weight;
+}
+
+template <typename Weight>
+std::vector<std::pair<VertexId, Weight>> Router<Weight>::FindReachable(VertexId from, Weight budget) const {
+    std::vector<std::pair<VertexId, Weight>> result;
+    if (from >= graph_.GetVertexCount() || budget < ZERO_WEIGHT) {
+        return result;
+    }
+
+    std::unordered_map<VertexId, Weight> reached{{from, ZERO_WEIGHT}};
+    std::unordered_set<VertexId> settled;
+
+    using QueueItem = std::pair<Weight, VertexId>;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+    queue.push({ZERO_WEIGHT, from});
+
+    while (!queue.empty()) {
+        const auto [weight, vertex] = queue.top();
+        queue.pop();
+        // Фронт поиска вышел за бюджет — дальше только более дорогие вершины
+        if (weight > budget) {
+            break;
+        }
+        if (!settled.insert(vertex).second) {
+            continue;
+        }
+        result.emplace_back(vertex, weight);
+
+        for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+            const auto& edge = graph_.GetEdge(edge_id);
+            const Weight candidate = weight + edge.weight;
+            if (candidate > budget || settled.count(edge.to)) {
+                continue;
+            }
+            auto [it, inserted] = reached.emplace(edge.to, candidate);
+            if (inserted || candidate < it->second) {
+                it->second = candidate;
+                queue.push({candidate, edge.to});
+            }
+        }
+    }
+    return result;
+}
+
+template <typename Weight>
+std::optional<typename Router<Weight>::SeededRouteInfo> Router<Weight>::BuildRoute(
+    const std::vector<RouteSeed>& sources, const std::vector<RouteSeed>& targets) const
+{
+    const size_t vertex_count = graph_.GetVertexCount();
+    std::vector<std::optional<RouteInternalData>> reached(vertex_count);
+    std::vector<std::optional<Weight>> target_weight(vertex_count);
+
+    using QueueItem = std::pair<Weight, VertexId>;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<QueueItem>> queue;
+
+    for (const RouteSeed& seed : sources) {
+        auto& route = reached.at(seed.vertex);
+        if (!route || seed.weight < route->weight) {
+            route = RouteInternalData{seed.weight, std::nullopt, 0};
+            queue.push({seed.weight, seed.vertex});
+        }
+    }
+    for (const RouteSeed& seed : targets) {
+        auto& weight = target_weight.at(seed.vertex);
+        if (!weight || seed.weight < *weight) {
+            weight = seed.weight;
+        }
+    }
+
+    std::optional<Weight> best_weight;
+    VertexId best_target = 0;
+    while (!queue.empty()) {
+        const auto [weight, vertex] = queue.top();
+        queue.pop();
+        if (weight > reached[vertex]->weight) {
+            continue;
+        }
+        // Все оставшиеся в очереди вершины не дешевле лучшего найденного маршрута.
+        if (best_weight && weight >= *best_weight) {
+            break;
+        }
+        if (target_weight[vertex]) {
+            const Weight total = weight + *target_weight[vertex];
+            if (!best_weight || total < *best_weight) {
+                best_weight = total;
+                best_target = vertex;
+            }
+        }
+        for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+            const auto& edge = graph_.GetEdge(edge_id);
+            const Weight candidate = weight + edge.weight;
+            auto& route_to = reached[edge.to];
+            if (!route_to || candidate < route_to->weight) {
+                route_to = RouteInternalData{candidate, edge_id, reached[vertex]->hops + 1};
+                queue.push({candidate, edge.to});
+            }
+        }
+    }
+
+    if (!best_weight) {
+        return std::nullopt;
+    }
+
     std::vector<EdgeId> edges;
-    for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
+    VertexId source = best_target;
+    for (std::optional<EdgeId> edge_id = reached[best_target]->prev_edge;
          edge_id;
-         edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge)
+         edge_id = reached[source]->prev_edge)
     {
         edges.push_back(*edge_id);
+        source = graph_.GetEdge(*edge_id).from;
     }
     std::reverse(edges.begin(), edges.end());
 
-    return RouteInfo{weight, std::move(edges)};
+    return SeededRouteInfo{RouteInfo{*best_weight, std::move(edges)}, source, best_target};
 }
 
 template<typename Weight>
@@ -132,4 +576,138 @@ inline const typename Router<Weight>::RoutesInternalData& Router<Weight>::GetRou
     return routes_internal_data_;
 }
 
+template<typename Weight>
+inline bool Router<Weight>::IsLazy() const
+{
+    return row_flags_ != nullptr;
+}
+
+template<typename Weight>
+inline bool Router<Weight>::IsExternal() const
+{
+    return external_rows_ != nullptr;
+}
+
+template<typename Weight>
+inline size_t Router<Weight>::GetRelaxedCellCount() const
+{
+    return relaxed_cells_;
+}
+
+template<typename Weight>
+memory::Usage Router<Weight>::GetMemoryUsage() const
+{
+    const size_t vertex_count = routes_internal_data_.size();
+    memory::Usage usage{"router_routes", 0, memory::VectorBytes(routes_internal_data_)};
+    if (external_rows_) {
+        usage.elements = graph_.GetVertexCount() * graph_.GetVertexCount();
+        return usage;
+    }
+    if (row_flags_) {
+        const size_t rows = computed_rows_->load(std::memory_order_relaxed);
+        usage.elements = rows * vertex_count;
+        usage.bytes += rows * vertex_count * sizeof(std::optional<RouteInternalData>)
+            + vertex_count * (sizeof(std::once_flag) + sizeof(std::atomic<size_t>));
+        return usage;
+    }
+    for (const Row& row : routes_internal_data_) {
+        usage.elements += row.size();
+        usage.bytes += memory::VectorBytes(row);
+    }
+    return usage;
+}
+
+template<typename Weight>
+size_t Router<Weight>::EstimateTableBytes(size_t vertex_count)
+{
+    return vertex_count * sizeof(Row) + vertex_count * vertex_count * sizeof(std::optional<RouteInternalData>);
+}
+
+template <typename Weight>
+void Router<Weight>::RelaxThroughEdges(const Graph& graph, RoutesInternalData& routes_data,
+                                       const std::vector<EdgeId>& changed_edges) {
+    const size_t vertex_count = graph.GetVertexCount();
+    std::vector<VertexId> ends;
+    ends.reserve(changed_edges.size() * 2);
+    for (const EdgeId edge_id : changed_edges) {
+        const auto& edge = graph.GetEdge(edge_id);
+        if (edge.weight < ZERO_WEIGHT) {
+            throw std::domain_error("Edges' weights should be non-negative");
+        }
+        ends.push_back(edge.from);
+        ends.push_back(edge.to);
+    }
+    std::sort(ends.begin(), ends.end());
+    ends.erase(std::unique(ends.begin(), ends.end()), ends.end());
+    if (ends.empty()) {
+        return;
+    }
+    const size_t ends_count = ends.size();
+    const auto end_index = [&ends](VertexId vertex) {
+        return static_cast<size_t>(std::lower_bound(ends.begin(), ends.end(), vertex) - ends.begin());
+    };
+
+    // Кратчайшие пути между концами изменённых рёбер: старые пути, новые рёбра и их сочетания
+    RoutesInternalData between(ends_count, Row(ends_count));
+    for (size_t from = 0; from < ends_count; ++from) {
+        for (size_t to = 0; to < ends_count; ++to) {
+            between[from][to] = routes_data[ends[from]][ends[to]];
+        }
+    }
+    for (const EdgeId edge_id : changed_edges) {
+        const auto& edge = graph.GetEdge(edge_id);
+        auto& route = between[end_index(edge.from)][end_index(edge.to)];
+        if (!route || edge.weight < route->weight) {
+            route = RouteInternalData{edge.weight, edge_id, 1};
+        }
+    }
+    for (size_t through = 0; through < ends_count; ++through) {
+        for (size_t from = 0; from < ends_count; ++from) {
+            if (const auto route_from = between[from][through]) {
+                for (size_t to = 0; to < ends_count; ++to) {
+                    if (const auto& route_to = between[through][to]) {
+                        Concatenate(between[from][to], *route_from, *route_to);
+                    }
+                }
+            }
+        }
+    }
+
+    // Старые пути от концов изменённых рёбер; копия нужна, потому что сами строки тоже обновляются
+    RoutesInternalData from_ends(ends_count);
+    for (size_t end = 0; end < ends_count; ++end) {
+        from_ends[end] = routes_data[ends[end]];
+    }
+
+    Row to_ends(ends_count);
+    std::vector<size_t> reached_ends;
+    reached_ends.reserve(ends_count);
+    for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
+        // Лучший путь от vertex_from до каждого конца, последний участок которого проходит между концами
+        Row& routes_row = routes_data[vertex_from];
+        reached_ends.clear();
+        for (size_t to = 0; to < ends_count; ++to) {
+            to_ends[to].reset();
+            for (size_t from = 0; from < ends_count; ++from) {
+                if (routes_row[ends[from]] && between[from][to]) {
+                    Concatenate(to_ends[to], *routes_row[ends[from]], *between[from][to]);
+                }
+            }
+            if (to_ends[to]) {
+                reached_ends.push_back(to);
+            }
+        }
+
+        for (const size_t end : reached_ends) {
+            const RouteInternalData route_from = *to_ends[end];
+            const Row& end_row = from_ends[end];
+            for (VertexId vertex_to = 0; vertex_to < vertex_count; ++vertex_to) {
+                if (const auto& route_to = end_row[vertex_to]) {
+                    Concatenate(routes_row[vertex_to], route_from, *route_to);
+                }
+            }
+        }
+    }
+}
+
 }  // namespace graph
\ No newline at end of file
@@ -1,11 +1,175 @@
 #include "serialization.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include "profiling.h"
+
 namespace transport_catalogue {
 	namespace serialize {
 		using namespace std;
 		using namespace domain;
 
 		namespace tcs = transport_catalogue_serialize;
+		using google::protobuf::Arena;
+		using google::protobuf::internal::WireFormatLite;
+
+		namespace {
+			// Записывает сообщение как очередное вхождение поля field_number сообщения DataBase
+			void WriteField(int field_number, const google::protobuf::MessageLite& message, google::protobuf::io::CodedOutputStream& output)
+			{
+				WireFormatLite::WriteTag(field_number, WireFormatLite::WIRETYPE_LENGTH_DELIMITED, &output);
+				output.WriteVarint32(static_cast<uint32_t>(message.ByteSizeLong()));
+				message.SerializeWithCachedSizes(&output);
+			}
+
+			uint64_t WeightBits(double weight)
+			{
+				uint64_t bits;
+				memcpy(&bits, &weight, sizeof(bits));
+				return bits;
+			}
+
+			double WeightFromBits(uint64_t bits)
+			{
+				double weight;
+				memcpy(&weight, &bits, sizeof(weight));
+				return weight;
+			}
+
+			// Вес, относительно которого хранится вес маршрута: вес маршрута до начала его последнего ребра
+			// плюс вес ребра. Сохранение и загрузка считают его одинаково, поэтому вес восстанавливается побитно.
+			double ExpectedWeight(const graph::Router<double>::Row& row, const graph::Edge<double>& last_edge)
+			{
+				return row[last_edge.from]->weight + last_edge.weight;
+			}
+
+			// Восстанавливает веса и число рёбер маршрутов строки. Пока строка не восстановлена,
+			// в поле weight лежат сохранённые биты разности. Ячейки обрабатываются по цепочке
+			// последних рёбер: ячейка начала ребра восстанавливается раньше ячейки его конца.
+			// Возвращает false, если цепочка ведёт в отсутствующую ячейку, на чужое ребро или зацикливается.
+			bool RestoreRouteRow(graph::Router<double>::Row& row, const vector<graph::Edge<double>>& edges)
+			{
+				vector<char> restored(row.size(), 0);
+				vector<graph::VertexId> chain;
+				for (graph::VertexId to = 0; to < row.size(); ++to) {
+					if (!row[to] || restored[to]) {
+						continue;
+					}
+					for (graph::VertexId vertex = to; !restored[vertex];) {
+						if (!row[vertex] || chain.size() == row.size()) {
+							return false;
+						}
+						chain.push_back(vertex);
+						const optional<graph::EdgeId>& prev_edge = row[vertex]->prev_edge;
+						if (!prev_edge) {
+							break;
+						}
+						if (*prev_edge >= edges.size() || edges[*prev_edge].to != vertex || edges[*prev_edge].from >= row.size()) {
+							return false;
+						}
+						vertex = edges[*prev_edge].from;
+					}
+					for (auto vertex = chain.rbegin(); vertex != chain.rend(); ++vertex) {
+						auto& route = *row[*vertex];
+						double expected = 0.;
+						route.hops = 0;
+						if (route.prev_edge) {
+							const graph::Edge<double>& last_edge = edges[*route.prev_edge];
+							expected = ExpectedWeight(row, last_edge);
+							route.hops = row[last_edge.from]->hops + 1;
+						}
+						route.weight = WeightFromBits(WeightBits(route.weight) ^ WeightBits(expected));
+						restored[*vertex] = 1;
+					}
+					chain.clear();
+				}
+				return true;
+			}
+
+			// Очередь задач для рабочих потоков декодирования. Число ожидающих задач ограничено,
+			// чтобы прочитанные, но ещё не разобранные фрагменты файла не накапливались в памяти.
+			// При одном потоке задачи выполняются сразу в вызывающем потоке.
+			class DecodeQueue {
+			public:
+				explicit DecodeQueue(size_t thread_count)
+					: max_pending_(thread_count * PENDING_FRAGMENTS_PER_THREAD)
+				{
+					if (thread_count > 1) {
+						workers_.reserve(thread_count);
+						for (size_t i = 0; i < thread_count; ++i) {
+							workers_.emplace_back([this] { Work(); });
+						}
+					}
+				}
+
+				~DecodeQueue()
+				{
+					Wait();
+				}
+
+				void Push(function<void()> task)
+				{
+					if (workers_.empty()) {
+						task();
+						return;
+					}
+					unique_lock lock(mutex_);
+					has_space_.wait(lock, [this] { return tasks_.size() < max_pending_; });
+					tasks_.push_back(move(task));
+					has_task_.notify_one();
+				}
+
+				// Дожидается выполнения всех задач и завершает рабочие потоки
+				void Wait()
+				{
+					{
+						lock_guard lock(mutex_);
+						done_ = true;
+					}
+					has_task_.notify_all();
+					for (thread& worker : workers_) {
+						worker.join();
+					}
+					workers_.clear();
+				}
+
+			private:
+				mutex mutex_;
+				condition_variable has_task_;
+				condition_variable has_space_;
+				deque<function<void()>> tasks_;
+				size_t max_pending_;
+				bool done_ = false;
+				vector<thread> workers_;
+
+				void Work()
+				{
+					while (true) {
+						function<void()> task;
+						{
+							unique_lock lock(mutex_);
+							has_task_.wait(lock, [this] { return done_ || !tasks_.empty(); });
+							if (tasks_.empty()) {
+								return;
+							}
+							task = move(tasks_.front());
+							tasks_.pop_front();
+						}
+						has_space_.notify_one();
+						task();
+					}
+				}
+			};
+		} // namespace
 
 		MainSerialize::MainSerialize(TransportCatalogue& tc, filesystem::path&& file)
 			: db_(tc)
@@ -21,6 +185,8 @@ namespace transport_catalogue {
 			, string_names_(db_.GetAllStrings())
 			, graph_(nullptr)
 			, router_(nullptr)
+			, renderedMap_(nullptr)
+			, stopProjection_(nullptr)
 		{
 		}
 
@@ -44,202 +210,309 @@ namespace transport_catalogue {
 			router_ = router;
 		}
 
-		Serialize::~Serialize()
+		void Serialize::SetRenderedMap(const renderer::RenderedMap* renderedMap)
 		{
-			google::protobuf::ShutdownProtobufLibrary();
+			renderedMap_ = renderedMap;
 		}
 
-		void Serialize::Save()
+		void Serialize::SetStopProjection(const renderer::StopProjection* stopProjection)
 		{
-			SaveStrings();
-			SaveStops();
-			SaveBuses();
-			SaveStopToStopDistance();
-			if (svgSettings_) {
-				SaveSVGSettings();
-			}
-
-			if (routingSettings_) {
-				SaveRoutingSettings();
-			}
+			stopProjection_ = stopProjection;
+		}
 
-			if (graph_ != nullptr) {
-				SaveGraph();
-			}
+		void Serialize::SetRouteTableFile(filesystem::path file)
+		{
+			routeTableFile_ = move(file);
+		}
 
-			if (router_ != nullptr) {
-				SaveRouter();
-			}
+		Serialize::~Serialize() = default;
 
+		void Serialize::Save()
+		{
+			profiling::Phase phase("save"sv);
 			ofstream out_file(file_, ios::out | ios::trunc | ios::binary);
 			if (!out_file.is_open()) {
 				return;
 			}
 
-			pbDataBase_.SerializeToOstream(&out_file);
+			// Записи пишутся в файл сразу по мере формирования, в порядке номеров полей DataBase,
+			// поэтому файл совместим с обычным разбором сообщения DataBase
+			{
+				google::protobuf::io::OstreamOutputStream raw_output(&out_file);
+				google::protobuf::io::CodedOutputStream output(&raw_output);
+
+				{
+					profiling::Phase phase("save_catalogue"sv);
+					SaveStrings(output);
+					SaveStops(output);
+					SaveBuses(output);
+					SaveStopToStopDistance(output);
+				}
+				if (svgSettings_) {
+					SaveSVGSettings(output);
+				}
+
+				if (routingSettings_) {
+					SaveRoutingSettings(output);
+				}
+
+				if (graph_ != nullptr) {
+					profiling::Phase phase("save_graph"sv);
+					SaveGraph(output);
+				}
+
+				if (router_ != nullptr) {
+					profiling::Phase phase("save_router"sv);
+					SaveRouter(output);
+				}
+
+				if (renderedMap_ != nullptr) {
+					SaveRenderedMap(output);
+				}
+
+				if (stopProjection_ != nullptr) {
+					SaveStopProjection(output);
+				}
+
+				if (routeTableFile_) {
+					SaveRouteTableFile(output);
+				}
+			}
 			out_file.close();
 		}
 
-		void Serialize::SaveStrings()
+		void Serialize::SaveStrings(google::protobuf::io::CodedOutputStream& output)
 		{
+			tcs::Strings_Stuct* pbString = Arena::CreateMessage<tcs::Strings_Stuct>(&arena_);
 			for (const pair<std::string, size_t>& item : string_names_) {
-				tcs::Strings_Stuct one_string;
-				one_string.set_originstring(item.first);
-				one_string.set_id(item.second);
+				pbString->Clear();
+				pbString->set_originstring(item.first);
+				pbString->set_id(item.second);
 
-				*pbDataBase_.add_strings_list() = move(one_string);
+				WriteField(tcs::DataBase::kStringsListFieldNumber, *pbString, output);
 			}
 		}
 
-		void Serialize::SaveStops()
+		void Serialize::SaveStops(google::protobuf::io::CodedOutputStream& output)
 		{
 			const deque<Stop>& stopsDb = db_.GetStopsList();
 
+			tcs::Stop* pbStop = Arena::CreateMessage<tcs::Stop>(&arena_);
 			for (const Stop& stop : stopsDb) {
-				tcs::Stop pbStop;
-
-				pbStop.set_name_id(string_names_.find(stop.name.data())->second);
-				pbStop.set_latitude(stop.latitude);
-				pbStop.set_longitude(stop.longitude);
-				pbStop.set_israw(stop.isRaw);
-				pbStop.set_isfinalstop(stop.isFinalStop);
-				pbStop.set_stop_id(stop.id);
-
-				*pbDataBase_.add_stops_list() = move(pbStop);
+				pbStop->Clear();
+				pbStop->set_name_id(string_names_.find(stop.name.data())->second);
+				pbStop->set_latitude(stop.latitude);
+				pbStop->set_longitude(stop.longitude);
+				pbStop->set_israw(stop.isRaw);
+				pbStop->set_isfinalstop(stop.isFinalStop);
+				pbStop->set_stop_id(stop.id);
+
+				WriteField(tcs::DataBase::kStopsListFieldNumber, *pbStop, output);
 			}
 		}
 
-		void Serialize::SaveBuses()
+		void Serialize::SaveBuses(google::protobuf::io::CodedOutputStream& output)
 		{
 			const deque<Bus>& busesDb = db_.GetBusesList();
 
+			tcs::Bus* pbBus = Arena::CreateMessage<tcs::Bus>(&arena_);
 			for (const Bus& bus : busesDb) {
-				tcs::Bus pbBus;
-
+				pbBus->Clear();
 				for (Stop* stop : bus.stop_for_bus_forward) {
-					pbBus.add_stop_id_for_bus(stop->id);
+					pbBus->add_stop_id_for_bus(stop->id);
 				}
 
-				pbBus.set_name_id(string_names_.find(bus.name.data())->second);
+				pbBus->set_name_id(string_names_.find(bus.name.data())->second);
 				if (bus.secondFinalStop != nullptr) {
-					pbBus.mutable_secondfinalstop_id()->set_value(bus.secondFinalStop->id);
+					pbBus->mutable_secondfinalstop_id()->set_value(bus.secondFinalStop->id);
 				}
-				pbBus.set_is_ring(bus.is_ring);
-				pbBus.set_distance_by_geo(bus.distance_by_geo);
-				pbBus.set_distance_by_road(bus.distance_by_road);
-				pbBus.set_bus_id(bus.id);
+				pbBus->set_is_ring(bus.is_ring);
+				pbBus->set_distance_by_geo(bus.distance_by_geo);
+				pbBus->set_distance_by_road(bus.distance_by_road);
+				pbBus->set_bus_id(bus.id);
 
-				*pbDataBase_.add_buses_list() = move(pbBus);
+				WriteField(tcs::DataBase::kBusesListFieldNumber, *pbBus, output);
 			}
 		}
 
-		void Serialize::SaveStopToStopDistance()
+		void Serialize::SaveStopToStopDistance(google::protobuf::io::CodedOutputStream& output)
 		{
+			tcs::Stop_to_stop_distance* pbStopToStop = Arena::CreateMessage<tcs::Stop_to_stop_distance>(&arena_);
 			for (const StopToStopDistance& item : db_.GetAllStopToStopDistance()) {
-				tcs::Stop_to_stop_distance pbStopToStop;
-
-				pbStopToStop.set_stop_a_id(item.stop_a);
-				pbStopToStop.set_stop_b_id(item.stop_b);
-				pbStopToStop.set_distance(item.distance);
+				pbStopToStop->Clear();
+				pbStopToStop->set_stop_a_id(item.stop_a);
+				pbStopToStop->set_stop_b_id(item.stop_b);
+				pbStopToStop->set_distance(item.distance);
 
-				*pbDataBase_.add_distance_list() = move(pbStopToStop);
+				WriteField(tcs::DataBase::kDistanceListFieldNumber, *pbStopToStop, output);
 			}
 		}
 
-		void Serialize::SaveSVGSettings()
+		void Serialize::SaveSVGSettings(google::protobuf::io::CodedOutputStream& output)
 		{
-			tcs::SVG_Settings pbSVGsetts;
+			tcs::SVG_Settings* pbSVGsetts = Arena::CreateMessage<tcs::SVG_Settings>(&arena_);
 			renderer::SVG_Settings& setts = svgSettings_.value();
-			pbSVGsetts.set_width(setts.width);
-			pbSVGsetts.set_height(setts.height);
-			pbSVGsetts.set_padding(setts.padding);
-			pbSVGsetts.set_line_width(setts.line_width);
-			pbSVGsetts.set_stop_radius(setts.stop_radius);
-			pbSVGsetts.set_bus_label_font_size(setts.bus_label_font_size);
-
-			tcs::Point pointBus;
-			pointBus.set_dx(setts.bus_label_offset.dx);
-			pointBus.set_dy(setts.bus_label_offset.dy);
-			*pbSVGsetts.mutable_bus_label_offset() = move(pointBus);
-
-			tcs::Point pointStop;
-			pointStop.set_dx(setts.stop_label_offset.dx);
-			pointStop.set_dy(setts.stop_label_offset.dy);
-			*pbSVGsetts.mutable_stop_label_offset() = move(pointStop);
-			pbSVGsetts.set_stop_label_font_size(setts.stop_label_font_size);
-
-			pbSVGsetts.set_underlayer_color(setts.underlayer_color);
-			pbSVGsetts.set_underlayer_width(setts.underlayer_width);
+			pbSVGsetts->set_width(setts.width);
+			pbSVGsetts->set_height(setts.height);
+			pbSVGsetts->set_padding(setts.padding);
+			pbSVGsetts->set_line_width(setts.line_width);
+			pbSVGsetts->set_stop_radius(setts.stop_radius);
+			pbSVGsetts->set_bus_label_font_size(setts.bus_label_font_size);
+
+			tcs::Point* pointBus = pbSVGsetts->mutable_bus_label_offset();
+			pointBus->set_dx(setts.bus_label_offset.dx);
+			pointBus->set_dy(setts.bus_label_offset.dy);
+
+			tcs::Point* pointStop = pbSVGsetts->mutable_stop_label_offset();
+			pointStop->set_dx(setts.stop_label_offset.dx);
+			pointStop->set_dy(setts.stop_label_offset.dy);
+			pbSVGsetts->set_stop_label_font_size(setts.stop_label_font_size);
+
+			pbSVGsetts->set_underlayer_color(setts.underlayer_color);
+			pbSVGsetts->set_underlayer_width(setts.underlayer_width);
 
 			for (const string& color : setts.color_palette) {
-				pbSVGsetts.add_color_palette(color);
+				pbSVGsetts->add_color_palette(color);
 			}
+			pbSVGsetts->set_simplify_tolerance(setts.simplify_tolerance);
+			pbSVGsetts->set_thin_labels(setts.thin_labels);
 
-			*pbDataBase_.mutable_svgsettings() = move(pbSVGsetts);
+			WriteField(tcs::DataBase::kSvgSettingsFieldNumber, *pbSVGsetts, output);
 		}
 
-		void Serialize::SaveRoutingSettings()
+		void Serialize::SaveRoutingSettings(google::protobuf::io::CodedOutputStream& output)
 		{
-			tcs::RoutingSettings pbRs;
+			tcs::RoutingSettings* pbRs = Arena::CreateMessage<tcs::RoutingSettings>(&arena_);
 			const domain::RoutingSettings& rs = routingSettings_.value();
-			pbRs.set_bus_wait_time(rs.bus_wait_time);
-			pbRs.set_bus_velocity(rs.bus_velocity);
-			*pbDataBase_.mutable_routingsettings() = move(pbRs);
+			pbRs->set_bus_wait_time(rs.bus_wait_time);
+			pbRs->set_bus_velocity(rs.bus_velocity);
+			pbRs->set_pedestrian_velocity(rs.pedestrian_velocity);
+
+			WriteField(tcs::DataBase::kRoutingSettingsFieldNumber, *pbRs, output);
 		}
 
-		void Serialize::SaveGraph()
+		// Граф пишется несколькими фрагментами поля graph (примерно GRAPH_EDGES_PER_CHUNK рёбер в каждом).
+		// Повторяющиеся вхождения одного поля protobuf объединяет, дописывая списки по порядку,
+		// поэтому при разборе получается тот же граф.
+		void Serialize::SaveGraph(google::protobuf::io::CodedOutputStream& output)
 		{
-			tcs::DirectedWeightedGraph pbGraph;
-			for (const auto& edge : graph_->GetEdges()) {
-				tcs::Edge pbEdge;
-				pbEdge.set_busid(edge.bus->id);
-				pbEdge.set_count(edge.count);
-				pbEdge.set_from(edge.from);
-				pbEdge.set_to(edge.to);
-				pbEdge.set_weight(edge.weight);
+			tcs::DirectedWeightedGraph* pbGraph = Arena::CreateMessage<tcs::DirectedWeightedGraph>(&arena_);
+			const auto& edges = graph_->GetEdges();
+			const auto& incidenceLists = graph_->GetIncidenceList();
 
-				*pbGraph.add_edges() = move(pbEdge);
+			if (edges.empty() && incidenceLists.empty()) {
+				WriteField(tcs::DataBase::kGraphFieldNumber, *pbGraph, output);
+				return;
 			}
 
-			for (const auto& incidenceList : graph_->GetIncidenceList()) {
-				tcs::EdgeId edgesId;
+			for (size_t first = 0; first < edges.size(); first += GRAPH_EDGES_PER_CHUNK) {
+				pbGraph->Clear();
+				const size_t last = min(edges.size(), first + GRAPH_EDGES_PER_CHUNK);
+				for (size_t i = first; i < last; ++i) {
+					const auto& edge = edges[i];
+					tcs::Edge* pbEdge = pbGraph->add_edges();
+					pbEdge->set_busid(edge.bus->id);
+					pbEdge->set_count(edge.count);
+					pbEdge->set_from(edge.from);
+					pbEdge->set_to(edge.to);
+					pbEdge->set_weight(edge.weight);
+				}
+				WriteField(tcs::DataBase::kGraphFieldNumber, *pbGraph, output);
+			}
+
+			pbGraph->Clear();
+			size_t chunkEdges = 0;
+			for (const auto& incidenceList : incidenceLists) {
+				tcs::EdgeId* edgesId = pbGraph->add_incidencelist();
 				for (auto edgeId : incidenceList) {
-					edgesId.add_edgeid(move(edgeId));
+					edgesId->add_edgeid(edgeId);
+				}
+				chunkEdges += incidenceList.size() + 1;
+				if (chunkEdges >= GRAPH_EDGES_PER_CHUNK) {
+					WriteField(tcs::DataBase::kGraphFieldNumber, *pbGraph, output);
+					pbGraph->Clear();
+					chunkEdges = 0;
 				}
-				*pbGraph.add_incidencelist() = move(edgesId);
 			}
-			*pbDataBase_.mutable_graph() = move(pbGraph);
+			if (pbGraph->incidencelist_size() > 0) {
+				WriteField(tcs::DataBase::kGraphFieldNumber, *pbGraph, output);
+			}
 		}
 
-		void Serialize::SaveRouter()
+		// Таблица маршрутов сохраняется блоками строк (примерно ROUTE_CELLS_PER_BLOCK ячеек в блоке),
+		// чтобы ни одно сообщение не приближалось к ограничению protobuf на размер.
+		// Каждый блок записывается в файл сразу, поэтому в памяти одновременно находится только один блок.
+		void Serialize::SaveRouter(google::protobuf::io::CodedOutputStream& output)
 		{
 			const auto& routerData = router_->GetRoutesInternalData();
-			tcs::VertexFrom pbVertexFrom;
-			for (const auto& from : routerData) {
-				tcs::VertexTo pbVertexTo;
-				for (const optional<graph::Router<double>::RouteInternalData>& to : from) {
-					tcs::OptionalRouteInternalData pbOptionalRouteData;
-
-					if (to) {
-						tcs::RouteInternalData pbRouteData;
-						pbRouteData.set_weight(to->weight);
-						if (to->prev_edge) {
-							pbRouteData.set_prev_edge(to->prev_edge.value());
-						}
-						else {
-							pbRouteData.set_isnull(true);
+			const auto& edges = graph_->GetEdges();
+			const size_t vertex_count = routerData.size();
+			if (vertex_count == 0) {
+				return;
+			}
+			const size_t rows_per_block = max<size_t>(1, ROUTE_CELLS_PER_BLOCK / vertex_count);
+
+			tcs::RouteRows* pbRows = Arena::CreateMessage<tcs::RouteRows>(&arena_);
+			for (size_t first_row = 0; first_row < vertex_count; first_row += rows_per_block) {
+				const size_t row_count = min(rows_per_block, vertex_count - first_row);
+				pbRows->Clear();
+				pbRows->set_first_row(first_row);
+				pbRows->set_row_count(row_count);
+				pbRows->set_vertex_count(vertex_count);
+
+				string& present = *pbRows->mutable_present();
+				present.assign((row_count * vertex_count + 7) / 8, '\0');
+				size_t cell = 0;
+				for (size_t row = first_row; row < first_row + row_count; ++row) {
+					for (const optional<graph::Router<double>::RouteInternalData>& to : routerData[row]) {
+						if (to) {
+							present[cell / 8] |= static_cast<char>(1 << (cell % 8));
+							pbRows->add_prev_edges(to->prev_edge ? static_cast<uint32_t>(*to->prev_edge + 1) : 0);
+							const double expected = to->prev_edge ? ExpectedWeight(routerData[row], edges[*to->prev_edge]) : 0.;
+							pbRows->add_weight_residuals(WeightBits(to->weight) ^ WeightBits(expected));
 						}
-						*pbOptionalRouteData.mutable_route_internal_data() = move(pbRouteData);
+						++cell;
 					}
-					else {
-						pbOptionalRouteData.set_isnull(true);
-					}
-					*pbVertexTo.add_routes_internal_data() = move(pbOptionalRouteData);
 				}
-				*pbVertexFrom.add_from() = move(pbVertexTo);
+				WriteField(tcs::DataBase::kRouterRowsFieldNumber, *pbRows, output);
+			}
+		}
+		void Serialize::SaveRenderedMap(google::protobuf::io::CodedOutputStream& output)
+		{
+			tcs::Rendered_Map* pbMap = Arena::CreateMessage<tcs::Rendered_Map>(&arena_);
+			pbMap->set_settings_hash(renderedMap_->settings_hash);
+			pbMap->set_svg(renderedMap_->svg);
+
+			WriteField(tcs::DataBase::kRenderedMapFieldNumber, *pbMap, output);
+		}
+
+		void Serialize::SaveStopProjection(google::protobuf::io::CodedOutputStream& output)
+		{
+			tcs::Stop_Projection* pbProjection = Arena::CreateMessage<tcs::Stop_Projection>(&arena_);
+			const renderer::SphereProjector::Parameters parameters = stopProjection_->projector.GetParameters();
+			pbProjection->set_settings_hash(stopProjection_->settings_hash);
+			pbProjection->set_offset_x(parameters.offset_x);
+			pbProjection->set_offset_y(parameters.offset_y);
+			pbProjection->set_min_lon(parameters.min_lon);
+			pbProjection->set_max_lat(parameters.max_lat);
+			pbProjection->set_zoom_coeff(parameters.zoom_coeff);
+			pbProjection->mutable_screen_x()->Reserve(stopProjection_->screen.size());
+			pbProjection->mutable_screen_y()->Reserve(stopProjection_->screen.size());
+			for (const svg::Point& point : stopProjection_->screen) {
+				pbProjection->add_screen_x(point.x);
+				pbProjection->add_screen_y(point.y);
 			}
+			pbProjection->mutable_order()->Add(stopProjection_->order.begin(), stopProjection_->order.end());
+
+			WriteField(tcs::DataBase::kStopProjectionFieldNumber, *pbProjection, output);
+		}
 
-			*pbDataBase_.mutable_router() = move(pbVertexFrom);
+		void Serialize::SaveRouteTableFile(google::protobuf::io::CodedOutputStream& output)
+		{
+			tcs::Route_Table_File* pbTable = Arena::CreateMessage<tcs::Route_Table_File>(&arena_);
+			// Имя без каталога: база и таблица переносятся вместе
+			pbTable->set_file(routeTableFile_->filename().string());
+			WriteField(tcs::DataBase::kRouteTableFileFieldNumber, *pbTable, output);
 		}
 
 
@@ -247,202 +520,496 @@ namespace transport_catalogue {
 
 
 
-		Deserialize::Deserialize(TransportCatalogue& tc, filesystem::path&& file)
+		Deserialize::Deserialize(TransportCatalogue& tc, filesystem::path&& file, size_t thread_count)
 			: MainSerialize::MainSerialize(tc, move(file))
+			, thread_count_(max<size_t>(thread_count, 1))
 		{
 		}
 
-		Deserialize::~Deserialize()
-		{
-			google::protobuf::ShutdownProtobufLibrary();
-		}
+		Deserialize::~Deserialize() = default;
 
-		void Deserialize::Load()
+		bool Deserialize::Load(unsigned sections)
 		{
+			profiling::Phase phase("load"sv);
 			ifstream in_file(file_, ios::in | ios::binary);
-			if (!in_file.is_open() || !pbDataBase_.ParseFromIstream(&in_file)) {
-				return;
+			if (!in_file.is_open()) {
+				return false;
 			}
-			in_file.close();
-
-			LoadStrings();
-			LoadStops();
-			LoadBuses();
-			LoadStopToStopRoute();
-			LoadSVGSettings();
-			LoadRoutingSettings();
-			LoadGraph();
-			LoadRouter();
+			// Записи переносятся в справочник по мере чтения, поэтому ошибка в середине файла
+			// оставила бы его частично заполненным; как и при разборе сообщения целиком, база не загружается
+			if (!ParseSections(in_file, sections)) {
+				Discard();
+				return false;
+			}
+			return true;
+		}
 
+		void Deserialize::Discard()
+		{
+			db_ = TransportCatalogue();
+			stringViewId_.clear();
+			edges_.clear();
+			incidence_lists_.clear();
+			routes_internal_data_.clear();
+			renderedMap_.reset();
+			stopProjection_.reset();
+			routeTableFile_.reset();
+			svgSettings_.reset();
+			routingSettings_.reset();
+			busesWithoutStatistic_ = false;
 		}
 
-		void Deserialize::LoadStrings()
+		// Разбирает верхний уровень сообщения DataBase вручную. Каждая нужная запись разбирается
+		// в переиспользуемое сообщение из арены и сразу переносится в справочник,
+		// ненужные записи пропускаются по длине, не создавая вложенных сообщений.
+		// Записи в файле идут в порядке номеров полей, поэтому строки загружаются раньше остановок,
+		// остановки раньше маршрутов, а маршруты раньше графа.
+		// Фрагменты графа и блоки таблицы маршрутов не зависят друг от друга, поэтому читаются
+		// из файла целиком и разбираются рабочими потоками; связывание с маршрутами выполняется в конце.
+		bool Deserialize::ParseSections(std::istream& input, unsigned sections)
 		{
-			for (size_t i = 0; i < pbDataBase_.strings_list_size(); ++i) {
-				tcs::Strings_Stuct* pbstring = pbDataBase_.mutable_strings_list(i);
-				stringViewId_[pbstring->id()] = db_.InsertString(move(*pbstring->mutable_originstring()), pbstring->id());
+			tcs::Strings_Stuct* pbString = Arena::CreateMessage<tcs::Strings_Stuct>(&arena_);
+			tcs::Stop* pbStop = Arena::CreateMessage<tcs::Stop>(&arena_);
+			tcs::Bus* pbBus = Arena::CreateMessage<tcs::Bus>(&arena_);
+			tcs::Stop_to_stop_distance* pbDistance = Arena::CreateMessage<tcs::Stop_to_stop_distance>(&arena_);
+			tcs::SVG_Settings* pbSetts = Arena::CreateMessage<tcs::SVG_Settings>(&arena_);
+			tcs::RoutingSettings* pbRs = Arena::CreateMessage<tcs::RoutingSettings>(&arena_);
+			tcs::Rendered_Map* pbMap = Arena::CreateMessage<tcs::Rendered_Map>(&arena_);
+			tcs::Stop_Projection* pbProjection = Arena::CreateMessage<tcs::Stop_Projection>(&arena_);
+			tcs::Route_Table_File* pbTable = Arena::CreateMessage<tcs::Route_Table_File>(&arena_);
+
+			deque<GraphFragment> graphFragments;
+			deque<RouteRowsBlock> routeRowsBlocks;
+			atomic<bool> decoded = true;
+			DecodeQueue decodeQueue(thread_count_);
+			const auto decode = [&decoded, &decodeQueue](google::protobuf::io::CodedInputStream& coded_input, auto decoder, auto& result) {
+				int length = 0;
+				string data;
+				if (!coded_input.ReadVarintSizeAsInt(&length) || !coded_input.ReadString(&data, length)) {
+					return false;
+				}
+				decodeQueue.Push([&decoded, decoder, &result, data = move(data)] {
+					if (!decoder(data, result)) {
+						decoded = false;
+					}
+				});
+				return true;
+			};
+
+			google::protobuf::io::IstreamInputStream raw_input(&input);
+			optional<profiling::Phase> phase;
+			phase.emplace("read"sv);
+			bool finished = false;
+			while (!finished) {
+				google::protobuf::io::CodedInputStream coded_input(&raw_input);
+				const auto read = [&coded_input](auto* message) {
+					message->Clear();
+					return WireFormatLite::ReadMessage(&coded_input, message);
+				};
+
+				while (coded_input.CurrentPosition() < CODED_STREAM_RESET_BYTES) {
+					const uint32_t tag = coded_input.ReadTag();
+					if (tag == 0) {
+						finished = true;
+						break;
+					}
+
+					const int field_number = WireFormatLite::GetTagFieldNumber(tag);
+					if (WireFormatLite::GetTagWireType(tag) != WireFormatLite::WIRETYPE_LENGTH_DELIMITED
+						|| !IsSectionWanted(field_number, sections)) {
+						if (!WireFormatLite::SkipField(&coded_input, tag)) {
+							return false;
+						}
+						continue;
+					}
+
+					switch (field_number) {
+					case tcs::DataBase::kStringsListFieldNumber:
+						if (!read(pbString)) {
+							return false;
+						}
+						LoadString(*pbString);
+						break;
+					case tcs::DataBase::kStopsListFieldNumber:
+						if (!read(pbStop)) {
+							return false;
+						}
+						LoadStop(*pbStop);
+						break;
+					case tcs::DataBase::kBusesListFieldNumber:
+						if (!read(pbBus)) {
+							return false;
+						}
+						LoadBus(*pbBus);
+						break;
+					case tcs::DataBase::kDistanceListFieldNumber:
+						if (!read(pbDistance)) {
+							return false;
+						}
+						LoadStopToStopRoute(*pbDistance);
+						break;
+					case tcs::DataBase::kSvgSettingsFieldNumber:
+						if (!read(pbSetts)) {
+							return false;
+						}
+						LoadSVGSettings(*pbSetts);
+						break;
+					case tcs::DataBase::kRoutingSettingsFieldNumber:
+						if (!read(pbRs)) {
+							return false;
+						}
+						LoadRoutingSettings(*pbRs);
+						break;
+					case tcs::DataBase::kRenderedMapFieldNumber:
+						if (!read(pbMap)) {
+							return false;
+						}
+						LoadRenderedMap(*pbMap);
+						break;
+					case tcs::DataBase::kStopProjectionFieldNumber:
+						if (!read(pbProjection)) {
+							return false;
+						}
+						LoadStopProjection(*pbProjection);
+						break;
+					case tcs::DataBase::kRouteTableFileFieldNumber:
+						if (!read(pbTable)) {
+							return false;
+						}
+						LoadRouteTableFile(*pbTable);
+						break;
+					case tcs::DataBase::kGraphFieldNumber:
+						if (!decode(coded_input, DecodeGraph, graphFragments.emplace_back())) {
+							return false;
+						}
+						break;
+					case tcs::DataBase::kRouterRowsFieldNumber:
+						if (!decode(coded_input, DecodeRouter, routeRowsBlocks.emplace_back())) {
+							return false;
+						}
+						break;
+					default:
+						break;
+					}
+				}
+			}
+
+			phase.reset();
+			phase.emplace("decode_wait"sv);
+			decodeQueue.Wait();
+			if (!decoded) {
+				return false;
 			}
+			phase.reset();
+			phase.emplace("link"sv);
+			if (!LinkFragments(graphFragments, routeRowsBlocks)) {
+				return false;
+			}
+			profiling::AddCounter("graph_edges_loaded"sv, edges_.size());
+			profiling::AddCounter("route_rows_loaded"sv, routes_internal_data_.size());
+			return true;
 		}
 
-		void Deserialize::LoadStops()
+		bool Deserialize::IsSectionWanted(int field_number, unsigned sections) const
 		{
-			for (size_t i = 0; i < pbDataBase_.stops_list_size(); ++i) {
-				tcs::Stop* pbStop = pbDataBase_.mutable_stops_list(i);
-				Stop newStop(
-					stringViewId_.find(pbStop->name_id())->second,
-					pbStop->latitude(),
-					pbStop->longitude());
-				newStop.isRaw = pbStop->israw();
-				newStop.isFinalStop = pbStop->isfinalstop();
-				newStop.id = pbStop->stop_id();
-
-				db_.InsertStop(move(newStop));
+			switch (field_number) {
+			case tcs::DataBase::kStringsListFieldNumber:
+			case tcs::DataBase::kStopsListFieldNumber:
+			case tcs::DataBase::kBusesListFieldNumber:
+				return sections & CATALOGUE;
+			case tcs::DataBase::kDistanceListFieldNumber:
+				// Расстояния сохраняются после маршрутов, поэтому здесь уже видно, рассчитана ли статистика
+				return (sections & DISTANCES) || ((sections & CATALOGUE) && busesWithoutStatistic_);
+			case tcs::DataBase::kSvgSettingsFieldNumber:
+			case tcs::DataBase::kRenderedMapFieldNumber:
+			case tcs::DataBase::kStopProjectionFieldNumber:
+				return sections & RENDER_SETTINGS;
+			case tcs::DataBase::kRoutingSettingsFieldNumber:
+			case tcs::DataBase::kGraphFieldNumber:
+			case tcs::DataBase::kRouterRowsFieldNumber:
+			case tcs::DataBase::kRouteTableFileFieldNumber:
+				return sections & ROUTING;
+			default:
+				return false;
 			}
 		}
 
-		void Deserialize::LoadBuses()
+		void Deserialize::LoadString(tcs::Strings_Stuct& pbString)
 		{
-			for (size_t i = 0; i < pbDataBase_.buses_list_size(); ++i) {
-				tcs::Bus* pbBus = pbDataBase_.mutable_buses_list(i);
-				Bus newBus(stringViewId_.find(pbBus->name_id())->second, pbBus->is_ring());
+			stringViewId_[pbString.id()] = db_.InsertString(move(*pbString.mutable_originstring()), pbString.id());
+		}
 
-				newBus.stop_for_bus_forward.reserve(pbBus->stop_id_for_bus_size());
-				for (size_t j = 0; j < pbBus->stop_id_for_bus_size(); ++j) {
-					newBus.stop_for_bus_forward.push_back(db_.MutableStopById(pbBus->stop_id_for_bus().Get(j)));
-				}
-				if (pbBus->has_secondfinalstop_id()) {
-					newBus.secondFinalStop = db_.MutableStopById(pbBus->secondfinalstop_id().value());
-				}
-				else {
-					newBus.secondFinalStop = nullptr;
-				}
-				newBus.distance_by_geo = pbBus->distance_by_geo();
-				newBus.distance_by_road = pbBus->distance_by_road();
-				newBus.id = pbBus->bus_id();
+		void Deserialize::LoadStop(const tcs::Stop& pbStop)
+		{
+			Stop newStop(
+				stringViewId_.find(pbStop.name_id())->second,
+				pbStop.latitude(),
+				pbStop.longitude());
+			newStop.isRaw = pbStop.israw();
+			newStop.isFinalStop = pbStop.isfinalstop();
+			newStop.id = pbStop.stop_id();
+
+			db_.InsertStop(move(newStop));
+		}
 
-				db_.InsertBus(move(newBus));
+		void Deserialize::LoadBus(const tcs::Bus& pbBus)
+		{
+			Bus newBus(stringViewId_.find(pbBus.name_id())->second, pbBus.is_ring());
+
+			newBus.stop_for_bus_forward.reserve(pbBus.stop_id_for_bus_size());
+			for (size_t j = 0; j < pbBus.stop_id_for_bus_size(); ++j) {
+				newBus.stop_for_bus_forward.push_back(db_.MutableStopById(pbBus.stop_id_for_bus().Get(j)));
+			}
+			if (pbBus.has_secondfinalstop_id()) {
+				newBus.secondFinalStop = db_.MutableStopById(pbBus.secondfinalstop_id().value());
+			}
+			else {
+				newBus.secondFinalStop = nullptr;
 			}
+			newBus.distance_by_geo = pbBus.distance_by_geo();
+			newBus.distance_by_road = pbBus.distance_by_road();
+			newBus.id = pbBus.bus_id();
+			if (newBus.distance_by_road < 0.001) {
+				busesWithoutStatistic_ = true;
+			}
+
+			db_.InsertBus(move(newBus));
 		}
 
-		void Deserialize::LoadStopToStopRoute()
+		void Deserialize::LoadStopToStopRoute(const tcs::Stop_to_stop_distance& pbDistance)
 		{
-			for (size_t i = 0; i < pbDataBase_.distance_list_size(); ++i) {
-				tcs::Stop_to_stop_distance* distance = pbDataBase_.mutable_distance_list(i);
-				const domain::StopToStopDistance stops(
-					static_cast<size_t>(distance->stop_a_id()),
-					static_cast<size_t>(distance->stop_b_id()),
-					static_cast<size_t>(distance->distance()));
-				db_.InsertStopToStopDistance(stops);
-			}
+			const domain::StopToStopDistance stops(
+				static_cast<size_t>(pbDistance.stop_a_id()),
+				static_cast<size_t>(pbDistance.stop_b_id()),
+				static_cast<size_t>(pbDistance.distance()));
+			db_.InsertStopToStopDistance(stops);
 		}
 
-		void Deserialize::LoadSVGSettings()
+		void Deserialize::LoadSVGSettings(const tcs::SVG_Settings& pbSetts)
 		{
-			if (pbDataBase_.has_svgsettings()) {
-				renderer::SVG_Settings setts;
+			renderer::SVG_Settings setts;
 
-				const tcs::SVG_Settings& pbSetts = pbDataBase_.svgsettings();
-				setts.width = pbSetts.width();
-				setts.height = pbSetts.height();
-				setts.padding = pbSetts.padding();
-				setts.line_width = pbSetts.line_width();
-				setts.stop_radius = pbSetts.stop_radius();
-				setts.bus_label_font_size = pbSetts.bus_label_font_size();
+			setts.width = pbSetts.width();
+			setts.height = pbSetts.height();
+			setts.padding = pbSetts.padding();
+			setts.line_width = pbSetts.line_width();
+			setts.stop_radius = pbSetts.stop_radius();
+			setts.bus_label_font_size = pbSetts.bus_label_font_size();
 
-				setts.bus_label_offset.dx = pbSetts.bus_label_offset().dx();
-				setts.bus_label_offset.dy = pbSetts.bus_label_offset().dy();
+			setts.bus_label_offset.dx = pbSetts.bus_label_offset().dx();
+			setts.bus_label_offset.dy = pbSetts.bus_label_offset().dy();
 
-				setts.stop_label_offset.dx = pbSetts.stop_label_offset().dx();
-				setts.stop_label_offset.dy = pbSetts.stop_label_offset().dy();
+			setts.stop_label_offset.dx = pbSetts.stop_label_offset().dx();
+			setts.stop_label_offset.dy = pbSetts.stop_label_offset().dy();
 
-				setts.stop_label_font_size = pbSetts.stop_label_font_size();
+			setts.stop_label_font_size = pbSetts.stop_label_font_size();
 
-				setts.underlayer_color = pbSetts.underlayer_color();
-				setts.underlayer_width = pbSetts.underlayer_width();
+			setts.underlayer_color = pbSetts.underlayer_color();
+			setts.underlayer_width = pbSetts.underlayer_width();
 
-				for (size_t i = 0; i < pbSetts.color_palette_size(); ++i) {
-					setts.color_palette.push_back(pbSetts.color_palette(i));
-				}
-				svgSettings_ = move(setts);
+			for (size_t i = 0; i < pbSetts.color_palette_size(); ++i) {
+				setts.color_palette.push_back(pbSetts.color_palette(i));
 			}
+			setts.simplify_tolerance = pbSetts.simplify_tolerance();
+			setts.thin_labels = pbSetts.thin_labels();
+			svgSettings_ = move(setts);
 		}
 
-		void Deserialize::LoadRoutingSettings()
+		void Deserialize::LoadRoutingSettings(const tcs::RoutingSettings& pbRs)
 		{
-			if (pbDataBase_.has_routingsettings()) {
-				const tcs::RoutingSettings& pbRs = pbDataBase_.routingsettings();
-				domain::RoutingSettings rs
-				{
-					pbRs.bus_wait_time(),
-					pbRs.bus_velocity()
-				};
-				routingSettings_ = move(rs);
+			domain::RoutingSettings rs
+			{
+				pbRs.bus_wait_time(),
+				pbRs.bus_velocity()
+			};
+			if (pbRs.pedestrian_velocity() > 0) {
+				rs.pedestrian_velocity = pbRs.pedestrian_velocity();
 			}
+			routingSettings_ = move(rs);
 		}
 
-		void Deserialize::LoadGraph()
+		void Deserialize::LoadRenderedMap(tcs::Rendered_Map& pbMap)
 		{
-			if (pbDataBase_.has_graph()) {
-				const tcs::DirectedWeightedGraph* pbGraph = pbDataBase_.mutable_graph();
+			renderer::RenderedMap renderedMap;
+			renderedMap.settings_hash = pbMap.settings_hash();
+			renderedMap.svg = move(*pbMap.mutable_svg());
+			renderedMap_ = move(renderedMap);
+		}
 
-				edges_.reserve(pbGraph->edges_size());
-				for (size_t i = 0; i < pbGraph->edges_size(); ++i) {
-					const tcs::Edge& pbEdge = pbGraph->edges(i);
-					graph::Edge<double> edge
-					{
-						pbEdge.from(),
-						pbEdge.to(),
-						pbEdge.weight(),
-						pbEdge.count(),
-						db_.MutableBusById(pbEdge.busid())
-					};
-
-					edges_.push_back(move(edge));
-				}
+		void Deserialize::LoadStopProjection(const tcs::Stop_Projection& pbProjection)
+		{
+			renderer::StopProjection projection;
+			projection.settings_hash = pbProjection.settings_hash();
+			projection.projector = renderer::SphereProjector({
+				pbProjection.offset_x(),
+				pbProjection.offset_y(),
+				pbProjection.min_lon(),
+				pbProjection.max_lat(),
+				pbProjection.zoom_coeff() });
+			const int count = min(pbProjection.screen_x_size(), pbProjection.screen_y_size());
+			projection.screen.reserve(count);
+			for (int i = 0; i < count; ++i) {
+				projection.screen.push_back({ pbProjection.screen_x(i), pbProjection.screen_y(i) });
+			}
+			projection.order.assign(pbProjection.order().begin(), pbProjection.order().end());
+			stopProjection_ = move(projection);
+		}
 
-				incidence_lists_.reserve(pbGraph->incidencelist_size());
-				for (size_t i = 0; i < pbGraph->incidencelist_size(); ++i) {
-					const tcs::EdgeId& pbEdgeId = pbGraph->incidencelist(i);
-					vector<size_t> incidents(pbEdgeId.edgeid_size());
-					for (size_t j = 0; j < pbEdgeId.edgeid_size(); ++j) {
-						incidents[j] = pbEdgeId.edgeid(j);
-					}
-					incidence_lists_.push_back(move(incidents));
-				}
+		void Deserialize::LoadRouteTableFile(const tcs::Route_Table_File& pbTable)
+		{
+			if (!pbTable.file().empty()) {
+				routeTableFile_ = file_.parent_path() / pbTable.file();
 			}
 		}
 
-		void Deserialize::LoadRouter()
+		// Граф может быть записан несколькими фрагментами, каждый разбирается отдельно
+		bool Deserialize::DecodeGraph(const string& data, GraphFragment& fragment)
 		{
-			if (pbDataBase_.has_router()) {
-				tcs::VertexFrom* pbRouter = pbDataBase_.mutable_router();
-				routes_internal_data_.resize(pbRouter->from_size());
+			Arena arena;
+			tcs::DirectedWeightedGraph* pbGraph = Arena::CreateMessage<tcs::DirectedWeightedGraph>(&arena);
+			if (!pbGraph->ParseFromString(data)) {
+				return false;
+			}
 
-				for (size_t i = 0; i < pbRouter->from_size(); ++i) {
-					tcs::VertexTo* pbVertexTo = pbRouter->mutable_from(i);
+			fragment.edges.reserve(pbGraph->edges_size());
+			fragment.bus_ids.reserve(pbGraph->edges_size());
+			for (size_t i = 0; i < pbGraph->edges_size(); ++i) {
+				const tcs::Edge& pbEdge = pbGraph->edges(i);
+				graph::Edge<double> edge
+				{
+					pbEdge.from(),
+					pbEdge.to(),
+					pbEdge.weight(),
+					pbEdge.count(),
+					nullptr
+				};
+
+				fragment.edges.push_back(move(edge));
+				fragment.bus_ids.push_back(pbEdge.busid());
+			}
 
-					for (size_t j = 0; j < pbVertexTo->routes_internal_data_size(); ++j) {
-						const tcs::OptionalRouteInternalData& pbRouteData = pbVertexTo->routes_internal_data(j);
-						graph::Router<double>::RouteInternalData routeItem;
-						routes_internal_data_[i].resize(pbVertexTo->routes_internal_data_size());
+			fragment.incidence_lists.reserve(pbGraph->incidencelist_size());
+			for (size_t i = 0; i < pbGraph->incidencelist_size(); ++i) {
+				const tcs::EdgeId& pbEdgeId = pbGraph->incidencelist(i);
+				vector<size_t> incidents(pbEdgeId.edgeid_size());
+				for (size_t j = 0; j < pbEdgeId.edgeid_size(); ++j) {
+					incidents[j] = pbEdgeId.edgeid(j);
+				}
+				fragment.incidence_lists.push_back(move(incidents));
+			}
+			return true;
+		}
 
-						if (pbRouteData.optional_route_internal_data_case() 
-							== tcs::OptionalRouteInternalData::OptionalRouteInternalDataCase::kRouteInternalData) {
+		bool Deserialize::DecodeRouter(const string& data, RouteRowsBlock& block)
+		{
+			Arena arena;
+			tcs::RouteRows* pbRows = Arena::CreateMessage<tcs::RouteRows>(&arena);
+			if (!pbRows->ParseFromString(data)) {
+				return false;
+			}
 
-							const auto& data = pbRouteData.route_internal_data();
-							routeItem.weight = data.weight();
+			const size_t vertex_count = pbRows->vertex_count();
+			const size_t cell_count = static_cast<size_t>(pbRows->row_count()) * vertex_count;
+			const string& present = pbRows->present();
+			if (present.size() * 8 < cell_count) {
+				return false;
+			}
+			// Значения хранятся только для отмеченных ячеек: в повреждённом блоке массивов может не хватить
+			size_t present_count = 0;
+			for (size_t cell = 0; cell < cell_count; ++cell) {
+				present_count += (present[cell / 8] >> (cell % 8)) & 1;
+			}
+			if (present_count != static_cast<size_t>(pbRows->prev_edges_size())
+				|| present_count != static_cast<size_t>(pbRows->weight_residuals_size())) {
+				return false;
+			}
 
-							if (data.edgeId_case() == tcs::RouteInternalData::EdgeIdCase::kPrevEdge) {
-								routeItem.prev_edge = data.prev_edge();
-							}
-							routes_internal_data_[i][j] = move(routeItem);
-						}
-						else {
-							routes_internal_data_[i][j] = nullopt;
+			block.first_row = pbRows->first_row();
+			block.vertex_count = vertex_count;
+			block.rows.resize(pbRows->row_count());
+			size_t cell = 0;
+			int value = 0;
+			for (auto& routes_row : block.rows) {
+				routes_row.assign(vertex_count, nullopt);
+				for (size_t column = 0; column < vertex_count; ++column, ++cell) {
+					if (!(present[cell / 8] & (1 << (cell % 8)))) {
+						continue;
+					}
+					// Вес и число рёбер восстанавливаются после сборки графа в LinkFragments
+					graph::Router<double>::RouteInternalData routeItem;
+					routeItem.weight = WeightFromBits(pbRows->weight_residuals(value));
+					if (const uint32_t prev_edge = pbRows->prev_edges(value); prev_edge != 0) {
+						routeItem.prev_edge = prev_edge - 1;
+					}
+					routes_row[column] = routeItem;
+					++value;
+				}
+			}
+			return true;
+		}
+
+		bool Deserialize::LinkFragments(deque<GraphFragment>& graphFragments, deque<RouteRowsBlock>& routeRowsBlocks)
+		{
+			for (GraphFragment& fragment : graphFragments) {
+				edges_.reserve(edges_.size() + fragment.edges.size());
+				for (size_t i = 0; i < fragment.edges.size(); ++i) {
+					fragment.edges[i].bus = db_.MutableBusById(fragment.bus_ids[i]);
+					edges_.push_back(move(fragment.edges[i]));
+				}
+				move(fragment.incidence_lists.begin(), fragment.incidence_lists.end(), back_inserter(incidence_lists_));
+			}
+			graphFragments.clear();
+
+			// Сохранённая таблица должна покрывать каждую вершину графа ровно одной строкой:
+			// иначе маршрутизатор получил бы таблицу с пустыми строками вместо перестроения
+			const size_t vertex_count = incidence_lists_.size();
+			if (!routeRowsBlocks.empty()) {
+				vector<char> covered(vertex_count, 0);
+				for (const RouteRowsBlock& block : routeRowsBlocks) {
+					if (block.vertex_count != vertex_count || block.first_row > vertex_count
+						|| block.rows.size() > vertex_count - block.first_row) {
+						return false;
+					}
+					for (size_t row = block.first_row; row < block.first_row + block.rows.size(); ++row) {
+						if (covered[row]) {
+							return false;
 						}
+						covered[row] = 1;
 					}
 				}
+				if (find(covered.begin(), covered.end(), 0) != covered.end()) {
+					return false;
+				}
 			}
+
+			atomic<bool> restored = true;
+			{
+				DecodeQueue restoreQueue(thread_count_);
+				for (RouteRowsBlock& block : routeRowsBlocks) {
+					restoreQueue.Push([this, &restored, &block] {
+						for (auto& routes_row : block.rows) {
+							if (!RestoreRouteRow(routes_row, edges_)) {
+								restored = false;
+								return;
+							}
+						}
+					});
+				}
+			}
+			if (!restored) {
+				return false;
+			}
+
+			if (!routeRowsBlocks.empty()) {
+				routes_internal_data_.resize(vertex_count);
+			}
+			for (RouteRowsBlock& block : routeRowsBlocks) {
+				for (size_t i = 0; i < block.rows.size(); ++i) {
+					routes_internal_data_[block.first_row + i] = move(block.rows[i]);
+				}
+			}
+			routeRowsBlocks.clear();
+			return true;
 		}
 
 		optional<renderer::SVG_Settings> Deserialize::GetSVGSettings() const
@@ -470,6 +1037,21 @@ namespace transport_catalogue {
 			return routes_internal_data_;
 		}
 
+		optional<renderer::RenderedMap>& Deserialize::GetRenderedMap()
+		{
+			return renderedMap_;
+		}
+
+		optional<renderer::StopProjection>& Deserialize::GetStopProjection()
+		{
+			return stopProjection_;
+		}
+
+		const optional<filesystem::path>& Deserialize::GetRouteTableFile() const
+		{
+			return routeTableFile_;
+		}
+
 
 
 	} // namespace serialize
@@ -1,10 +1,15 @@
 #pragma once
+#include <deque>
 #include <fstream>
 #include <filesystem>
 #include <optional>
+#include <string>
+#include <thread>
 
 #include "transport_catalogue.h"
 #include <transport_catalogue.pb.h>
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/coded_stream.h>
 #include "map_renderer.h"
 #include "graph.h"
 #include "router.h"
@@ -12,6 +17,27 @@
 namespace transport_catalogue {
 	namespace serialize {
 
+		// Примерное количество ячеек таблицы маршрутов в одном сохраняемом блоке строк
+		inline const size_t ROUTE_CELLS_PER_BLOCK = 1 << 20;
+		// Примерное количество рёбер графа в одном сохраняемом фрагменте
+		inline const size_t GRAPH_EDGES_PER_CHUNK = 1 << 16;
+		// CodedInputStream не читает больше 2 ГБ, поэтому при загрузке он пересоздаётся после этого объёма
+		inline const int CODED_STREAM_RESET_BYTES = 1 << 30;
+		// Наибольшее число прочитанных, но ещё не разобранных фрагментов на один поток декодирования
+		inline const size_t PENDING_FRAGMENTS_PER_THREAD = 2;
+
+		// Разделы базы, которые можно загружать выборочно.
+		enum Section : unsigned {
+			// Строки, остановки и маршруты — нужны для любых запросов
+			CATALOGUE = 1 << 0,
+			// Расстояния между остановками — нужны, только если статистика маршрутов не была рассчитана
+			DISTANCES = 1 << 1,
+			RENDER_SETTINGS = 1 << 2,
+			// Настройки маршрутизации, граф и таблица маршрутов
+			ROUTING = 1 << 3,
+			ALL_SECTIONS = CATALOGUE | DISTANCES | RENDER_SETTINGS | ROUTING,
+		};
+
 		class MainSerialize {
 		public:
 			MainSerialize(TransportCatalogue& tc, std::filesystem::path&& file);
@@ -20,7 +46,9 @@ namespace transport_catalogue {
 		protected:
 			TransportCatalogue& db_;
 			std::filesystem::path file_;
-			transport_catalogue_serialize::DataBase pbDataBase_;
+			// Вспомогательные сообщения protobuf создаются в арене один раз и переиспользуются для каждой записи.
+			// Сообщение DataBase целиком в памяти не собирается: записи пишутся и читаются по одной.
+			google::protobuf::Arena arena_;
 			std::optional<renderer::SVG_Settings> svgSettings_;
 			std::optional<domain::RoutingSettings> routingSettings_;
 
@@ -33,6 +61,11 @@ namespace transport_catalogue {
 			void SetRoutingSettings(const domain::RoutingSettings& routingSettings);
 			void SetGraph(graph::DirectedWeightedGraph<double>* graphRef);
 			void SetRouter(graph::Router<double>* router);
+			// Заранее отрисованная карта сохраняется вместе с хешем настроек, по которым она построена
+			void SetRenderedMap(const renderer::RenderedMap* renderedMap);
+			void SetStopProjection(const renderer::StopProjection* stopProjection);
+			// Таблица маршрутов записана в файл file рядом с базой; в базе сохраняется только ссылка на него
+			void SetRouteTableFile(std::filesystem::path file);
 
 			~Serialize() override;
 
@@ -42,45 +75,90 @@ namespace transport_catalogue {
 			const std::unordered_map<std::string, size_t>& string_names_;
 			graph::DirectedWeightedGraph<double>* graph_;
 			graph::Router<double>* router_;
-
-			void SaveStrings();
-			void SaveStops();
-			void SaveBuses();
-			void SaveStopToStopDistance();
-			void SaveSVGSettings();
-			void SaveRoutingSettings();
-			void SaveGraph();
-			void SaveRouter();
+			const renderer::RenderedMap* renderedMap_;
+			const renderer::StopProjection* stopProjection_;
+			std::optional<std::filesystem::path> routeTableFile_;
+
+			void SaveStrings(google::protobuf::io::CodedOutputStream& output);
+			void SaveStops(google::protobuf::io::CodedOutputStream& output);
+			void SaveBuses(google::protobuf::io::CodedOutputStream& output);
+			void SaveStopToStopDistance(google::protobuf::io::CodedOutputStream& output);
+			void SaveSVGSettings(google::protobuf::io::CodedOutputStream& output);
+			void SaveRoutingSettings(google::protobuf::io::CodedOutputStream& output);
+			void SaveGraph(google::protobuf::io::CodedOutputStream& output);
+			void SaveRouter(google::protobuf::io::CodedOutputStream& output);
+			void SaveRenderedMap(google::protobuf::io::CodedOutputStream& output);
+			void SaveStopProjection(google::protobuf::io::CodedOutputStream& output);
+			void SaveRouteTableFile(google::protobuf::io::CodedOutputStream& output);
 		};
 
 
 		class Deserialize final : public MainSerialize{
 		public:
-			Deserialize(TransportCatalogue& tc, std::filesystem::path&& file);
+			Deserialize(TransportCatalogue& tc, std::filesystem::path&& file,
+				size_t thread_count = std::thread::hardware_concurrency());
 			std::optional<renderer::SVG_Settings> GetSVGSettings() const;
 			std::optional<domain::RoutingSettings> GetRoutingSettings() const;
 			std::vector<graph::Edge<double>>& GetEdges();
 			std::vector<std::vector<size_t>>& GetIncidence_lists();
 			graph::Router<double>::RoutesInternalData& GetRoutesInternalData();
+			std::optional<renderer::RenderedMap>& GetRenderedMap();
+			std::optional<renderer::StopProjection>& GetStopProjection();
+			// Путь к файлу таблицы маршрутов относительно текущего каталога, если таблица хранится вне базы
+			const std::optional<std::filesystem::path>& GetRouteTableFile() const;
 
 			~Deserialize() override;
 
-			void Load();
+			// Загружает только разделы из sections; остальные поля файла пропускаются без разбора.
+			// Возвращает false, если файл не открылся или повреждён; тогда справочник остаётся пустым.
+			bool Load(unsigned sections = ALL_SECTIONS);
 
 		private:
+			// Фрагмент графа, разобранный рабочим потоком. Указатели на маршруты в рёбрах
+			// заполняются после загрузки всех разделов по bus_ids.
+			struct GraphFragment {
+				std::vector<graph::Edge<double>> edges;
+				std::vector<size_t> bus_ids;
+				std::vector<std::vector<size_t>> incidence_lists;
+			};
+
+			// Блок строк таблицы маршрутов, разобранный рабочим потоком
+			struct RouteRowsBlock {
+				size_t first_row = 0;
+				size_t vertex_count = 0;
+				graph::Router<double>::RoutesInternalData rows;
+			};
+
+			size_t thread_count_;
 			std::unordered_map<size_t, std::string_view> stringViewId_;
 			std::vector<graph::Edge<double>> edges_;
 			std::vector<std::vector<size_t>> incidence_lists_;
 			graph::Router<double>::RoutesInternalData routes_internal_data_;
-
-			void LoadStrings();
-			void LoadStops();
-			void LoadBuses();
-			void LoadStopToStopRoute();
-			void LoadSVGSettings();
-			void LoadRoutingSettings();
-			void LoadGraph();
-			void LoadRouter();
+			std::optional<renderer::RenderedMap> renderedMap_;
+			std::optional<renderer::StopProjection> stopProjection_;
+			std::optional<std::filesystem::path> routeTableFile_;
+			bool busesWithoutStatistic_ = false;
+
+			void LoadString(transport_catalogue_serialize::Strings_Stuct& pbString);
+			void LoadStop(const transport_catalogue_serialize::Stop& pbStop);
+			void LoadBus(const transport_catalogue_serialize::Bus& pbBus);
+			void LoadStopToStopRoute(const transport_catalogue_serialize::Stop_to_stop_distance& pbDistance);
+			void LoadSVGSettings(const transport_catalogue_serialize::SVG_Settings& pbSetts);
+			void LoadRoutingSettings(const transport_catalogue_serialize::RoutingSettings& pbRs);
+			void LoadRenderedMap(transport_catalogue_serialize::Rendered_Map& pbMap);
+			void LoadStopProjection(const transport_catalogue_serialize::Stop_Projection& pbProjection);
+			void LoadRouteTableFile(const transport_catalogue_serialize::Route_Table_File& pbTable);
+			static bool DecodeGraph(const std::string& data, GraphFragment& fragment);
+			static bool DecodeRouter(const std::string& data, RouteRowsBlock& block);
+
+			bool ParseSections(std::istream& input, unsigned sections);
+			// Отбрасывает частично загруженные данные вместе с содержимым справочника
+			void Discard();
+			// Собирает разобранные фрагменты графа и таблицы маршрутов, связывает рёбра с маршрутами
+			// и восстанавливает веса маршрутов. Возвращает false, если таблица не согласована с графом
+			// или покрывает не все его вершины.
+			bool LinkFragments(std::deque<GraphFragment>& graphFragments, std::deque<RouteRowsBlock>& routeRowsBlocks);
+			bool IsSectionWanted(int field_number, unsigned sections) const;
 		};
 
 
@@ -0,0 +1,85 @@
+#include "snapshot.h"
+
+#include <future>
+#include <utility>
+
+namespace snapshot {
+	using namespace std;
+
+	CatalogueSnapshot::CatalogueSnapshot(json::Document settings)
+		: reader_(db_)
+	{
+		reader_.GetJsonDoc() = move(settings);
+		loaded_ = reader_.ProcessDeserialization(transport_catalogue::serialize::ALL_SECTIONS);
+	}
+
+	json::Document CatalogueSnapshot::ProcessStatRequests(const json::Node& requests) const
+	{
+		return reader_.ProcessStatRequests(requests);
+	}
+
+	bool CatalogueSnapshot::IsLoaded() const
+	{
+		return loaded_;
+	}
+
+	SnapshotPtr SnapshotHolder::Get() const
+	{
+		return atomic_load(&current_);
+	}
+
+	void SnapshotHolder::Publish(SnapshotPtr snapshot)
+	{
+		atomic_store(&current_, move(snapshot));
+	}
+
+	void Serve(istream& input, ostream& output)
+	{
+		SnapshotHolder holder;
+		future<void> loading;
+		// Повреждённая база не заменяет прежний снимок
+		const auto publish = [&holder](SnapshotPtr snapshot) {
+			if (snapshot->IsLoaded()) {
+				holder.Publish(move(snapshot));
+			}
+		};
+		const auto wait_loading = [&loading] {
+			if (loading.valid()) {
+				loading.get();
+			}
+		};
+
+		while (input >> ws && input.peek() != istream::traits_type::eof()) {
+			json::Document document = json::Load(input);
+			const json::Dict& root = document.GetRoot().AsMap();
+			const bool has_settings = root.count("serialization_settings"s) > 0;
+			auto requests = root.find("stat_requests"s);
+
+			if (has_settings) {
+				// Одновременно загружается не больше одной базы
+				wait_loading();
+				if (requests == root.end()) {
+					loading = async(launch::async, [&publish, document = move(document)]() mutable {
+						publish(make_shared<const CatalogueSnapshot>(move(document)));
+					});
+					continue;
+				}
+				publish(make_shared<const CatalogueSnapshot>(document));
+			}
+			if (requests == root.end()) {
+				continue;
+			}
+
+			SnapshotPtr current = holder.Get();
+			if (!current) {
+				wait_loading();
+				current = holder.Get();
+			}
+			json::Print(current ? current->ProcessStatRequests(requests->second) : json::Document(json::Array{}), output);
+			output << '\n';
+			output.flush();
+		}
+		wait_loading();
+	}
+
+} // namespace snapshot
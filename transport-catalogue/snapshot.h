@@ -0,0 +1,65 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+
+#include "json.h"
+#include "json_reader.h"
+#include "transport_catalogue.h"
+
+namespace snapshot {
+
+	// Снимок базы: справочник, настройки, граф и маршрутизатор. Данные снимка после создания не меняются,
+	// поэтому отвечать по нему на запросы можно из любого числа потоков. Общие ленивые кэши снимка
+	// защищены своими блокировками, и ответ может их брать:
+	// - кэш маршрутов ("route_cache") — запросы Route между остановками, пока кэш включён, и RouteCacheStats;
+	// - проекция остановок — Map, MapTile, MapViewport и запросы с "with_map": true; при первом обращении
+	//   проекция вычисляется под блокировкой, если её нет в базе;
+	// - полная карта — Map и MemoryStats; при первом запросе Map, если карты нет в базе, она отрисовывается
+	//   под блокировкой, и одновременные запросы Map ждут её;
+	// - раскладки карты — MapTile и MapViewport; раскладка уровня строится под блокировкой при первом запросе;
+	// - в режиме "router_mode": "lazy" строка таблицы маршрутов считается один раз (std::call_once),
+	//   и запросы из той же остановки ждут её;
+	// - внешняя таблица маршрутов, если её не удалось отобразить в память, читается из файла под блокировкой.
+	// После первых запросов блокировки кэшей только проверяют готовое значение.
+	class CatalogueSnapshot {
+	public:
+		// Загружает целиком базу из "serialization_settings" документа settings.
+		// Из него же берутся необязательные "render_settings", "route_cache" и "router_mode".
+		explicit CatalogueSnapshot(json::Document settings);
+
+		CatalogueSnapshot(const CatalogueSnapshot&) = delete;
+		CatalogueSnapshot& operator=(const CatalogueSnapshot&) = delete;
+
+		json::Document ProcessStatRequests(const json::Node& requests) const;
+		// false, если база не загрузилась; такой снимок не публикуется
+		bool IsLoaded() const;
+
+	private:
+		transport_catalogue::TransportCatalogue db_;
+		// Ссылается на db_, поэтому объявлен после него
+		jsonReader::JsonReader reader_;
+		bool loaded_ = false;
+	};
+
+	using SnapshotPtr = std::shared_ptr<const CatalogueSnapshot>;
+
+	// Точка публикации снимков по схеме RCU: читатель атомарно берёт текущий снимок и держит его,
+	// пока отвечает на запросы, писатель атомарно подменяет указатель готовым снимком.
+	// Старый снимок освобождается, когда его отпускает последний читатель.
+	class SnapshotHolder {
+	public:
+		SnapshotPtr Get() const;
+		void Publish(SnapshotPtr snapshot);
+
+	private:
+		SnapshotPtr current_;
+	};
+
+	// Режим serve: читает из input JSON-документы один за другим.
+	// Документ только с "serialization_settings" загружает базу в фоновом потоке; пока она загружается,
+	// запросы обслуживаются по прежнему снимку. Документ со "stat_requests" обрабатывается по текущему снимку,
+	// а если снимка ещё нет, то после окончания загрузки. Документ с обоими ключами загружает базу и сразу отвечает по ней.
+	void Serve(std::istream& input, std::ostream& output);
+
+} // namespace snapshot
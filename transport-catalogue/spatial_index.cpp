@@ -0,0 +1,271 @@
+#define _USE_MATH_DEFINES
+#include "spatial_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace spatial {
+	using namespace std;
+
+	namespace {
+		// Длина одного градуса меридиана в метрах (для радиуса Земли из geo.cpp).
+		const double METERS_PER_DEGREE = 6371000. * M_PI / 180.;
+		// Среднее количество остановок на ячейку сетки.
+		const size_t STOPS_PER_CELL = 2;
+		// Среднее количество прямоугольников на ячейку сетки RectIndex.
+		const size_t RECTS_PER_CELL = 4;
+	}
+
+	StopsIndex::StopsIndex(const deque<domain::Stop>& stops)
+	{
+		vector<const domain::Stop*> placed;
+		placed.reserve(stops.size());
+		for (const domain::Stop& stop : stops) {
+			if (!stop.isRaw) {
+				placed.push_back(&stop);
+			}
+		}
+		size_ = placed.size();
+		if (placed.empty()) {
+			return;
+		}
+
+		const auto [bottom_it, top_it] = minmax_element(placed.begin(), placed.end(),
+			[](const domain::Stop* lhs, const domain::Stop* rhs) { return lhs->latitude < rhs->latitude; });
+		const auto [left_it, right_it] = minmax_element(placed.begin(), placed.end(),
+			[](const domain::Stop* lhs, const domain::Stop* rhs) { return lhs->longitude < rhs->longitude; });
+		min_lat_ = (*bottom_it)->latitude;
+		min_lng_ = (*left_it)->longitude;
+		const double max_lat = (*top_it)->latitude;
+		const double max_lng = (*right_it)->longitude;
+
+		const size_t side = max<size_t>(1, static_cast<size_t>(ceil(sqrt(static_cast<double>(size_) / STOPS_PER_CELL))));
+		rows_ = side;
+		cols_ = side;
+		// Небольшой запас, чтобы крайние остановки попадали внутрь сетки.
+		cell_lat_ = max((max_lat - min_lat_) / rows_, 1e-9) * (1 + 1e-9);
+		cell_lng_ = max((max_lng - min_lng_) / cols_, 1e-9) * (1 + 1e-9);
+
+		const double max_abs_lat = max(abs(min_lat_), abs(max_lat));
+		cell_min_meters_ = min(cell_lat_, cell_lng_ * cos(max_abs_lat * M_PI / 180.)) * METERS_PER_DEGREE;
+
+		cells_.resize(rows_ * cols_);
+		for (const domain::Stop* stop : placed) {
+			cells_[RowOf(stop->latitude) * cols_ + ColOf(stop->longitude)].push_back(stop);
+		}
+	}
+
+	vector<const domain::Stop*> StopsIndex::FindNearest(geo::Coordinates point, size_t count) const
+	{
+		vector<pair<double, const domain::Stop*>> candidates;
+		if (count == 0 || size_ == 0) {
+			return {};
+		}
+
+		const long row = static_cast<long>(RowOf(point.lat));
+		const long col = static_cast<long>(ColOf(point.lng));
+		const long max_ring = static_cast<long>(max(rows_, cols_));
+
+		for (long ring = 0; ring <= max_ring; ++ring) {
+			for (long r = row - ring; r <= row + ring; ++r) {
+				if (r < 0 || r >= static_cast<long>(rows_)) {
+					continue;
+				}
+				// Внутренние ряды кольца содержат только две крайние ячейки.
+				const bool edge_row = (r == row - ring || r == row + ring);
+				const long step = edge_row ? 1 : max(2 * ring, 1L);
+				for (long c = col - ring; c <= col + ring; c += step) {
+					if (c < 0 || c >= static_cast<long>(cols_)) {
+						continue;
+					}
+					for (const domain::Stop* stop : cells_[r * cols_ + c]) {
+						candidates.emplace_back(geo::ComputeDistance(point, { stop->latitude, stop->longitude }), stop);
+					}
+				}
+			}
+
+			if (candidates.size() >= count) {
+				nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end(),
+					[](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+				// Ячейки следующего кольца не ближе ring * (размер ячейки).
+				if (candidates[count - 1].first <= ring * cell_min_meters_) {
+					break;
+				}
+			}
+		}
+
+		const size_t result_size = min(count, candidates.size());
+		partial_sort(candidates.begin(), candidates.begin() + result_size, candidates.end(),
+			[](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+		vector<const domain::Stop*> result;
+		result.reserve(result_size);
+		for (size_t i = 0; i < result_size; ++i) {
+			result.push_back(candidates[i].second);
+		}
+		return result;
+	}
+
+	size_t StopsIndex::Size() const
+	{
+		return size_;
+	}
+
+	memory::Usage StopsIndex::GetMemoryUsage() const
+	{
+		size_t bytes = memory::VectorBytes(cells_);
+		for (const vector<const domain::Stop*>& cell : cells_) {
+			bytes += memory::VectorBytes(cell);
+		}
+		return { "stops_index", size_, bytes };
+	}
+
+	size_t StopsIndex::RowOf(double lat) const
+	{
+		const double row = floor((lat - min_lat_) / cell_lat_);
+		return static_cast<size_t>(clamp(row, 0., static_cast<double>(rows_ - 1)));
+	}
+
+	size_t StopsIndex::ColOf(double lng) const
+	{
+		const double col = floor((lng - min_lng_) / cell_lng_);
+		return static_cast<size_t>(clamp(col, 0., static_cast<double>(cols_ - 1)));
+	}
+
+	bool RectIndex::Rect::Intersects(const Rect& other) const
+	{
+		return min_x <= other.max_x && other.min_x <= max_x
+			&& min_y <= other.max_y && other.min_y <= max_y;
+	}
+
+	RectIndex::RectIndex(vector<Rect> rects)
+		: rects_(move(rects))
+	{
+		PrepareCells();
+		for (size_t id = 0; id < rects_.size(); ++id) {
+			const Rect& rect = rects_[id];
+			const size_t last_row = RowOf(rect.max_y);
+			const size_t last_col = ColOf(rect.max_x);
+			for (size_t row = RowOf(rect.min_y); row <= last_row; ++row) {
+				for (size_t col = ColOf(rect.min_x); col <= last_col; ++col) {
+					cells_[row * cols_ + col].push_back(id);
+				}
+			}
+		}
+	}
+
+	RectIndex::RectIndex(const vector<Segment>& segments)
+	{
+		rects_.reserve(segments.size());
+		for (const Segment& segment : segments) {
+			rects_.push_back({ min(segment.x1, segment.x2), min(segment.y1, segment.y2),
+				max(segment.x1, segment.x2), max(segment.y1, segment.y2) });
+		}
+		PrepareCells();
+		for (size_t id = 0; id < segments.size(); ++id) {
+			InsertSegment(id, segments[id]);
+		}
+	}
+
+	void RectIndex::PrepareCells()
+	{
+		if (rects_.empty()) {
+			return;
+		}
+
+		bounds_ = rects_.front();
+		for (const Rect& rect : rects_) {
+			bounds_.min_x = min(bounds_.min_x, rect.min_x);
+			bounds_.min_y = min(bounds_.min_y, rect.min_y);
+			bounds_.max_x = max(bounds_.max_x, rect.max_x);
+			bounds_.max_y = max(bounds_.max_y, rect.max_y);
+		}
+
+		const size_t side = max<size_t>(1, static_cast<size_t>(ceil(sqrt(static_cast<double>(rects_.size()) / RECTS_PER_CELL))));
+		rows_ = side;
+		cols_ = side;
+		cell_width_ = max((bounds_.max_x - bounds_.min_x) / cols_, 1e-9) * (1 + 1e-9);
+		cell_height_ = max((bounds_.max_y - bounds_.min_y) / rows_, 1e-9) * (1 + 1e-9);
+
+		cells_.resize(rows_ * cols_);
+	}
+
+	// Обход ячеек вдоль отрезка (алгоритм Amanatides — Woo): на каждом шаге отрезок
+	// переходит в соседнюю ячейку через ту границу, до которой ему ближе.
+	void RectIndex::InsertSegment(size_t id, const Segment& segment)
+	{
+		size_t row = RowOf(segment.y1);
+		size_t col = ColOf(segment.x1);
+		const size_t last_row = RowOf(segment.y2);
+		const size_t last_col = ColOf(segment.x2);
+
+		const double dx = segment.x2 - segment.x1;
+		const double dy = segment.y2 - segment.y1;
+		const auto firstCrossing = [](double start, double delta, double origin, double cell, size_t index) {
+			if (delta == 0) {
+				return numeric_limits<double>::infinity();
+			}
+			const double border = origin + (delta > 0 ? index + 1 : index) * cell;
+			return (border - start) / delta;
+		};
+		double t_x = firstCrossing(segment.x1, dx, bounds_.min_x, cell_width_, col);
+		double t_y = firstCrossing(segment.y1, dy, bounds_.min_y, cell_height_, row);
+		const double step_t_x = dx == 0 ? numeric_limits<double>::infinity() : cell_width_ / abs(dx);
+		const double step_t_y = dy == 0 ? numeric_limits<double>::infinity() : cell_height_ / abs(dy);
+
+		// Каждый шаг приближает ячейку к последней, поэтому шагов не больше rows_ + cols_
+		for (size_t steps = 0; steps <= rows_ + cols_; ++steps) {
+			cells_[row * cols_ + col].push_back(id);
+			if (row == last_row && col == last_col) {
+				break;
+			}
+			if (t_x < t_y ? col != last_col : row == last_row) {
+				col = dx > 0 ? col + 1 : col - 1;
+				t_x += step_t_x;
+			}
+			else {
+				row = dy > 0 ? row + 1 : row - 1;
+				t_y += step_t_y;
+			}
+		}
+	}
+
+	vector<size_t> RectIndex::Find(const Rect& area) const
+	{
+		vector<size_t> result;
+		if (rects_.empty() || !bounds_.Intersects(area)) {
+			return result;
+		}
+
+		const size_t last_row = RowOf(area.max_y);
+		const size_t last_col = ColOf(area.max_x);
+		for (size_t row = RowOf(area.min_y); row <= last_row; ++row) {
+			for (size_t col = ColOf(area.min_x); col <= last_col; ++col) {
+				for (size_t id : cells_[row * cols_ + col]) {
+					if (rects_[id].Intersects(area)) {
+						result.push_back(id);
+					}
+				}
+			}
+		}
+		// Прямоугольник, задевающий несколько ячеек, найден в каждой из них
+		sort(result.begin(), result.end());
+		result.erase(unique(result.begin(), result.end()), result.end());
+		return result;
+	}
+
+	size_t RectIndex::RowOf(double y) const
+	{
+		const double row = floor((y - bounds_.min_y) / cell_height_);
+		return static_cast<size_t>(clamp(row, 0., static_cast<double>(rows_ - 1)));
+	}
+
+	size_t RectIndex::ColOf(double x) const
+	{
+		const double col = floor((x - bounds_.min_x) / cell_width_);
+		return static_cast<size_t>(clamp(col, 0., static_cast<double>(cols_ - 1)));
+	}
+
+} // namespace spatial
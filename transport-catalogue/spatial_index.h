@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "geo.h"
+#include "domain.h"
+#include "memory_usage.h"
+
+namespace spatial {
+
+	// Пространственный индекс остановок: равномерная сетка по широте и долготе.
+	// Каждая ячейка хранит указатели на остановки, попавшие в неё.
+	// Поиск ближайших остановок обходит ячейки кольцами вокруг точки запроса
+	// и останавливается, как только следующее кольцо заведомо дальше найденных кандидатов.
+	class StopsIndex {
+	public:
+		StopsIndex() = default;
+		explicit StopsIndex(const std::deque<domain::Stop>& stops);
+
+		// Возвращает до count ближайших к точке остановок, упорядоченных по расстоянию.
+		std::vector<const domain::Stop*> FindNearest(geo::Coordinates point, size_t count) const;
+
+		size_t Size() const;
+		memory::Usage GetMemoryUsage() const;
+
+	private:
+		double min_lat_ = 0;
+		double min_lng_ = 0;
+		double cell_lat_ = 1;
+		double cell_lng_ = 1;
+		// Нижняя оценка размера ячейки в метрах, нужна для критерия остановки поиска.
+		double cell_min_meters_ = 0;
+		size_t rows_ = 0;
+		size_t cols_ = 0;
+		size_t size_ = 0;
+		std::vector<std::vector<const domain::Stop*>> cells_;
+
+		size_t RowOf(double lat) const;
+		size_t ColOf(double lng) const;
+	};
+
+	// Равномерная сетка на плоскости для поиска прямоугольников, пересекающих заданную область.
+	// Прямоугольник заносится во все ячейки, которые он задевает, поэтому поиск обходит
+	// только ячейки области и не зависит от общего числа прямоугольников.
+	class RectIndex {
+	public:
+		struct Rect {
+			double min_x = 0;
+			double min_y = 0;
+			double max_x = 0;
+			double max_y = 0;
+
+			bool Intersects(const Rect& other) const;
+		};
+
+		struct Segment {
+			double x1 = 0;
+			double y1 = 0;
+			double x2 = 0;
+			double y2 = 0;
+		};
+
+		RectIndex() = default;
+		// Номер прямоугольника — его позиция в rects
+		explicit RectIndex(std::vector<Rect> rects);
+		// Отрезок заносится только в ячейки, через которые он проходит, а не во все ячейки
+		// своего прямоугольника: длинные диагональные участки иначе заполняют почти всю сетку.
+		// Find находит отрезки по их прямоугольникам.
+		explicit RectIndex(const std::vector<Segment>& segments);
+
+		// Возвращает номера прямоугольников, пересекающих area, по возрастанию и без повторов
+		std::vector<size_t> Find(const Rect& area) const;
+
+	private:
+		std::vector<Rect> rects_;
+		Rect bounds_;
+		double cell_width_ = 1;
+		double cell_height_ = 1;
+		size_t rows_ = 0;
+		size_t cols_ = 0;
+		std::vector<std::vector<size_t>> cells_;
+
+		size_t RowOf(double y) const;
+		size_t ColOf(double x) const;
+		// Вычисляет границы и размер ячеек по rects_
+		void PrepareCells();
+		void InsertSegment(size_t id, const Segment& segment);
+	};
+
+} // namespace spatial
@@ -21,7 +21,7 @@ namespace svg {
         // Делегируем вывод тега своим подклассам
         RenderObject(context);
 
-        context.out << std::endl;
+        context.out << '\n';
     }
 
     // ---------- Circle ------------------
@@ -51,6 +51,11 @@ namespace svg {
         return *this;
     }
 
+    Polyline& Polyline::ClearPoints() {
+        points_.clear();
+        return *this;
+    }
+
     const std::vector<Point>& Polyline::GetPoints() const {
         return points_;
     }
@@ -60,11 +65,11 @@ namespace svg {
         bool first = true;
         out << "<polyline points=\""sv;
         for (const Point& point : points_) {
-            if (!first) out << " ";
-            out << point.x << "," << point.y;
+            if (!first) out << ' ';
+            out << point.x << ',' << point.y;
             first = false;
         }
-        out << "\"";
+        out << '"';
         RenderAttrs(context);
         out << "/>"sv;
     }
@@ -89,27 +94,25 @@ namespace svg {
         return *this;
     }
 
-    Text& Text::SetFontFamily(std::string font_family)
+    Text& Text::SetFontFamily(std::string_view font_family)
     {
-        font_family_ = std::move(font_family);
+        font_family_.assign(font_family);
         return *this;
     }
 
-    Text& Text::SetFontWeight(std::string font_weight)
+    Text& Text::SetFontWeight(std::string_view font_weight)
     {
-        font_weight_ = std::move(font_weight);
+        font_weight_.assign(font_weight);
         return *this;
     }
 
-    Text& Text::SetData(std::string data)
+    Text& Text::SetData(std::string_view data)
     {
-        data_ = std::move(data);
+        data_.assign(data);
         return *this;
     }
 
     void Text::RenderObject(const RenderContext& context) const {
-        std::string safe_data;
-
         auto& out = context.out;
         out << "<text"sv;
         RenderAttrs(context);
@@ -122,34 +125,35 @@ namespace svg {
         if (!font_weight_.empty()) {
             out << " font-weight=\""sv << font_weight_ << "\""sv;
         }
-        out << ">"sv << GetSafeData() << "<"sv;
+        out << ">"sv;
+        RenderSafeData(out);
+        out << "<"sv;
         out << "/text>"sv;
     }
 
-    std::string Text::GetSafeData() const
+    // Выводит текст, экранируя служебные символы xml
+    void Text::RenderSafeData(Output& out) const
     {
-        std::string result;
         for (char c : data_) {
             if (c == '"') {
-                result += "&quot;";
+                out << "&quot;"sv;
             }
             else if (c == '\'') {
-                result += "&apos;";
+                out << "&apos;"sv;
             }
             else if (c == '<') {
-                result += "&lt;";
+                out << "&lt;"sv;
             }
             else if (c == '>') {
-                result += "&gt;";
+                out << "&gt;"sv;
             }
             else if (c == '&') {
-                result += "&amp;";
+                out << "&amp;"sv;
             }
             else {
-                result += c;
+                out << c;
             }
         }
-        return result;
     }
 
     // ---------- Document ------------------
@@ -161,14 +165,37 @@ namespace svg {
 
     void Document::Render(std::ostream& out) const
     {
-        out << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>"sv << std::endl;
-        out << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">"sv << std::endl;
+        std::string buffer;
+        Render(buffer);
+        out << buffer;
+    }
 
+    void Document::Render(std::string& out) const
+    {
+        StreamDocument document(out);
         for (size_t i = 0; i < objects_.size(); ++i) {
-            objects_[i]->Render(RenderContext{ out });
+            document.Add(*objects_[i]);
         }
+        document.Finish();
+    }
+
+    // ---------- StreamDocument ------------------
 
-        out << "</svg>"sv;
+    StreamDocument::StreamDocument(std::string& buffer)
+        : out_(buffer)
+    {
+        out_ << "<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n"sv;
+        out_ << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n"sv;
+    }
+
+    void StreamDocument::Append(std::string_view fragment)
+    {
+        out_ << fragment;
+    }
+
+    void StreamDocument::Finish()
+    {
+        out_ << "</svg>"sv;
     }
 
 }  // namespace svg
@@ -3,10 +3,12 @@
 #define _USE_MATH_DEFINES 
 #include <cmath>
 
+#include <charconv>
 #include <cstdint>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <optional>
 
@@ -45,12 +47,53 @@ namespace svg {
 
 	inline const Color NoneColor{ "none" };
 
+	// Выводит svg в конец строки. Числа форматируются через std::to_chars в том же виде,
+	// что и std::ostream с настройками по умолчанию (6 значащих цифр, как %g), но без
+	// обращения к локали и без промежуточных строк.
+	class Output {
+	public:
+		explicit Output(std::string& buffer)
+			: buffer_(buffer) {
+		}
+
+		Output& operator<<(std::string_view value) {
+			buffer_.append(value);
+			return *this;
+		}
+
+		Output& operator<<(char value) {
+			buffer_.push_back(value);
+			return *this;
+		}
+
+		Output& operator<<(double value) {
+			char digits[32];
+			const std::to_chars_result result = std::to_chars(std::begin(digits), std::end(digits), value, std::chars_format::general, 6);
+			buffer_.append(digits, result.ptr);
+			return *this;
+		}
+
+		Output& operator<<(uint32_t value) {
+			char digits[16];
+			const std::to_chars_result result = std::to_chars(std::begin(digits), std::end(digits), value);
+			buffer_.append(digits, result.ptr);
+			return *this;
+		}
+
+		void put(char value) {
+			buffer_.push_back(value);
+		}
+
+	private:
+		std::string& buffer_;
+	};
+
 	struct RenderContext {
-		RenderContext(std::ostream& out)
+		RenderContext(Output& out)
 			: out(out) {
 		}
 
-		RenderContext(std::ostream& out, int indent_step, int indent = 0)
+		RenderContext(Output& out, int indent_step, int indent = 0)
 			: out(out)
 			, indent_step(indent_step)
 			, indent(indent) {
@@ -66,7 +109,7 @@ namespace svg {
 			}
 		}
 
-		std::ostream& out;
+		Output& out;
 		int indent_step = 0;
 		int indent = 1;
 	};
@@ -104,14 +147,14 @@ namespace svg {
 	class PathProps {
 	public:
 		//задаёт значение свойства fill — цвет заливки. По умолчанию свойство не выводится.
-		Owner& SetFillColor(Color color) {
-			fill_color_ = std::move(color);
+		Owner& SetFillColor(std::string_view color) {
+			AssignColor(fill_color_, color);
 			return AsOwner();
 		}
 
 		// задаёт значение свойства stroke — цвет контура. По умолчанию свойство не выводится.
-		Owner& SetStrokeColor(Color color) {
-			stroke_color_ = std::move(color);
+		Owner& SetStrokeColor(std::string_view color) {
+			AssignColor(stroke_color_, color);
 			return AsOwner();
 		}
 
@@ -170,6 +213,16 @@ namespace svg {
 			// если класс Owner — наследник PathProps
 			return static_cast<Owner&>(*this);
 		}
+
+		// Переиспользует уже выделенную под цвет память, если объект рисуется повторно
+		static void AssignColor(std::optional<Color>& target, std::string_view color) {
+			if (target) {
+				target->assign(color);
+			}
+			else {
+				target.emplace(color);
+			}
+		}
 	};
 
 
@@ -198,6 +251,9 @@ namespace svg {
 		// Добавляет очередную вершину к ломаной линии
 		Polyline& AddPoint(Point point);
 
+		// Удаляет все вершины, сохраняя выделенную под них память
+		Polyline& ClearPoints();
+
 		/*
 		 * Прочие методы и данные, необходимые для реализации элемента <polyline>
 		 */
@@ -225,18 +281,18 @@ namespace svg {
 		Text& SetFontSize(uint32_t size);
 
 		// Задаёт название шрифта (атрибут font-family)
-		Text& SetFontFamily(std::string font_family);
+		Text& SetFontFamily(std::string_view font_family);
 
 		// Задаёт толщину шрифта (атрибут font-weight)
-		Text& SetFontWeight(std::string font_weight);
+		Text& SetFontWeight(std::string_view font_weight);
 
 		// Задаёт текстовое содержимое объекта (отображается внутри тега text)
-		Text& SetData(std::string data);
+		Text& SetData(std::string_view data);
 
 		// Прочие данные и методы, необходимые для реализации элемента <text>
 	private:
 		void RenderObject(const RenderContext& context) const override;
-		std::string GetSafeData() const;
+		void RenderSafeData(Output& out) const;
 
 		Point pos_ = { 0, 0 };
 		Point offset_ = { 0, 0 };
@@ -254,6 +310,8 @@ namespace svg {
 
 		// Выводит в ostream svg-представление документа
 		void Render(std::ostream& out) const;
+		// Дописывает svg-представление документа в конец строки
+		void Render(std::string& out) const;
 
 		// Прочие методы и данные, необходимые для реализации класса Document
 
@@ -262,6 +320,45 @@ namespace svg {
 
 	};
 
+	// Выводит объекты в конец строки без заголовка и закрывающего тега svg.
+	// Части документа, собранные в разных потоках, затем склеиваются через StreamDocument::Append.
+	class StreamFragment {
+	public:
+		explicit StreamFragment(std::string& buffer)
+			: out_(buffer) {
+		}
+
+		template <typename Obj>
+		void Add(const Obj& obj) {
+			obj.Render(RenderContext{ out_ });
+		}
+
+	private:
+		Output out_;
+	};
+
+	// Документ, который выводит объекты в строку сразу при добавлении и не хранит их.
+	// Один и тот же объект можно изменить и добавить снова, не выделяя память заново.
+	class StreamDocument {
+	public:
+		// Дописывает заголовок svg в конец buffer
+		explicit StreamDocument(std::string& buffer);
+
+		template <typename Obj>
+		void Add(const Obj& obj) {
+			obj.Render(RenderContext{ out_ });
+		}
+
+		// Дописывает готовую часть документа, выведенную через StreamFragment
+		void Append(std::string_view fragment);
+
+		// Выводит закрывающий тег, после него объекты добавлять нельзя
+		void Finish();
+
+	private:
+		Output out_;
+	};
+
 }  // namespace svg
 
 
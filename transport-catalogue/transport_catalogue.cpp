@@ -1,5 +1,7 @@
 #include "transport_catalogue.h"
 
+#include <algorithm>
+
 using namespace transport_catalogue;
 using namespace domain;
 
@@ -166,14 +168,191 @@ void TransportCatalogue::AddBus(std::string name, const std::vector<std::string>
 	GetBusStatistic(newBus);
 }
 
+void TransportCatalogue::DetachBusFromStops(const Bus& bus)
+{
+	for (Stop* stop : bus.stop_for_bus_forward) {
+		auto it = stop_to_buses_name_.find(stop);
+		if (it != stop_to_buses_name_.end()) {
+			it->second.erase(bus.name);
+			if (it->second.empty()) {
+				stop_to_buses_name_.erase(it);
+			}
+		}
+	}
+}
+
+Stop* TransportCatalogue::MarkedFinalStop(const Bus& bus)
+{
+	if (!bus.is_ring) {
+		return bus.secondFinalStop;
+	}
+	const auto last = std::find_if(bus.stop_for_bus_forward.rbegin(), bus.stop_for_bus_forward.rend(),
+		[](const Stop* stop) { return stop != nullptr; });
+	return last != bus.stop_for_bus_forward.rend() ? *last : nullptr;
+}
+
+void TransportCatalogue::RefreshFinalStop(Stop* stop)
+{
+	if (stop == nullptr) {
+		return;
+	}
+	stop->isFinalStop = std::any_of(buses_list_.begin(), buses_list_.end(),
+		[stop](const Bus& bus) { return MarkedFinalStop(bus) == stop; });
+}
+
+void TransportCatalogue::UpdateStop(StopToAdd& stop_to_add)
+{
+	auto it = stops_pointers_.find(stop_to_add.stop_name);
+	if (it != stops_pointers_.end()) {
+		Stop* stop = it->second;
+		stop->latitude = stop_to_add.latitude;
+		stop->longitude = stop_to_add.longitude;
+		stop->isRaw = false;
+
+		for (auto it_route = stop_to_stop_route_.begin(); it_route != stop_to_stop_route_.end();) {
+			if (it_route->first.stop_a == stop) {
+				it_route = stop_to_stop_route_.erase(it_route);
+			}
+			else {
+				++it_route;
+			}
+		}
+	}
+	AddStop(stop_to_add);
+}
+
+void TransportCatalogue::UpdateBus(std::string name, const std::vector<std::string>& stopsname, const bool is_ring)
+{
+	auto it = buses_pointers_.find(name);
+	if (it == buses_pointers_.end()) {
+		AddBus(std::move(name), stopsname, is_ring);
+		return;
+	}
+
+	Bus& bus = *it->second;
+	Stop* old_final_stop = MarkedFinalStop(bus);
+	DetachBusFromStops(bus);
+	bus.stop_for_bus_forward.clear();
+	bus.secondFinalStop = nullptr;
+	bus.is_ring = is_ring;
+	bus.distance_by_geo = 0;
+	bus.distance_by_road = 0;
+
+	AddStopToBusWithoutStat(bus, stopsname);
+	// Прежняя конечная остаётся отмеченной, только если на ней заканчивается новый вариант маршрута или другой маршрут
+	RefreshFinalStop(old_final_stop);
+	GetBusStatistic(bus);
+}
+
+bool TransportCatalogue::RemoveBus(const std::string_view name)
+{
+	auto it = buses_pointers_.find(name);
+	if (it == buses_pointers_.end()) {
+		return false;
+	}
+
+	Stop* old_final_stop = MarkedFinalStop(*it->second);
+	DetachBusFromStops(*it->second);
+	buses_list_.erase(buses_list_.begin() + it->second->id);
+	RefreshFinalStop(old_final_stop);
+
+	buses_pointers_.clear();
+	for (size_t id = 0; id < buses_list_.size(); ++id) {
+		buses_list_[id].id = id;
+		buses_pointers_[buses_list_[id].name] = &buses_list_[id];
+	}
+	return true;
+}
+
+bool TransportCatalogue::RemoveStop(const std::string_view name)
+{
+	auto it = stops_pointers_.find(name);
+	if (it == stops_pointers_.end() || stop_to_buses_name_.count(it->second) > 0) {
+		return false;
+	}
+	const size_t removed_id = it->second->id;
+
+	// Удаление из середины дека делает недействительными все указатели на остановки,
+	// поэтому на время удаления связи переводятся в номера остановок
+	const std::vector<StopToStopDistance> distances = GetAllStopToStopDistance();
+	std::vector<std::vector<size_t>> bus_stops;
+	bus_stops.reserve(buses_list_.size());
+	for (const Bus& bus : buses_list_) {
+		std::vector<size_t>& stops = bus_stops.emplace_back();
+		stops.reserve(bus.stop_for_bus_forward.size());
+		for (const Stop* stop : bus.stop_for_bus_forward) {
+			stops.push_back(stop->id);
+		}
+	}
+	std::vector<std::pair<size_t, std::set<std::string_view>>> stop_buses;
+	stop_buses.reserve(stop_to_buses_name_.size());
+	for (auto& [stop, buses] : stop_to_buses_name_) {
+		stop_buses.emplace_back(stop->id, std::move(buses));
+	}
+	std::vector<std::optional<size_t>> second_final_stops;
+	second_final_stops.reserve(buses_list_.size());
+	for (const Bus& bus : buses_list_) {
+		second_final_stops.push_back(bus.secondFinalStop != nullptr ? std::optional<size_t>(bus.secondFinalStop->id) : std::nullopt);
+	}
+
+	stops_list_.erase(stops_list_.begin() + removed_id);
+	const auto shifted = [this, removed_id](size_t id) {
+		return &stops_list_[id > removed_id ? id - 1 : id];
+	};
+
+	stops_pointers_.clear();
+	for (size_t id = 0; id < stops_list_.size(); ++id) {
+		stops_list_[id].id = id;
+		stops_pointers_[stops_list_[id].name] = &stops_list_[id];
+	}
+
+	for (size_t bus_id = 0; bus_id < buses_list_.size(); ++bus_id) {
+		Bus& bus = buses_list_[bus_id];
+		for (size_t i = 0; i < bus.stop_for_bus_forward.size(); ++i) {
+			bus.stop_for_bus_forward[i] = shifted(bus_stops[bus_id][i]);
+		}
+		bus.secondFinalStop = second_final_stops[bus_id] ? shifted(*second_final_stops[bus_id]) : nullptr;
+	}
+
+	stop_to_stop_route_.clear();
+	for (const StopToStopDistance& item : distances) {
+		if (item.stop_a != removed_id && item.stop_b != removed_id) {
+			stop_to_stop_route_[{ shifted(item.stop_a), shifted(item.stop_b) }] = item.distance;
+		}
+	}
+
+	stop_to_buses_name_.clear();
+	for (auto& [stop_id, buses] : stop_buses) {
+		stop_to_buses_name_[shifted(stop_id)] = std::move(buses);
+	}
+	return true;
+}
+
+void TransportCatalogue::RecalculateBusesStatistic()
+{
+	for (Bus& bus : buses_list_) {
+		// Для линейного маршрута AddStopToBusWithoutStat учитывает ещё и расстояние разворота на конечной
+		bus.distance_by_geo = 0;
+		bus.distance_by_road = (!bus.is_ring && bus.secondFinalStop != nullptr)
+			? GetDistanceByRoad(bus.secondFinalStop, bus.secondFinalStop)
+			: 0;
+		GetBusStatistic(bus);
+	}
+}
+
 const BusInfo TransportCatalogue::GetBusInfo(const std::string_view bus_name) const
 {
 	auto it = buses_pointers_.find(bus_name);
 	if (it != buses_pointers_.end()) {
-		Bus* bus = buses_pointers_.find(bus_name)->second;
+		const Bus* bus = it->second;
 
+		// Статистика, не загруженная из базы, считается на копии: запрос не должен менять справочник,
+		// чтобы его можно было читать из нескольких потоков
+		std::optional<Bus> busWithStatistic;
 		if (bus->distance_by_road < 0.001) {
-			GetBusStatistic(*bus);
+			busWithStatistic = *bus;
+			GetBusStatistic(*busWithStatistic);
+			bus = &*busWithStatistic;
 		}
 		std::unordered_set<std::string_view> unique;
 		for (const Stop* item : bus->stop_for_bus_forward) {
@@ -289,6 +468,34 @@ size_t transport_catalogue::TransportCatalogue::StopsCount() const
 	return stops_list_.size();
 }
 
+std::vector<memory::Usage> transport_catalogue::TransportCatalogue::GetMemoryUsage() const
+{
+	size_t string_bytes = memory::HashTableBytes(string_names_);
+	for (const auto& [name, id] : string_names_) {
+		string_bytes += memory::StringBytes(name);
+	}
+
+	size_t bus_bytes = memory::DequeBytes(buses_list_);
+	for (const Bus& bus : buses_list_) {
+		bus_bytes += memory::VectorBytes(bus.stop_for_bus_forward);
+	}
+
+	size_t stop_to_buses_bytes = memory::HashTableBytes(stop_to_buses_name_);
+	for (const auto& [stop, buses] : stop_to_buses_name_) {
+		stop_to_buses_bytes += memory::TreeBytes(buses);
+	}
+
+	return {
+		{ "string_names", string_names_.size(), string_bytes },
+		{ "stops_list", stops_list_.size(), memory::DequeBytes(stops_list_) },
+		{ "buses_list", buses_list_.size(), bus_bytes },
+		{ "buses_pointers", buses_pointers_.size(), memory::HashTableBytes(buses_pointers_) },
+		{ "stops_pointers", stops_pointers_.size(), memory::HashTableBytes(stops_pointers_) },
+		{ "stop_to_buses_name", stop_to_buses_name_.size(), stop_to_buses_bytes },
+		{ "stop_to_stop_route", stop_to_stop_route_.size(), memory::HashTableBytes(stop_to_stop_route_) },
+	};
+}
+
 size_t TransportCatalogue::HasherPairStopStop::operator()(const KeyPairStops& key) const
 {
 	if (key.stop_a != nullptr && key.stop_b != nullptr) {
@@ -11,9 +11,11 @@
 #include <string_view>
 #include <cmath>
 #include <memory>
+#include <optional>
 
 #include"geo.h"
 #include"domain.h"
+#include"memory_usage.h"
 
 namespace transport_catalogue {
 
@@ -46,6 +48,11 @@ namespace transport_catalogue {
 
 		void AddStopToBusWithoutStat(domain::Bus& bus, const std::vector<std::string>& stopsname);
 		void GetBusStatistic(domain::Bus& bus) const;
+		void DetachBusFromStops(const domain::Bus& bus);
+		// Остановка, которую AddStopToBusWithoutStat отмечает конечной для маршрута bus
+		static domain::Stop* MarkedFinalStop(const domain::Bus& bus);
+		// Снимает отметку конечной с остановки stop, если ни один маршрут на ней больше не заканчивается
+		void RefreshFinalStop(domain::Stop* stop);
 
 
 	public:
@@ -53,6 +60,19 @@ namespace transport_catalogue {
 		void AddStop(domain::StopToAdd&);
 		void AddBus(std::string name, const std::vector<std::string>& stopsname, const bool is_ring);
 
+		// Изменение загруженного справочника (режим update_base).
+		// Добавляет остановку или заменяет описание существующей: координаты и расстояния от неё до других остановок.
+		void UpdateStop(domain::StopToAdd&);
+		// Добавляет маршрут или заменяет список остановок существующего, номер маршрута сохраняется.
+		void UpdateBus(std::string name, const std::vector<std::string>& stopsname, const bool is_ring);
+		// Удаляет маршрут. Номера следующих маршрутов сдвигаются, указатели на маршруты становятся недействительными.
+		bool RemoveBus(const std::string_view name);
+		// Удаляет остановку, через которую не проходит ни один маршрут, вместе с расстояниями до неё.
+		// Номера следующих остановок сдвигаются, указатели на остановки становятся недействительными.
+		bool RemoveStop(const std::string_view name);
+		// Пересчитывает длины всех маршрутов после изменения координат или расстояний.
+		void RecalculateBusesStatistic();
+
 		const domain::BusInfo GetBusInfo(const std::string_view) const;
 		const domain::StopInfo GetBusesInStop(const std::string_view) const;
 		const domain::Stop* GetStopByName(const std::string_view) const;
@@ -78,5 +98,8 @@ namespace transport_catalogue {
 
 		const std::unordered_map<std::string, size_t>& GetAllStrings() const;
 
+		// Память, занятая хранилищами и индексами справочника, по отдельности
+		std::vector<memory::Usage> GetMemoryUsage() const;
+
 	};
 }
\ No newline at end of file
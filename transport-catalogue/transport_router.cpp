@@ -1,5 +1,10 @@
 #include "transport_router.h"
 
+#include <numeric>
+#include <tuple>
+
+#include "profiling.h"
+
 namespace transport_router {
 	using namespace std;
 	using namespace domain;
@@ -29,6 +34,11 @@ namespace transport_router {
 		
 	}
 
+	const graph::DirectedWeightedGraph<double>& GraphBuilder::GetGraph() const
+	{
+		return dwGraph_;
+	}
+
 	graph::DirectedWeightedGraph<double>* GraphBuilder::GetGrahpPtr()
 	{
 		return &dwGraph_;
@@ -40,25 +50,123 @@ namespace transport_router {
 			return nullopt;
 		}
 		Route result;
-		const size_t edges_size = routeInfo->edges.size();
-		double total_time = routeInfo->weight;
+		FillRouteItems(routeInfo->weight, routeInfo->edges, result);
+		return result;
+	}
 
-		for (size_t edgeID = 0; edgeID < edges_size; edgeID++) {
-			const graph::Edge edge = dwGraph_.GetEdge(routeInfo->edges[edgeID]);
+	void GraphBuilder::FillRouteItems(double weight, const std::vector<graph::EdgeId>& edges, Route& route) const
+	{
+		route.route_items.clear();
+		// Каждое ребро даёт не больше двух элементов, плюс возможный NoWay
+		route.route_items.reserve(edges.size() * 2 + 1);
+		AppendEdgeItems(edges, route);
+
+		route.total_time = weight;
+		if (route.total_time == 0) {
+			route.route_items.push_back(RouteItem_NoWay{});
+		}
+	}
+
+	void GraphBuilder::AppendEdgeItems(const std::vector<graph::EdgeId>& edges, Route& route) const
+	{
+		for (const graph::EdgeId edgeID : edges) {
+			const graph::Edge<double>& edge = dwGraph_.GetEdge(edgeID);
 
 			if (edge.count > 0) {
-				result.route_items.push_back(RouteItem_Wait{ routing_settings_.bus_wait_time, db_.GetStopByID(edge.from).name});
-				result.route_items.push_back(RouteItem_Bus{ edge.bus->name, edge.weight - routing_settings_.bus_wait_time, edge.count });
+				route.route_items.push_back(RouteItem_Wait{ routing_settings_.bus_wait_time, db_.GetStopByID(edge.from).name});
+				route.route_items.push_back(RouteItem_Bus{ edge.bus->name, edge.weight - routing_settings_.bus_wait_time, edge.count, edge.bus, edge.from, edge.to });
 			}
 			else {
-				result.route_items.push_back(RouteItem_Wait{ routing_settings_.bus_wait_time, db_.GetStopByID(edge.from).name });
+				route.route_items.push_back(RouteItem_Wait{ routing_settings_.bus_wait_time, db_.GetStopByID(edge.from).name });
 			}
 		}
-		result.total_time = total_time;
-		if (result.total_time == 0) {
-			result.route_items.push_back(RouteItem_NoWay{});
+	}
+
+	vector<EdgeKey> GraphBuilder::GetEdgeKeys(const vector<graph::Edge<double>>& edges)
+	{
+		vector<EdgeKey> keys;
+		keys.reserve(edges.size());
+		for (const graph::Edge<double>& edge : edges) {
+			keys.push_back({ edge.bus->id, edge.from, edge.to, edge.count, edge.weight });
+		}
+		return keys;
+	}
+
+	bool GraphBuilder::UpdateRoutes(const vector<EdgeKey>& old_edges, graph::Router<double>::RoutesInternalData& routes_data) const
+	{
+		profiling::Phase phase("router_update"sv);
+		const vector<EdgeKey> new_edges = GetEdgeKeys(dwGraph_.GetEdges());
+		const size_t vertex_count = dwGraph_.GetVertexCount();
+		if (routes_data.size() > vertex_count) {
+			return false;
 		}
-		return result;
+
+		// Рёбра одного маршрута между одними вершинами с одинаковым числом пролётов сопоставляются
+		// по возрастанию веса
+		const auto sorted = [](const vector<EdgeKey>& keys) {
+			vector<graph::EdgeId> order(keys.size());
+			iota(order.begin(), order.end(), 0);
+			sort(order.begin(), order.end(), [&keys](graph::EdgeId lhs, graph::EdgeId rhs) {
+				const EdgeKey& l = keys[lhs];
+				const EdgeKey& r = keys[rhs];
+				return tie(l.bus_id, l.from, l.to, l.count, l.weight) < tie(r.bus_id, r.from, r.to, r.count, r.weight);
+			});
+			return order;
+		};
+		const auto less = [](const EdgeKey& l, const EdgeKey& r) {
+			return tie(l.bus_id, l.from, l.to, l.count) < tie(r.bus_id, r.from, r.to, r.count);
+		};
+		const vector<graph::EdgeId> old_order = sorted(old_edges);
+		const vector<graph::EdgeId> new_order = sorted(new_edges);
+
+		vector<graph::EdgeId> old_to_new(old_edges.size());
+		vector<graph::EdgeId> changed_edges;
+		size_t old_pos = 0;
+		size_t new_pos = 0;
+		while (old_pos < old_order.size()) {
+			const EdgeKey& old_edge = old_edges[old_order[old_pos]];
+			if (new_pos == new_order.size() || less(old_edge, new_edges[new_order[new_pos]])) {
+				return false;
+			}
+			const EdgeKey& new_edge = new_edges[new_order[new_pos]];
+			if (less(new_edge, old_edge)) {
+				changed_edges.push_back(new_order[new_pos++]);
+				continue;
+			}
+			if (new_edge.weight > old_edge.weight) {
+				return false;
+			}
+			if (new_edge.weight < old_edge.weight) {
+				changed_edges.push_back(new_order[new_pos]);
+			}
+			old_to_new[old_order[old_pos++]] = new_order[new_pos++];
+		}
+		changed_edges.insert(changed_edges.end(), new_order.begin() + new_pos, new_order.end());
+
+		// Номер ребра за пределами прежнего графа бывает только в повреждённой таблице: её нужно строить заново.
+		// Проверка идёт до переноса, чтобы при отказе таблица осталась нетронутой
+		for (const auto& row : routes_data) {
+			for (const auto& route : row) {
+				if (route && route->prev_edge && *route->prev_edge >= old_to_new.size()) {
+					return false;
+				}
+			}
+		}
+		for (auto& row : routes_data) {
+			for (auto& route : row) {
+				if (route && route->prev_edge) {
+					route->prev_edge = old_to_new[*route->prev_edge];
+				}
+			}
+			row.resize(vertex_count);
+		}
+		for (size_t vertex = routes_data.size(); vertex < vertex_count; ++vertex) {
+			auto& row = routes_data.emplace_back(vertex_count);
+			row[vertex] = graph::Router<double>::RouteInternalData{ 0, nullopt, 0 };
+		}
+
+		graph::Router<double>::RelaxThroughEdges(dwGraph_, routes_data, changed_edges);
+		return true;
 	}
 
 	double GraphBuilder::TakeWeightEdge(domain::Stop* const stop_a, domain::Stop* const stop_b) const
@@ -70,6 +178,7 @@ namespace transport_router {
 	// Рисует из маршрутов направленный взвешенный граф.
 	void transport_router::GraphBuilder::BuildGraph()
 	{
+		profiling::Phase phase("graph_build"sv);
 		const unordered_map<string_view, domain::Bus*>& allBuses = db_.GetAllBusesRef();
 		for (const auto& [bus_name, bus_ptr] : allBuses) {
 			if (!bus_ptr->is_ring) {
@@ -79,6 +188,8 @@ namespace transport_router {
 				DrawEdgeForRoundRoute(bus_ptr);
 			}
 		}
+		profiling::AddCounter("graph_vertices"sv, dwGraph_.GetVertexCount());
+		profiling::AddCounter("graph_edges"sv, dwGraph_.GetEdgeCount());
 	}
 
 	// Прокладываем ребра между вершинами прямого маршрута
@@ -126,14 +237,31 @@ namespace transport_router {
 		dwGraph_.AddEdge({ stops[0]->id, stops[stopsCount - 1]->id, routing_settings_.bus_wait_time, 0, bus });
 	}
 
-	RouteHandler::RouteHandler(transport_catalogue::TransportCatalogue& db, domain::RoutingSettings& route_sett)
+	RouteHandler::RouteHandler(transport_catalogue::TransportCatalogue& db, domain::RoutingSettings& route_sett, RouterMode mode)
 		: graph_builder_(db, route_sett), db_(db)
 		, routing_settings_(route_sett)
-		, router_(*graph_builder_.GetGrahpPtr())
+		, router_(MakeRouter(*graph_builder_.GetGrahpPtr(), mode))
+		, stops_index_(db.GetStopsList())
+		, route_cache_(DEFAULT_ROUTE_CACHE_CAPACITY)
 	{
 		
 	}
 
+	RouteHandler::RouteHandler(
+		transport_catalogue::TransportCatalogue& db,
+		domain::RoutingSettings& route_sett,
+		GraphBuilder&& graphBuilder,
+		RouterMode mode
+	)
+		: db_(db)
+		, routing_settings_(route_sett)
+		, graph_builder_(forward<GraphBuilder>(graphBuilder))
+		, router_(MakeRouter(*graph_builder_.GetGrahpPtr(), mode))
+		, stops_index_(db.GetStopsList())
+		, route_cache_(DEFAULT_ROUTE_CACHE_CAPACITY)
+	{
+	}
+
 	RouteHandler::RouteHandler(
 		transport_catalogue::TransportCatalogue& db,
 		domain::RoutingSettings& route_sett,
@@ -144,19 +272,187 @@ namespace transport_router {
 		, routing_settings_(route_sett)
 		, graph_builder_(forward<GraphBuilder>(graphBuilder))
 		, router_(*graph_builder_.GetGrahpPtr(), forward<graph::Router<double>::RoutesInternalData>(routes_data))
+		, stops_index_(db.GetStopsList())
+		, route_cache_(DEFAULT_ROUTE_CACHE_CAPACITY)
+	{
+	}
+
+	RouteHandler::RouteHandler(
+		transport_catalogue::TransportCatalogue& db,
+		domain::RoutingSettings& route_sett,
+		GraphBuilder&& graphBuilder,
+		shared_ptr<const graph::Router<double>::ExternalRows> routes_rows
+	)
+		: db_(db)
+		, routing_settings_(route_sett)
+		, graph_builder_(forward<GraphBuilder>(graphBuilder))
+		, router_(*graph_builder_.GetGrahpPtr(), move(routes_rows))
+		, stops_index_(db.GetStopsList())
+		, route_cache_(DEFAULT_ROUTE_CACHE_CAPACITY)
 	{
 	}
 
 
-	optional<Route> RouteHandler::BuildRoute(const std::string_view from_sv, const std::string_view to_sv) const
+	shared_ptr<const Route> RouteHandler::BuildRoute(const std::string_view from_sv, const std::string_view to_sv) const
 	{
 		const domain::Stop* stop_from = db_.GetStopByName(from_sv);
 		const domain::Stop* stop_to = db_.GetStopByName(to_sv);
 		
-		if (stop_from != nullptr && stop_to != nullptr) {
-			return graph_builder_.GetItemsFromRouteInfo(router_.BuildRoute(stop_from->id, stop_to->id));
+		if (stop_from == nullptr || stop_to == nullptr) {
+			return nullptr;
+		}
+
+		const RouteCache::Key key{ stop_from->id, stop_to->id };
+		if (optional<RouteCache::Value> cached = route_cache_.Find(key)) {
+			return *cached;
+		}
+
+		shared_ptr<const Route> result;
+		if (optional<Route> route = graph_builder_.GetItemsFromRouteInfo(router_.BuildRoute(stop_from->id, stop_to->id))) {
+			result = make_shared<const Route>(move(*route));
+		}
+		route_cache_.Insert(key, result);
+		return result;
+	}
+
+	bool RouteHandler::BuildRoute(const std::string_view from_sv, const std::string_view to_sv, RouteBuffers& buffers) const
+	{
+		const domain::Stop* stop_from = db_.GetStopByName(from_sv);
+		const domain::Stop* stop_to = db_.GetStopByName(to_sv);
+
+		if (stop_from == nullptr || stop_to == nullptr) {
+			return false;
+		}
+		const optional<double> weight = router_.BuildRoute(stop_from->id, stop_to->id, buffers.edges);
+		if (!weight) {
+			return false;
+		}
+		graph_builder_.FillRouteItems(*weight, buffers.edges, buffers.route);
+		return true;
+	}
+
+	void RouteHandler::SetRouteCacheCapacity(size_t capacity)
+	{
+		route_cache_.SetCapacity(capacity);
+	}
+
+	RouteCacheStats RouteHandler::GetRouteCacheStats() const
+	{
+		return route_cache_.GetStats();
+	}
+
+	vector<memory::Usage> RouteHandler::GetMemoryUsage() const
+	{
+		vector<memory::Usage> usage = graph_builder_.GetGraph().GetMemoryUsage();
+		usage.push_back(router_.GetMemoryUsage());
+		usage.push_back(stops_index_.GetMemoryUsage());
+		const RouteCacheStats cache = route_cache_.GetStats();
+		usage.push_back({ "route_cache"s, cache.entries, cache.memory_bytes });
+		return usage;
+	}
+
+	bool RouteHandler::IsRouteCacheEnabled() const
+	{
+		return route_cache_.GetStats().capacity > 0;
+	}
+
+	shared_ptr<const Route> RouteHandler::BuildRoute(geo::Coordinates from, geo::Coordinates to, size_t candidates) const
+	{
+		using Router = graph::Router<double>;
+
+		vector<Router::RouteSeed> sources;
+		for (const domain::Stop* stop : stops_index_.FindNearest(from, candidates)) {
+			sources.push_back({ stop->id, WalkTime(from, { stop->latitude, stop->longitude }) });
+		}
+		vector<Router::RouteSeed> targets;
+		for (const domain::Stop* stop : stops_index_.FindNearest(to, candidates)) {
+			targets.push_back({ stop->id, WalkTime({ stop->latitude, stop->longitude }, to) });
+		}
+
+		Route result;
+		const double direct_walk = WalkTime(from, to);
+		const optional<Router::SeededRouteInfo> seeded = router_.BuildRoute(sources, targets);
+
+		// Пешком напрямую может оказаться быстрее любого маршрута с пересадками
+		if (!seeded || direct_walk <= seeded->route.weight) {
+			result.route_items.push_back(RouteItem_Walk{ direct_walk, {}, {} });
+			result.total_time = direct_walk;
+			return make_shared<const Route>(move(result));
+		}
+
+		const domain::Stop& source = db_.GetStopByID(seeded->source);
+		const domain::Stop& target = db_.GetStopByID(seeded->target);
+		result.route_items.push_back(RouteItem_Walk{ WalkTime(from, { source.latitude, source.longitude }), {}, source.name });
+		graph_builder_.AppendEdgeItems(seeded->route.edges, result);
+		result.route_items.push_back(RouteItem_Walk{ WalkTime({ target.latitude, target.longitude }, to), target.name, {} });
+		result.total_time = seeded->route.weight;
+		return make_shared<const Route>(move(result));
+	}
+
+	optional<vector<ReachableStop>> RouteHandler::FindReachableStops(const std::string_view from, double time_budget) const
+	{
+		const domain::Stop* stop_from = db_.GetStopByName(from);
+		if (stop_from == nullptr) {
+			return nullopt;
+		}
+
+		vector<ReachableStop> result;
+		for (const auto& [vertex, time] : router_.FindReachable(stop_from->id, time_budget)) {
+			result.push_back({ &db_.GetStopByID(vertex), time });
+		}
+		return result;
+	}
+
+	TravelTimeMatrix RouteHandler::BuildMatrix(const vector<string_view>& from, const vector<string_view>& to) const
+	{
+		TravelTimeMatrix result;
+		result.sources = from.size();
+		result.targets = to.size();
+		result.total_times.resize(from.size() * to.size());
+
+		vector<const domain::Stop*> targets;
+		targets.reserve(to.size());
+		for (const string_view name : to) {
+			targets.push_back(db_.GetStopByName(name));
+		}
+
+		for (size_t i = 0; i < from.size(); ++i) {
+			const domain::Stop* source = db_.GetStopByName(from[i]);
+			if (source == nullptr) {
+				continue;
+			}
+			for (size_t j = 0; j < targets.size(); ++j) {
+				if (targets[j] != nullptr) {
+					result.total_times[i * result.targets + j] = router_.GetRouteWeight(source->id, targets[j]->id);
+				}
+			}
+		}
+		return result;
+	}
+
+	double RouteHandler::WalkTime(geo::Coordinates from, geo::Coordinates to) const
+	{
+		const double distance = geo::ComputeDistance(from, to) / 1000;
+		return (distance / routing_settings_.pedestrian_velocity) * 60;
+	}
+
+	RouterMode RouteHandler::GetRouterMode() const
+	{
+		if (router_.IsExternal()) {
+			return RouterMode::External;
+		}
+		return router_.IsLazy() ? RouterMode::Lazy : RouterMode::Precomputed;
+	}
+
+	graph::Router<double> RouteHandler::MakeRouter(const graph::DirectedWeightedGraph<double>& graph, RouterMode mode)
+	{
+		if (mode == RouterMode::Lazy) {
+			return graph::Router<double>(graph, graph::Router<double>::LazyRows{});
 		}
-		return nullopt;
+		profiling::Phase phase("router_build"sv);
+		graph::Router<double> router(graph);
+		profiling::AddCounter("router_cells_relaxed"sv, router.GetRelaxedCellCount());
+		return router;
 	}
 
 	graph::Router<double>* RouteHandler::GetRouterPtr()
@@ -15,18 +15,59 @@
 #include "transport_catalogue.h"
 #include "graph.h"
 #include "router.h"
+#include "geo.h"
+#include "spatial_index.h"
+#include "route_cache.h"
 
 namespace transport_router {
 	
-	using Items = std::variant<domain::RouteItem_Wait, domain::RouteItem_Bus, domain::RouteItem_NoWay>;
+	using Items = std::variant<domain::RouteItem_Wait, domain::RouteItem_Bus, domain::RouteItem_NoWay, domain::RouteItem_Walk>;
 
 	class RouteHandler;
 
+	// Precomputed — полная таблица маршрутов строится сразу (Флойд–Уоршелл) или загружается из базы.
+	// Lazy — строка таблицы для остановки отправления вычисляется при первом запросе маршрута из неё.
+	// External — таблица лежит в файле рядом с базой и читается по ячейкам при запросах.
+	enum class RouterMode {
+		Precomputed,
+		Lazy,
+		External,
+	};
+
 	struct Route {
 		std::vector<Items> route_items;
 		double total_time = 0;
 	};
 
+	// Буферы, переиспользуемые между запросами: после прогрева построение маршрута не выделяет память.
+	struct RouteBuffers {
+		std::vector<graph::EdgeId> edges;
+		Route route;
+	};
+
+	// Остановка, достижимая в пределах бюджета времени, и время прибытия на неё.
+	struct ReachableStop {
+		const domain::Stop* stop;
+		double time;
+	};
+
+	// Матрица времён в пути, хранится построчно: ячейка [i * targets + j] — время из i-го источника в j-ю цель.
+	struct TravelTimeMatrix {
+		size_t sources = 0;
+		size_t targets = 0;
+		std::vector<std::optional<double>> total_times;
+	};
+
+	// Ребро графа без указателей на справочник: по таким ключам сопоставляются рёбра графов
+	// до и после обновления базы.
+	struct EdgeKey {
+		size_t bus_id;
+		graph::VertexId from;
+		graph::VertexId to;
+		int count;
+		double weight;
+	};
+
 	class GraphBuilder 
 	{
 	public:
@@ -40,8 +81,20 @@ namespace transport_router {
 			std::vector<std::vector<size_t>>&&
 		);
 		graph::DirectedWeightedGraph<double>* GetGrahpPtr();
+		const graph::DirectedWeightedGraph<double>& GetGraph() const;
 		std::optional<Route> GetItemsFromRouteInfo(const std::optional<graph::Router<double>::RouteInfo>& routeInfo) const;
-		
+		// Добавляет в маршрут элементы Wait/Bus для каждого ребра пути.
+		void AppendEdgeItems(const std::vector<graph::EdgeId>& edges, Route& route) const;
+		// Заполняет маршрут заново, сохраняя ёмкость его буфера элементов.
+		void FillRouteItems(double weight, const std::vector<graph::EdgeId>& edges, Route& route) const;
+
+		static std::vector<EdgeKey> GetEdgeKeys(const std::vector<graph::Edge<double>>& edges);
+
+		// Переносит таблицу маршрутов, построенную для графа с рёбрами old_edges, на текущий граф
+		// и дополняет её через добавленные и подешевевшие рёбра. Возвращает false, не трогая таблицу,
+		// если какое-то ребро исчезло или подорожало: старые пути могут стать недействительными,
+		// и таблицу нужно строить заново. Так же и для таблицы со ссылками на несуществующие рёбра.
+		bool UpdateRoutes(const std::vector<EdgeKey>& old_edges, graph::Router<double>::RoutesInternalData& routes_data) const;
 
 	private:
 		const int TIME_SPAN = 60;
@@ -73,7 +126,19 @@ namespace transport_router {
 		// Конструирует пустой граф и пустой маршрутизатор
 		RouteHandler(
 			transport_catalogue::TransportCatalogue&, 
-			domain::RoutingSettings&
+			domain::RoutingSettings&,
+			RouterMode mode = RouterMode::Precomputed
+		);
+
+		static const size_t DEFAULT_ROUTE_CACHE_CAPACITY = 4096;
+
+		// Конструирует маршрутизатор по готовому графу: таблица маршрутов строится заново (параллельно)
+		// или, в ленивом режиме, по строкам при первых запросах.
+		RouteHandler(
+			transport_catalogue::TransportCatalogue& db,
+			domain::RoutingSettings& route_sett,
+			GraphBuilder&& graphBuilder,
+			RouterMode mode = RouterMode::Precomputed
 		);
 
 		// Конструирует маршрутизатор из готовых (десериализованных) данных.
@@ -84,7 +149,40 @@ namespace transport_router {
 			graph::Router<double>::RoutesInternalData&& routes_data
 		);
 
-		std::optional<Route> BuildRoute(const std::string_view from, const std::string_view to) const;
+		// Конструирует маршрутизатор, читающий таблицу маршрутов из внешнего хранилища, например из файла.
+		RouteHandler(
+			transport_catalogue::TransportCatalogue& db,
+			domain::RoutingSettings& route_sett,
+			GraphBuilder&& graphBuilder,
+			std::shared_ptr<const graph::Router<double>::ExternalRows> routes_rows
+		);
+
+		// Результаты кэшируются по паре остановок; пустой указатель означает, что маршрут не найден.
+		std::shared_ptr<const Route> BuildRoute(const std::string_view from, const std::string_view to) const;
+
+		// Строит маршрут в буферы вызывающей стороны в обход кэша. Возвращает false, если маршрут не найден.
+		bool BuildRoute(const std::string_view from, const std::string_view to, RouteBuffers& buffers) const;
+
+		// Строит маршрут между двумя произвольными точками. В качестве точек посадки и высадки
+		// рассматриваются candidates ближайших остановок, пеший подход учитывается как стоимость
+		// начальных и конечных вершин единственного поиска.
+		std::shared_ptr<const Route> BuildRoute(geo::Coordinates from, geo::Coordinates to, size_t candidates) const;
+
+		// Все остановки, достижимые из from не более чем за time_budget минут. nullopt, если остановка не найдена.
+		std::optional<std::vector<ReachableStop>> FindReachableStops(const std::string_view from, double time_budget) const;
+
+		// Считает только времена в пути для всех пар источник-цель, не восстанавливая маршруты.
+		// Для неизвестных остановок и недостижимых пар ячейка пуста.
+		TravelTimeMatrix BuildMatrix(const std::vector<std::string_view>& from, const std::vector<std::string_view>& to) const;
+
+		// Ёмкость кэша маршрутов в записях, 0 отключает кэш.
+		void SetRouteCacheCapacity(size_t capacity);
+		RouteCacheStats GetRouteCacheStats() const;
+		// Память графа, таблицы маршрутов, индекса остановок и кэша маршрутов
+		std::vector<memory::Usage> GetMemoryUsage() const;
+		bool IsRouteCacheEnabled() const;
+
+		RouterMode GetRouterMode() const;
 
 		graph::Router<double>* GetRouterPtr();
 		graph::DirectedWeightedGraph<double>* GetGrahpPtr();
@@ -94,6 +192,11 @@ namespace transport_router {
 		domain::RoutingSettings& routing_settings_;
 		GraphBuilder graph_builder_;
 		graph::Router<double> router_;
+		spatial::StopsIndex stops_index_;
+		mutable RouteCache route_cache_;
+
+		static graph::Router<double> MakeRouter(const graph::DirectedWeightedGraph<double>& graph, RouterMode mode);
+		double WalkTime(geo::Coordinates from, geo::Coordinates to) const;
 	};
 
 } // namespace transport_router
\ No newline at end of file
@@ -0,0 +1,205 @@
+# Регрессия обновления базы на синтетическом городе: база после make_base и update_base
+# должна отвечать на stat_requests так же, как база, построенная make_base заново
+# по base_requests с теми же изменениями.
+#
+# cmake -DCATALOGUE=<transport_catalogue> -DBENCH=<transport_catalogue_bench> -DWORK_DIR=<каталог> -P update_regression.cmake
+cmake_minimum_required(VERSION 3.19)
+
+foreach(variable CATALOGUE BENCH WORK_DIR)
+	if(NOT DEFINED ${variable})
+		message(FATAL_ERROR "${variable} is not set")
+	endif()
+endforeach()
+
+# Запускает transport_catalogue в режиме mode на документе input, сохранённом в dir/name.json;
+# ответ пишется в dir/name.out
+function(run_catalogue dir mode name input)
+	file(WRITE "${dir}/${name}.json" "${input}")
+	execute_process(COMMAND "${CATALOGUE}" ${mode}
+		WORKING_DIRECTORY "${dir}"
+		INPUT_FILE "${dir}/${name}.json"
+		OUTPUT_FILE "${dir}/${name}.out"
+		ERROR_VARIABLE errors
+		RESULT_VARIABLE result)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "${mode} < ${dir}/${name}.json failed (${result}): ${errors}")
+	endif()
+	# Неподходящая внешняя таблица маршрутов не ломает ответы (маршруты считаются по запросам),
+	# поэтому её отказ проверяется по сообщению
+	if(errors MATCHES "does not match the base")
+		message(FATAL_ERROR "${mode} < ${dir}/${name}.json: ${errors}")
+	endif()
+endfunction()
+
+# Задаёт файл базы в "serialization_settings" документа, сохраняя остальные настройки
+function(with_file document file out_var)
+	string(JSON settings ERROR_VARIABLE no_settings GET "${document}" serialization_settings)
+	if(no_settings)
+		set(settings "{}")
+	endif()
+	string(JSON settings SET "${settings}" file "\"${file}\"")
+	string(JSON document SET "${document}" serialization_settings "${settings}")
+	set(${out_var} "${document}" PARENT_SCOPE)
+endfunction()
+
+# Документ make_base, равный base после применения update_requests update: описания с тем же типом
+# и именем заменяются на месте или удаляются, как это делает update_base, новые добавляются в конец
+function(apply_update base update out_var)
+	string(JSON requests GET "${base}" base_requests)
+	string(JSON update_length LENGTH "${update}")
+	math(EXPR update_last "${update_length} - 1")
+	foreach(update_index RANGE ${update_last})
+		string(JSON item GET "${update}" ${update_index})
+		string(JSON type GET "${item}" type)
+		string(JSON name GET "${item}" name)
+		string(JSON remove ERROR_VARIABLE no_remove GET "${item}" remove)
+		if(no_remove)
+			set(remove OFF)
+		endif()
+
+		string(JSON length LENGTH "${requests}")
+		set(found "")
+		if(length GREATER 0)
+			math(EXPR last "${length} - 1")
+			foreach(index RANGE ${last})
+				string(JSON other_type GET "${requests}" ${index} type)
+				string(JSON other_name GET "${requests}" ${index} name)
+				if(type STREQUAL other_type AND name STREQUAL other_name)
+					set(found ${index})
+					break()
+				endif()
+			endforeach()
+		endif()
+
+		if(remove)
+			if(NOT found STREQUAL "")
+				string(JSON requests REMOVE "${requests}" ${found})
+			endif()
+		elseif(NOT found STREQUAL "")
+			string(JSON requests SET "${requests}" ${found} "${item}")
+		else()
+			string(JSON requests SET "${requests}" ${length} "${item}")
+		endif()
+	endforeach()
+	string(JSON base SET "${base}" base_requests "${requests}")
+	set(${out_var} "${base}" PARENT_SCOPE)
+endfunction()
+
+# Сравнивает ответы базы, обновлённой через update_base, с ответами базы, построенной заново;
+# settings — "serialization_settings" обеих баз в make_base, update_base их не получает
+function(check_update name settings update)
+	set(dir "${WORK_DIR}/${name}")
+	file(MAKE_DIRECTORY "${dir}")
+	string(JSON source SET "${BASE}" serialization_settings "${settings}")
+
+	with_file("${source}" updated.db base)
+	run_catalogue("${dir}" make_base make_updated "${base}")
+	with_file("{\"update_requests\": ${update}}" updated.db update_document)
+	run_catalogue("${dir}" update_base update "${update_document}")
+	with_file("${STAT}" updated.db stat)
+	run_catalogue("${dir}" process_requests stat_updated "${stat}")
+
+	apply_update("${source}" "${update}" rebuilt)
+	with_file("${rebuilt}" rebuilt.db rebuilt)
+	run_catalogue("${dir}" make_base make_rebuilt "${rebuilt}")
+	with_file("${STAT}" rebuilt.db stat)
+	run_catalogue("${dir}" process_requests stat_rebuilt "${stat}")
+
+	file(READ "${dir}/stat_updated.out" updated_answers)
+	file(READ "${dir}/stat_rebuilt.out" rebuilt_answers)
+	if(NOT updated_answers STREQUAL rebuilt_answers)
+		message(FATAL_ERROR "${name}: answers of the updated base differ from a rebuilt one, see ${dir}")
+	endif()
+	message(STATUS "${name}: ok")
+endfunction()
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+execute_process(COMMAND "${BENCH}" --stops 60 --buses 8 --seed 1 --stat-count 200
+	--emit-base "${WORK_DIR}/base.json" --emit-stat "${WORK_DIR}/stat.json"
+	RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+	message(FATAL_ERROR "${BENCH} failed (${result})")
+endif()
+file(READ "${WORK_DIR}/base.json" BASE)
+file(READ "${WORK_DIR}/stat.json" STAT)
+
+# Запросы к остановкам и маршрутам, которые меняются в сценариях
+set(extra_requests
+	"{\"type\": \"Bus\", \"name\": \"Bus New\"}"
+	"{\"type\": \"Stop\", \"name\": \"Stop New\"}"
+	"{\"type\": \"Route\", \"from\": \"Stop New\", \"to\": \"Stop 55\"}"
+	"{\"type\": \"Route\", \"from\": \"Stop 0\", \"to\": \"Stop 47\"}"
+	"{\"type\": \"Bus\", \"name\": \"Bus 4\"}"
+	"{\"type\": \"Bus\", \"name\": \"Bus 7\"}"
+	"{\"type\": \"Stop\", \"name\": \"Stop Temp\"}")
+set(request_id 1000000)
+foreach(request IN LISTS extra_requests)
+	string(JSON length LENGTH "${STAT}" stat_requests)
+	string(JSON request SET "${request}" id ${request_id})
+	string(JSON STAT SET "${STAT}" stat_requests ${length} "${request}")
+	math(EXPR request_id "${request_id} + 1")
+endforeach()
+
+# Рёбра только добавляются: таблица маршрутов дополняется через новые рёбра (GraphBuilder::UpdateRoutes)
+check_update(incremental "{}" [=[[
+	{"type": "Stop", "name": "Stop New", "latitude": 55.775, "longitude": 37.44, "road_distances": {"Stop 8": 700, "Stop 47": 900}},
+	{"type": "Bus", "name": "Bus New", "stops": ["Stop 8", "Stop New", "Stop 47"], "is_roundtrip": false}
+]]=])
+
+# serve в одном потоке документов отвечает по исходной базе, затем загружает обновлённую в фоне
+# и, получив документ с обоими ключами, отвечает по ней так же, как process_requests
+set(dir "${WORK_DIR}/incremental")
+with_file("${BASE}" before.db base)
+run_catalogue("${dir}" make_base make_before "${base}")
+with_file("${STAT}" before.db stat_before)
+run_catalogue("${dir}" process_requests stat_before "${stat_before}")
+with_file("{}" updated.db load_document)
+with_file("${STAT}" updated.db stat)
+run_catalogue("${dir}" serve serve "${stat_before}\n${load_document}\n${stat}\n")
+file(READ "${dir}/stat_before.out" before_answers)
+file(READ "${dir}/stat_rebuilt.out" rebuilt_answers)
+file(READ "${dir}/serve.out" serve_answers)
+if(NOT serve_answers STREQUAL "${before_answers}\n${rebuilt_answers}\n")
+	message(FATAL_ERROR "serve: answers differ from process_requests before and after the update, see ${dir}")
+endif()
+message(STATUS "serve: ok")
+
+# Маршрут изменён, другой маршрут и временная остановка удалены: номера сдвигаются, таблица строится заново
+check_update(rebuild "{}" [=[[
+	{"type": "Stop", "name": "Stop Temp", "latitude": 55.77, "longitude": 37.45, "road_distances": {}},
+	{"type": "Bus", "name": "Bus 4", "stops": ["Stop 17", "Stop 9", "Stop 1", "Stop 0", "Stop 8"], "is_roundtrip": false},
+	{"type": "Bus", "name": "Bus 7", "remove": true},
+	{"type": "Stop", "name": "Stop Temp", "remove": true}
+]]=])
+
+# Таблица во внешнем файле: update_base сохраняет её туда же, process_requests читает её по ячейкам
+check_update(external [=[{"external_router": true}]=] [=[[
+	{"type": "Stop", "name": "Stop New", "latitude": 55.775, "longitude": 37.44, "road_distances": {"Stop 8": 700, "Stop 47": 900}},
+	{"type": "Bus", "name": "Bus New", "stops": ["Stop 8", "Stop New", "Stop 47"], "is_roundtrip": false},
+	{"type": "Bus", "name": "Bus 7", "remove": true}
+]]=])
+foreach(file updated.db.routes rebuilt.db.routes)
+	if(NOT EXISTS "${WORK_DIR}/external/${file}")
+		message(FATAL_ERROR "external: ${file} is not written")
+	endif()
+endforeach()
+
+# Остановку, через которую идут маршруты, удалить нельзя: update_base завершается с ошибкой и не меняет базу
+set(dir "${WORK_DIR}/kept_stop")
+file(MAKE_DIRECTORY "${dir}")
+with_file("${BASE}" kept.db base)
+run_catalogue("${dir}" make_base make "${base}")
+file(SHA256 "${dir}/kept.db" hash_before)
+with_file([=[{"update_requests": [{"type": "Stop", "name": "Stop 8", "remove": true}]}]=] kept.db update_document)
+file(WRITE "${dir}/update.json" "${update_document}")
+execute_process(COMMAND "${CATALOGUE}" update_base
+	WORKING_DIRECTORY "${dir}"
+	INPUT_FILE "${dir}/update.json"
+	OUTPUT_QUIET ERROR_QUIET
+	RESULT_VARIABLE result)
+file(SHA256 "${dir}/kept.db" hash_after)
+if(result EQUAL 0 OR NOT hash_before STREQUAL hash_after)
+	message(FATAL_ERROR "kept_stop: update_base must fail and keep the base when a used stop is removed")
+endif()
+message(STATUS "kept_stop: ok")